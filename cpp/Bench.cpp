@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include "DetourCommon.h"
+#include "DetourNavMesh.h"
+#include "DetourTileCache.h"
+#include "nlohmann/json.hpp"
+#include "NaviAlloc.h"
+#include "Navi.h"
+
+// RecastJniBench [options]
+//   --mesh <file>      tile cache set to load (default: nav_test_obs_navi.bin)
+//   --doors <file>     door file, "" to skip
+//   --regions <file>   region file, "" to skip
+//   --seed <n>         seed of the query workload (default: 1)
+//   --pairs <n>        start/end pairs per workload (default: 1000)
+//   --rounds <n>       times every workload is replayed (default: 5)
+//   --obstacles <n>    obstacle add+refresh samples (default: 100)
+//   --threads <n,..>   scaling mode: run the query mix on each thread count,
+//                      every thread with its own Navi (e.g. 1,2,4,8)
+//   --shared <0|1>     scaling mode: all threads query one thread-safe Navi
+//   --out <file>       write the json report to a file instead of stdout
+struct BenchOptions
+{
+    std::string mesh;
+    std::string doors;
+    std::string regions;
+    unsigned int seed;
+    int pairs;
+    int rounds;
+    int obstacles;
+    std::vector<int> threads;
+    bool shared;
+    std::string out;
+
+    BenchOptions()
+    :mesh(RECAST_BIN"/Output/nav_test_obs_navi.bin")
+    ,doors(RECAST_BIN"/Output/nav_test.door")
+    ,regions(RECAST_BIN"/Output/nav_test.region")
+    ,seed(1)
+    ,pairs(1000)
+    ,rounds(5)
+    ,obstacles(100)
+    ,shared(false)
+    {}
+};
+
+struct QueryPair
+{
+    Vector3 start;
+    Vector3 end;
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+// per thread, so every thread of the scaling mode replays its own seed
+static thread_local std::mt19937 sRandom;
+
+static float BenchRand()
+{
+    // findRandomPoint expects [0, 1), the float distribution may round up to 1
+    const float value = std::uniform_real_distribution<float>(0.0f, 1.0f)(sRandom);
+    return value < 1.0f ? value : std::nextafter(1.0f, 0.0f);
+}
+
+// Collects per call latencies of one operation.
+struct LatencyStats
+{
+    std::string name;
+    std::vector<long long> samples;
+    long long totalNs;
+
+    LatencyStats(const char* inName)
+    :name(inName)
+    ,totalNs(0)
+    {}
+
+    inline void Add(BenchClock::time_point begin, BenchClock::time_point end)
+    {
+        const long long ns = (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+        samples.push_back(ns);
+        totalNs += ns;
+    }
+
+    nlohmann::json ToJson()
+    {
+        nlohmann::json result;
+        result["name"] = name;
+        result["count"] = samples.size();
+        if (samples.empty())
+            return result;
+        std::sort(samples.begin(), samples.end());
+        const size_t count = samples.size();
+        result["p50_ns"] = samples[count / 2];
+        result["p99_ns"] = samples[std::min(count - 1, count * 99 / 100)];
+        result["max_ns"] = samples[count - 1];
+        result["mean_ns"] = totalNs / (long long)count;
+        // operations are interleaved here, so this is the rate implied by the
+        // mean latency, the scaling mode reports measured throughput
+        result["mean_ops_per_sec"] = totalNs > 0 ? (double)count * 1e9 / (double)totalNs : 0.0;
+        return result;
+    }
+};
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            fprintf(stderr, "missing value of %s\n", arg);
+            return false;
+        }
+        ++i;
+        if (!strcmp(arg, "--mesh"))
+            options.mesh = value;
+        else if (!strcmp(arg, "--doors"))
+            options.doors = value;
+        else if (!strcmp(arg, "--regions"))
+            options.regions = value;
+        else if (!strcmp(arg, "--seed"))
+            options.seed = (unsigned int)strtoul(value, nullptr, 10);
+        else if (!strcmp(arg, "--pairs"))
+            options.pairs = atoi(value);
+        else if (!strcmp(arg, "--rounds"))
+            options.rounds = atoi(value);
+        else if (!strcmp(arg, "--obstacles"))
+            options.obstacles = atoi(value);
+        else if (!strcmp(arg, "--threads"))
+        {
+            options.threads.clear();
+            for (const char* it = value; *it; ++it)
+            {
+                const int count = atoi(it);
+                if (count <= 0)
+                {
+                    fprintf(stderr, "invalid thread count in %s\n", value);
+                    return false;
+                }
+                options.threads.push_back(count);
+                while (*it && *it != ',')
+                    ++it;
+                if (!*it)
+                    break;
+            }
+        }
+        else if (!strcmp(arg, "--shared"))
+            options.shared = atoi(value) != 0;
+        else if (!strcmp(arg, "--out"))
+            options.out = value;
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool LoadNavi(Navi& navi, const BenchOptions& options)
+{
+    if (!navi.LoadMesh(options.mesh.c_str(), MAX_SEARCH_POLYS))
+    {
+        fprintf(stderr, "load mesh failed: %s\n", options.mesh.c_str());
+        return false;
+    }
+    if (!options.doors.empty() && !navi.LoadDoors(options.doors.c_str()))
+    {
+        fprintf(stderr, "load doors failed: %s\n", options.doors.c_str());
+        return false;
+    }
+    if (!options.regions.empty() && !navi.LoadRegions(options.regions.c_str()))
+    {
+        fprintf(stderr, "load regions failed: %s\n", options.regions.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Random pairs on the mesh, split by whether FindPath reaches the end.
+static void GeneratePairs(Navi& navi, int pairCount, std::vector<QueryPair>& reachable, std::vector<QueryPair>& unreachable)
+{
+    const int maxAttempts = pairCount * 20;
+    for (int i = 0; i < maxAttempts; ++i)
+    {
+        if ((int)reachable.size() >= pairCount && (int)unreachable.size() >= pairCount)
+            break;
+        QueryPair pair;
+        if (!navi.FindRandomPoint(BenchRand, pair.start) || !navi.FindRandomPoint(BenchRand, pair.end))
+            continue;
+        const int status = navi.FindPath(pair.start, pair.end);
+        const bool reached = dtStatusSucceed(status) && !dtStatusDetail(status, DT_PARTIAL_RESULT);
+        std::vector<QueryPair>& pairs = reached ? reachable : unreachable;
+        if ((int)pairs.size() < pairCount)
+            pairs.push_back(pair);
+    }
+}
+
+// Latency of every operation on a single Navi.
+static bool RunLatency(const BenchOptions& options, nlohmann::json& report)
+{
+    Navi navi(MAX_SEARCH_POLYS, -1);
+    if (!LoadNavi(navi, options))
+        return false;
+    navi.OpenAllDoors(true);
+
+    sRandom.seed(options.seed);
+    std::vector<QueryPair> reachable;
+    std::vector<QueryPair> unreachable;
+    GeneratePairs(navi, options.pairs, reachable, unreachable);
+
+    LatencyStats findReachable("FindPath.reachable");
+    LatencyStats findUnreachable("FindPath.unreachable");
+    LatencyStats raycast("PathRaycast");
+    LatencyStats straight("MakePathStraight");
+    LatencyStats regionId("GetRegionId");
+    LatencyStats passable("IsPassable");
+    LatencyStats obstacle("AddObstacle+RefreshObstacle");
+
+    std::vector<Vector3> pathCopy(navi.GetMaxPolys());
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        for (int i = 0; i < (int)reachable.size(); ++i)
+        {
+            const QueryPair& pair = reachable[i];
+            BenchClock::time_point begin = BenchClock::now();
+            navi.FindPath(pair.start, pair.end);
+            findReachable.Add(begin, BenchClock::now());
+
+            // straighten the found path with every corner doubled
+            int pathCount = 0;
+            const Vector3* path = navi.GetPath();
+            for (int j = 0; j < navi.GetPathCount() && pathCount + 1 < (int)pathCopy.size(); ++j)
+            {
+                pathCopy[pathCount++] = path[j];
+                if (j + 1 < navi.GetPathCount())
+                {
+                    Vector3 mid(path[j]);
+                    mid.Add(path[j + 1]);
+                    mid.Mul(0.5f);
+                    pathCopy[pathCount++] = mid;
+                }
+            }
+            begin = BenchClock::now();
+            navi.MakePathStraight(pathCount, (float*)&pathCopy[0]);
+            straight.Add(begin, BenchClock::now());
+        }
+        for (int i = 0; i < (int)unreachable.size(); ++i)
+        {
+            const QueryPair& pair = unreachable[i];
+            BenchClock::time_point begin = BenchClock::now();
+            navi.FindPath(pair.start, pair.end);
+            findUnreachable.Add(begin, BenchClock::now());
+        }
+        for (int k = 0; k < 2; ++k)
+        {
+            const std::vector<QueryPair>& pairs = k == 0 ? reachable : unreachable;
+            for (int i = 0; i < (int)pairs.size(); ++i)
+            {
+                const QueryPair& pair = pairs[i];
+                BenchClock::time_point begin = BenchClock::now();
+                navi.PathRaycast(pair.start, pair.end);
+                raycast.Add(begin, BenchClock::now());
+
+                begin = BenchClock::now();
+                navi.GetRegionId(pair.start);
+                regionId.Add(begin, BenchClock::now());
+
+                begin = BenchClock::now();
+                navi.IsPassable(pair.start, pair.end);
+                passable.Add(begin, BenchClock::now());
+            }
+        }
+    }
+
+    // obstacles are removed again after each sample so every sample sees the same mesh
+    for (int i = 0; i < options.obstacles; ++i)
+    {
+        Vector3 pos;
+        if (!navi.FindRandomPoint(BenchRand, pos))
+            continue;
+        dtObstacleRef ref = 0;
+        BenchClock::time_point begin = BenchClock::now();
+        dtStatus status = navi.AddObstacle(pos, 1.0f, 2.0f, &ref);
+        navi.RefreshObstacle();
+        obstacle.Add(begin, BenchClock::now());
+        if (dtStatusSucceed(status))
+        {
+            navi.RemoveObstacle(ref);
+            navi.RefreshObstacle();
+        }
+    }
+
+    report["reachable_pairs"] = reachable.size();
+    report["unreachable_pairs"] = unreachable.size();
+    report["memory_bytes"] = navi.GetMemoryUsage();
+    nlohmann::json results = nlohmann::json::array();
+    results.push_back(findReachable.ToJson());
+    results.push_back(findUnreachable.ToJson());
+    results.push_back(raycast.ToJson());
+    results.push_back(straight.ToJson());
+    results.push_back(regionId.ToJson());
+    results.push_back(passable.ToJson());
+    results.push_back(obstacle.ToJson());
+    report["results"] = results;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// Scaling
+// Every thread owns a Navi, or with --shared queries one thread-safe Navi, and
+// replays the same query mix, all threads start together so the measured window
+// only contains queries.
+struct ScalingWorker
+{
+    int index;
+    bool loaded;
+    long long ops;
+    long long memoryBytes;
+    double seconds;
+
+    ScalingWorker()
+    :index(0)
+    ,loaded(false)
+    ,ops(0)
+    ,memoryBytes(0)
+    ,seconds(0)
+    {}
+};
+
+static void RunScalingWorker(const BenchOptions& options, ScalingWorker& worker, Navi* sharedNavi,
+    std::atomic<int>& readyCount, std::atomic<bool>& start)
+{
+    std::unique_ptr<Navi> ownNavi;
+    if (!sharedNavi)
+    {
+        ownNavi.reset(new Navi(MAX_SEARCH_POLYS, -1));
+        worker.loaded = LoadNavi(*ownNavi, options);
+        if (worker.loaded)
+            ownNavi->OpenAllDoors(true);
+    }
+    else
+    {
+        worker.loaded = true;
+    }
+    Navi& navi = sharedNavi ? *sharedNavi : *ownNavi;
+    std::vector<QueryPair> reachable;
+    std::vector<QueryPair> unreachable;
+    if (worker.loaded)
+    {
+        NaviReadLock lock(&navi);
+        sRandom.seed(options.seed + worker.index);
+        GeneratePairs(navi, options.pairs, reachable, unreachable);
+    }
+    readyCount.fetch_add(1);
+    while (!start.load(std::memory_order_acquire))
+        std::this_thread::yield();
+    if (!worker.loaded)
+        return;
+
+    long long ops = 0;
+    BenchClock::time_point begin = BenchClock::now();
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        for (int k = 0; k < 2; ++k)
+        {
+            const std::vector<QueryPair>& pairs = k == 0 ? reachable : unreachable;
+            for (int i = 0; i < (int)pairs.size(); ++i)
+            {
+                const QueryPair& pair = pairs[i];
+                // per query like the JNI layer, a no-op without --shared
+                NaviReadLock lock(&navi);
+                navi.FindPath(pair.start, pair.end);
+                navi.PathRaycast(pair.start, pair.end);
+                navi.IsPassable(pair.start, pair.end);
+                navi.GetRegionId(pair.end);
+                ops += 4;
+            }
+        }
+    }
+    worker.seconds = std::chrono::duration<double>(BenchClock::now() - begin).count();
+    worker.ops = ops;
+    NaviReadLock lock(&navi);
+    worker.memoryBytes = navi.GetMemoryUsage();
+}
+
+static bool RunScaling(const BenchOptions& options, nlohmann::json& report)
+{
+    std::unique_ptr<Navi> sharedNavi;
+    if (options.shared)
+    {
+        sharedNavi.reset(new Navi(MAX_SEARCH_POLYS, -1, true));
+        // a thread-safe navi only has a query context under its lock
+        NaviWriteLock lock(sharedNavi.get());
+        if (!LoadNavi(*sharedNavi, options))
+            return false;
+        sharedNavi->OpenAllDoors(true);
+    }
+
+    nlohmann::json results = nlohmann::json::array();
+    double baseThroughput = 0;
+    for (int t = 0; t < (int)options.threads.size(); ++t)
+    {
+        const int threadCount = options.threads[t];
+        std::vector<ScalingWorker> workers(threadCount);
+        std::vector<std::thread> threads;
+        std::atomic<int> readyCount(0);
+        std::atomic<bool> start(false);
+        for (int i = 0; i < threadCount; ++i)
+        {
+            workers[i].index = i;
+            threads.push_back(std::thread(RunScalingWorker, std::cref(options), std::ref(workers[i]),
+                sharedNavi.get(), std::ref(readyCount), std::ref(start)));
+        }
+        while (readyCount.load() < threadCount)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const long long totalBytes = NaviAllocGetTotalBytes();
+        BenchClock::time_point begin = BenchClock::now();
+        start.store(true, std::memory_order_release);
+        for (int i = 0; i < threadCount; ++i)
+            threads[i].join();
+        const double seconds = std::chrono::duration<double>(BenchClock::now() - begin).count();
+
+        long long ops = 0;
+        nlohmann::json perThread = nlohmann::json::array();
+        for (int i = 0; i < threadCount; ++i)
+        {
+            const ScalingWorker& worker = workers[i];
+            if (!worker.loaded)
+                return false;
+            ops += worker.ops;
+            nlohmann::json item;
+            item["ops"] = worker.ops;
+            item["seconds"] = worker.seconds;
+            item["ops_per_sec"] = worker.seconds > 0 ? worker.ops / worker.seconds : 0.0;
+            item["memory_bytes"] = worker.memoryBytes;
+            perThread.push_back(item);
+        }
+        const double throughput = seconds > 0 ? ops / seconds : 0.0;
+        if (t == 0)
+            baseThroughput = throughput / threadCount;
+        nlohmann::json result;
+        result["threads"] = threadCount;
+        result["ops"] = ops;
+        result["seconds"] = seconds;
+        result["ops_per_sec"] = throughput;
+        // throughput relative to the first thread count, scaled to one thread
+        result["speedup"] = baseThroughput > 0 ? throughput / baseThroughput : 0.0;
+        result["pool_bytes"] = totalBytes;
+        result["per_thread"] = perThread;
+        results.push_back(result);
+    }
+    report["query_mix"] = "FindPath+PathRaycast+IsPassable+GetRegionId";
+    report["shared"] = options.shared;
+    report["scaling"] = results;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options))
+        return 1;
+
+    nlohmann::json report;
+    report["mesh"] = options.mesh;
+    report["seed"] = options.seed;
+    report["rounds"] = options.rounds;
+    const bool success = options.threads.empty() ? RunLatency(options, report) : RunScaling(options, report);
+    if (!success)
+        return 1;
+
+    const std::string text = report.dump(2);
+    if (options.out.empty())
+    {
+        printf("%s\n", text.c_str());
+    }
+    else
+    {
+        std::ofstream write(options.out.c_str());
+        if (!write.is_open())
+        {
+            fprintf(stderr, "cannot write %s\n", options.out.c_str());
+            return 1;
+        }
+        write << text << "\n";
+    }
+    return 0;
+}
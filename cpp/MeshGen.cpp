@@ -0,0 +1,706 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <algorithm>
+#include "DetourCommon.h"
+#include "DetourNavMesh.h"
+#include "DetourTileCache.h"
+#include "DetourTileCacheBuilder.h"
+#include "Recast.h"
+#include "fastlz.h"
+#include "nlohmann/json.hpp"
+#include "Navi.h"
+
+// RecastJniMeshGen [options]
+// Writes <out>.bin (tile cache set), <out>.door and <out>.region of a flat maze
+// in [0, size x] * [0, size z]. Provinces are bands along x separated by walls,
+// doors are gaps in those walls.
+//   --out <prefix>          output path prefix (default: nav_gen)
+//   --size <x> <z>          world size in meters (default: 256 256)
+//   --tiles <x> <z>         tile count along x and z (default: 8 8)
+//   --maze-cell <m>         maze cell size in meters (default: 4)
+//   --density <0..1>        ratio of blocked maze cells (default: 0.25)
+//   --provinces <n>         province count (default: 4)
+//   --doors <n>             door count, spread over the walls between provinces (default: 6)
+//   --region-size <m>       region and region chunk size in meters (default: 64)
+//   --seed <n>              seed of the maze (default: 1)
+//   --cell-size <m>         voxel size (default: 0.3)
+struct GenOptions
+{
+    std::string out;
+    float sizeX;
+    float sizeZ;
+    int tilesX;
+    int tilesZ;
+    float mazeCell;
+    float density;
+    int provinces;
+    int doors;
+    float regionSize;
+    unsigned int seed;
+    float cellSize;
+
+    GenOptions()
+    :out("nav_gen")
+    ,sizeX(256.0f)
+    ,sizeZ(256.0f)
+    ,tilesX(8)
+    ,tilesZ(8)
+    ,mazeCell(4.0f)
+    ,density(0.25f)
+    ,provinces(4)
+    ,doors(6)
+    ,regionSize(64.0f)
+    ,seed(1)
+    ,cellSize(0.3f)
+    {}
+};
+
+// Same layout as the reader in Navi::LoadMesh.
+const int TILECACHESET_MAGIC = 'W'<<24 | 'L'<<16 | 'R'<<8 | 'D';
+const int TILECACHESET_VERSION = 1;
+const int EXPECTED_LAYERS_PER_TILE = 4;
+const int MAX_LAYERS = 32;
+
+const float AGENT_HEIGHT = 2.0f;
+const float AGENT_RADIUS = 0.6f;
+const float AGENT_CLIMB = 0.9f;
+const float AGENT_SLOPE = 45.0f;
+const float CELL_HEIGHT = 0.2f;
+const float DOOR_HEIGHT = 3.0f;
+
+struct TileCacheSetHeader
+{
+    int magic;
+    int version;
+    int numTiles;
+    dtNavMeshParams meshParams;
+    dtTileCacheParams cacheParams;
+};
+
+struct TileCacheTileHeader
+{
+    dtCompressedTileRef tileRef;
+    int dataSize;
+};
+
+// Must match the compressor Navi decompresses with.
+struct FastLZCompressor : public dtTileCacheCompressor
+{
+    virtual ~FastLZCompressor();
+
+    virtual int maxCompressedSize(const int bufferSize)
+    {
+        return (int)(bufferSize* 1.05f);
+    }
+
+    virtual dtStatus compress(const unsigned char* buffer, const int bufferSize,
+                              unsigned char* compressed, const int /*maxCompressedSize*/, int* compressedSize)
+    {
+        *compressedSize = fastlz_compress((const void *const)buffer, bufferSize, compressed);
+        return DT_SUCCESS;
+    }
+
+    virtual dtStatus decompress(const unsigned char* compressed, const int compressedSize,
+                                unsigned char* buffer, const int maxBufferSize, int* bufferSize)
+    {
+        *bufferSize = fastlz_decompress(compressed, compressedSize, buffer, maxBufferSize);
+        return *bufferSize < 0 ? DT_FAILURE : DT_SUCCESS;
+    }
+};
+
+FastLZCompressor::~FastLZCompressor()
+{
+    // Defined out of line to fix the weak v-tables warning
+}
+
+struct GenDoor
+{
+    int id;
+    int cellX;
+    int cellZ;
+    int links[2];
+};
+
+struct GenRegion
+{
+    int id;
+    int province;
+    float minX;
+    float minZ;
+    float maxX;
+    float maxZ;
+};
+
+/////////////////////////////////////////////////////////////////
+// Maze
+// Grid of square cells, a blocked cell has no floor. Cells on the walls
+// between provinces are blocked except the door cells.
+struct Maze
+{
+    int countX;
+    int countZ;
+    float cell;
+    std::vector<unsigned char> blocked;
+    std::vector<int> walls;                 // cell x of the wall between province i + 1 and i + 2
+    std::vector<GenDoor> doors;
+
+    inline bool IsBlocked(int x, int z) const
+    {
+        return blocked[z * countX + x] != 0;
+    }
+
+    bool Build(const GenOptions& options, std::mt19937& random);
+};
+
+bool Maze::Build(const GenOptions& options, std::mt19937& random)
+{
+    cell = options.mazeCell;
+    countX = (int)ceilf(options.sizeX / cell);
+    countZ = (int)ceilf(options.sizeZ / cell);
+    if (countX < options.provinces * 3 || countZ < 3)
+    {
+        fprintf(stderr, "world is too small for %d provinces\n", options.provinces);
+        return false;
+    }
+    if (options.provinces > 1 && options.doors > countZ * (options.provinces - 1))
+    {
+        fprintf(stderr, "too many doors for the walls\n");
+        return false;
+    }
+
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    blocked.resize(countX * countZ);
+    for (int i = 0; i < (int)blocked.size(); ++i)
+        blocked[i] = unit(random) < options.density ? 1 : 0;
+
+    for (int i = 1; i < options.provinces; ++i)
+    {
+        const int wallX = i * countX / options.provinces;
+        walls.push_back(wallX);
+        for (int z = 0; z < countZ; ++z)
+            blocked[z * countX + wallX] = 1;
+    }
+
+    std::uniform_int_distribution<int> pickZ(0, countZ - 1);
+    for (int i = 0; i < options.doors && !walls.empty(); ++i)
+    {
+        const int wall = i % (int)walls.size();
+        const int wallX = walls[wall];
+        int z = pickZ(random);
+        while (!IsBlocked(wallX, z))
+            z = (z + 1) % countZ;
+        GenDoor door;
+        door.id = i + 1;
+        door.cellX = wallX;
+        door.cellZ = z;
+        door.links[0] = wall + 1;
+        door.links[1] = wall + 2;
+        doors.push_back(door);
+
+        // the door and the cells on both sides are always open
+        blocked[z * countX + wallX - 1] = 0;
+        blocked[z * countX + wallX] = 0;
+        blocked[z * countX + wallX + 1] = 0;
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// Tile build
+
+struct TileGeometry
+{
+    std::vector<float> verts;
+    std::vector<int> tris;
+
+    void AddQuad(float x0, float z0, float x1, float z1)
+    {
+        const int base = (int)verts.size() / 3;
+        const float quad[12] = {x0, 0, z0, x0, 0, z1, x1, 0, z1, x1, 0, z0};
+        verts.insert(verts.end(), quad, quad + 12);
+        // wound so the normals point up
+        const int indices[6] = {base, base + 1, base + 2, base, base + 2, base + 3};
+        tris.insert(tris.end(), indices, indices + 6);
+    }
+};
+
+// Floor of the open cells touching [minX, maxX] * [minZ, maxZ], runs of open
+// cells in a row are merged into one quad.
+static void BuildTileGeometry(const Maze& maze, float minX, float minZ, float maxX, float maxZ, TileGeometry& geom)
+{
+    const int x0 = std::max(0, (int)floorf(minX / maze.cell));
+    const int z0 = std::max(0, (int)floorf(minZ / maze.cell));
+    const int x1 = std::min(maze.countX - 1, (int)floorf(maxX / maze.cell));
+    const int z1 = std::min(maze.countZ - 1, (int)floorf(maxZ / maze.cell));
+    for (int z = z0; z <= z1; ++z)
+    {
+        int x = x0;
+        while (x <= x1)
+        {
+            if (maze.IsBlocked(x, z))
+            {
+                ++x;
+                continue;
+            }
+            int end = x;
+            while (end + 1 <= x1 && !maze.IsBlocked(end + 1, z))
+                ++end;
+            geom.AddQuad(x * maze.cell, z * maze.cell, (end + 1) * maze.cell, (z + 1) * maze.cell);
+            x = end + 1;
+        }
+    }
+}
+
+static void GetDoorVerts(const Maze& maze, const GenDoor& door, float* verts)
+{
+    const float x0 = door.cellX * maze.cell;
+    const float z0 = door.cellZ * maze.cell;
+    const float x1 = x0 + maze.cell;
+    const float z1 = z0 + maze.cell;
+    const float quad[12] = {x0, 0, z0, x1, 0, z0, x1, 0, z1, x0, 0, z1};
+    memcpy(verts, quad, sizeof(quad));
+}
+
+// Rasterizes one tile and adds its layers to the tile cache, returns the layer count or -1.
+static int BuildTileLayers(rcContext* ctx, const rcConfig& baseCfg, const Maze& maze, FastLZCompressor* comp,
+    dtTileCache* tileCache, const float* orig, int tx, int ty)
+{
+    rcConfig cfg = baseCfg;
+    const float tcs = cfg.tileSize * cfg.cs;
+    cfg.bmin[0] = orig[0] + tx * tcs;
+    cfg.bmin[1] = orig[1];
+    cfg.bmin[2] = orig[2] + ty * tcs;
+    cfg.bmax[0] = orig[0] + (tx + 1) * tcs;
+    cfg.bmax[1] = orig[1] + DOOR_HEIGHT * 2;
+    cfg.bmax[2] = orig[2] + (ty + 1) * tcs;
+    cfg.bmin[0] -= cfg.borderSize * cfg.cs;
+    cfg.bmin[2] -= cfg.borderSize * cfg.cs;
+    cfg.bmax[0] += cfg.borderSize * cfg.cs;
+    cfg.bmax[2] += cfg.borderSize * cfg.cs;
+
+    TileGeometry geom;
+    BuildTileGeometry(maze, cfg.bmin[0], cfg.bmin[2], cfg.bmax[0], cfg.bmax[2], geom);
+    if (geom.tris.empty())
+        return 0;
+    const int vertCount = (int)geom.verts.size() / 3;
+    const int triCount = (int)geom.tris.size() / 3;
+
+    int layerCount = -1;
+    rcHeightfield* solid = nullptr;
+    rcCompactHeightfield* chf = nullptr;
+    rcHeightfieldLayerSet* lset = nullptr;
+    std::vector<unsigned char> triAreas(triCount, 0);
+    do
+    {
+        solid = rcAllocHeightfield();
+        if (!solid || !rcCreateHeightfield(ctx, *solid, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch))
+            break;
+        rcMarkWalkableTriangles(ctx, cfg.walkableSlopeAngle, &geom.verts[0], vertCount, &geom.tris[0], triCount, &triAreas[0]);
+        if (!rcRasterizeTriangles(ctx, &geom.verts[0], vertCount, &geom.tris[0], &triAreas[0], triCount, *solid, cfg.walkableClimb))
+            break;
+        rcFilterLowHangingWalkableObstacles(ctx, cfg.walkableClimb, *solid);
+        rcFilterLedgeSpans(ctx, cfg.walkableHeight, cfg.walkableClimb, *solid);
+        rcFilterWalkableLowHeightSpans(ctx, cfg.walkableHeight, *solid);
+
+        chf = rcAllocCompactHeightfield();
+        if (!chf || !rcBuildCompactHeightfield(ctx, cfg.walkableHeight, cfg.walkableClimb, *solid, *chf))
+            break;
+        if (!rcErodeWalkableArea(ctx, cfg.walkableRadius, *chf))
+            break;
+        for (int i = 0; i < (int)maze.doors.size(); ++i)
+        {
+            float verts[12];
+            GetDoorVerts(maze, maze.doors[i], verts);
+            if (verts[3] < cfg.bmin[0] || verts[0] > cfg.bmax[0] || verts[8] < cfg.bmin[2] || verts[2] > cfg.bmax[2])
+                continue;
+            rcMarkConvexPolyArea(ctx, verts, 4, -1.0f, DOOR_HEIGHT, POLYAREA_DOOR, *chf);
+        }
+
+        lset = rcAllocHeightfieldLayerSet();
+        if (!lset || !rcBuildHeightfieldLayers(ctx, *chf, cfg.borderSize, cfg.walkableHeight, *lset))
+            break;
+
+        layerCount = 0;
+        for (int i = 0; i < std::min(lset->nlayers, MAX_LAYERS); ++i)
+        {
+            const rcHeightfieldLayer* layer = &lset->layers[i];
+            dtTileCacheLayerHeader header;
+            header.magic = DT_TILECACHE_MAGIC;
+            header.version = DT_TILECACHE_VERSION;
+            header.tx = tx;
+            header.ty = ty;
+            header.tlayer = i;
+            dtVcopy(header.bmin, layer->bmin);
+            dtVcopy(header.bmax, layer->bmax);
+            header.width = (unsigned char)layer->width;
+            header.height = (unsigned char)layer->height;
+            header.minx = (unsigned char)layer->minx;
+            header.maxx = (unsigned char)layer->maxx;
+            header.miny = (unsigned char)layer->miny;
+            header.maxy = (unsigned char)layer->maxy;
+            header.hmin = (unsigned short)layer->hmin;
+            header.hmax = (unsigned short)layer->hmax;
+
+            unsigned char* data = nullptr;
+            int dataSize = 0;
+            dtStatus status = dtBuildTileCacheLayer(comp, &header, layer->heights, layer->areas, layer->cons, &data, &dataSize);
+            if (dtStatusFailed(status))
+            {
+                layerCount = -1;
+                break;
+            }
+            status = tileCache->addTile(data, dataSize, DT_COMPRESSEDTILE_FREE_DATA, nullptr);
+            if (dtStatusFailed(status))
+            {
+                dtFree(data);
+                layerCount = -1;
+                break;
+            }
+            ++layerCount;
+        }
+    } while (false);
+
+    rcFreeHeightfieldLayerSet(lset);
+    rcFreeCompactHeightfield(chf);
+    rcFreeHeightField(solid);
+    return layerCount;
+}
+
+static bool WriteTileCacheSet(const char* path, const dtTileCache* tileCache, const dtNavMesh* navMesh)
+{
+    FILE* fp = fopen(path, "wb");
+    if (!fp)
+        return false;
+
+    TileCacheSetHeader header;
+    header.magic = TILECACHESET_MAGIC;
+    header.version = TILECACHESET_VERSION;
+    header.numTiles = 0;
+    for (int i = 0; i < tileCache->getTileCount(); ++i)
+    {
+        const dtCompressedTile* tile = tileCache->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize)
+            continue;
+        header.numTiles++;
+    }
+    memcpy(&header.cacheParams, tileCache->getParams(), sizeof(dtTileCacheParams));
+    memcpy(&header.meshParams, navMesh->getParams(), sizeof(dtNavMeshParams));
+    fwrite(&header, sizeof(TileCacheSetHeader), 1, fp);
+
+    for (int i = 0; i < tileCache->getTileCount(); ++i)
+    {
+        const dtCompressedTile* tile = tileCache->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize)
+            continue;
+        TileCacheTileHeader tileHeader;
+        tileHeader.tileRef = tileCache->getTileRef(tile);
+        tileHeader.dataSize = tile->dataSize;
+        fwrite(&tileHeader, sizeof(tileHeader), 1, fp);
+        fwrite(tile->data, tile->dataSize, 1, fp);
+    }
+    const bool success = !ferror(fp);
+    fclose(fp);
+    return success;
+}
+
+/////////////////////////////////////////////////////////////////
+// Door and region files
+
+static bool WriteDoors(const char* path, const Maze& maze)
+{
+    nlohmann::json volumes = nlohmann::json::array();
+    for (int i = 0; i < (int)maze.doors.size(); ++i)
+    {
+        const GenDoor& door = maze.doors[i];
+        float verts[12];
+        GetDoorVerts(maze, door, verts);
+        nlohmann::json volume;
+        volume["id"] = door.id;
+        volume["verts"] = nlohmann::json::array();
+        for (int j = 0; j < 4; ++j)
+            volume["verts"].push_back({verts[j * 3], verts[j * 3 + 1], verts[j * 3 + 2]});
+        volume["link"] = {door.links[0], door.links[1]};
+        volumes.push_back(volume);
+    }
+    nlohmann::json data;
+    data["volumes"] = volumes;
+    std::ofstream write(path);
+    if (!write.is_open())
+        return false;
+    write << data.dump(2) << "\n";
+    return true;
+}
+
+// One region per province band and region-size stripe along z, indexed by a
+// grid of region-size chunks starting at the origin.
+static bool WriteRegions(const char* path, const Maze& maze, const GenOptions& options)
+{
+    std::vector<float> bandEdges;
+    bandEdges.push_back(0.0f);
+    for (int i = 0; i < (int)maze.walls.size(); ++i)
+        bandEdges.push_back(maze.walls[i] * maze.cell);
+    bandEdges.push_back(maze.countX * maze.cell);
+    const float worldZ = maze.countZ * maze.cell;
+
+    std::vector<GenRegion> regions;
+    for (int band = 0; band + 1 < (int)bandEdges.size(); ++band)
+    {
+        for (float z = 0.0f; z < worldZ; z += options.regionSize)
+        {
+            GenRegion region;
+            region.id = (int)regions.size() + 1;
+            region.province = band + 1;
+            region.minX = bandEdges[band];
+            region.maxX = bandEdges[band + 1];
+            region.minZ = z;
+            region.maxZ = std::min(z + options.regionSize, worldZ);
+            regions.push_back(region);
+        }
+    }
+
+    const float chunkSize = options.regionSize;
+    const int xCount = (int)ceilf(maze.countX * maze.cell / chunkSize);
+    const int zCount = (int)ceilf(worldZ / chunkSize);
+    std::vector<std::vector<int>> grid(xCount * zCount);
+    nlohmann::json volumes = nlohmann::json::array();
+    for (int i = 0; i < (int)regions.size(); ++i)
+    {
+        const GenRegion& region = regions[i];
+        nlohmann::json volume;
+        volume["id"] = region.id;
+        volume["province"] = region.province;
+        // counter clockwise, as GameVolume::IsContain expects
+        volume["verts"] = {
+            {region.minX, 0.0f, region.minZ},
+            {region.maxX, 0.0f, region.minZ},
+            {region.maxX, 0.0f, region.maxZ},
+            {region.minX, 0.0f, region.maxZ}};
+        volumes.push_back(volume);
+
+        const int cx0 = (int)(region.minX / chunkSize);
+        const int cz0 = (int)(region.minZ / chunkSize);
+        const int cx1 = std::min(xCount - 1, (int)ceilf(region.maxX / chunkSize) - 1);
+        const int cz1 = std::min(zCount - 1, (int)ceilf(region.maxZ / chunkSize) - 1);
+        for (int cz = cz0; cz <= cz1; ++cz)
+        {
+            for (int cx = cx0; cx <= cx1; ++cx)
+                grid[cz * xCount + cx].push_back(region.id);
+        }
+    }
+
+    nlohmann::json data;
+    data["info"]["type"] = 2;
+    data["info"]["xCount"] = xCount;
+    data["info"]["zCount"] = zCount;
+    data["info"]["xCellSize"] = chunkSize;
+    data["info"]["zCellSize"] = chunkSize;
+    data["volumes"] = volumes;
+    data["region"] = grid;
+    std::ofstream write(path);
+    if (!write.is_open())
+        return false;
+    write << data.dump() << "\n";
+    return true;
+}
+
+static bool ParseOptions(int argc, char* argv[], GenOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const bool pair = !strcmp(arg, "--size") || !strcmp(arg, "--tiles");
+        if (i + (pair ? 2 : 1) >= argc)
+        {
+            fprintf(stderr, "missing value of %s\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+        if (!strcmp(arg, "--out"))
+            options.out = value;
+        else if (!strcmp(arg, "--size"))
+        {
+            options.sizeX = (float)atof(value);
+            options.sizeZ = (float)atof(argv[++i]);
+        }
+        else if (!strcmp(arg, "--tiles"))
+        {
+            options.tilesX = atoi(value);
+            options.tilesZ = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--maze-cell"))
+            options.mazeCell = (float)atof(value);
+        else if (!strcmp(arg, "--density"))
+            options.density = (float)atof(value);
+        else if (!strcmp(arg, "--provinces"))
+            options.provinces = atoi(value);
+        else if (!strcmp(arg, "--doors"))
+            options.doors = atoi(value);
+        else if (!strcmp(arg, "--region-size"))
+            options.regionSize = (float)atof(value);
+        else if (!strcmp(arg, "--seed"))
+            options.seed = (unsigned int)strtoul(value, nullptr, 10);
+        else if (!strcmp(arg, "--cell-size"))
+            options.cellSize = (float)atof(value);
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return false;
+        }
+    }
+    if (options.sizeX <= 0 || options.sizeZ <= 0 || options.tilesX <= 0 || options.tilesZ <= 0 ||
+        options.mazeCell < AGENT_RADIUS * 4 || options.provinces <= 0 || options.doors < 0 ||
+        options.regionSize <= 0 || options.cellSize <= 0)
+    {
+        fprintf(stderr, "invalid options\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    GenOptions options;
+    if (!ParseOptions(argc, argv, options))
+        return 1;
+
+    std::mt19937 random(options.seed);
+    Maze maze;
+    if (!maze.Build(options, random))
+        return 1;
+
+    // square tiles covering the larger of the two axes
+    const float tileWorld = std::max(options.sizeX / options.tilesX, options.sizeZ / options.tilesZ);
+    const int tileSize = (int)ceilf(tileWorld / options.cellSize);
+    if (tileSize > 255)
+    {
+        fprintf(stderr, "tile is %d voxels wide, at most 255, use more tiles or a larger cell size\n", tileSize);
+        return 1;
+    }
+
+    rcConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.cs = options.cellSize;
+    cfg.ch = CELL_HEIGHT;
+    cfg.walkableSlopeAngle = AGENT_SLOPE;
+    cfg.walkableHeight = (int)ceilf(AGENT_HEIGHT / cfg.ch);
+    cfg.walkableClimb = (int)floorf(AGENT_CLIMB / cfg.ch);
+    cfg.walkableRadius = (int)ceilf(AGENT_RADIUS / cfg.cs);
+    cfg.maxEdgeLen = (int)(12.0f / cfg.cs);
+    cfg.maxSimplificationError = 1.3f;
+    cfg.minRegionArea = 8 * 8;
+    cfg.mergeRegionArea = 20 * 20;
+    cfg.maxVertsPerPoly = 6;
+    cfg.tileSize = tileSize;
+    cfg.borderSize = cfg.walkableRadius + 3;
+    cfg.width = cfg.tileSize + cfg.borderSize * 2;
+    cfg.height = cfg.tileSize + cfg.borderSize * 2;
+    cfg.detailSampleDist = cfg.cs * 6.0f;
+    cfg.detailSampleMaxError = cfg.ch * 1.0f;
+
+    const float orig[3] = {0.0f, -1.0f, 0.0f};
+    const int tw = (int)ceilf(maze.countX * maze.cell / (tileSize * cfg.cs));
+    const int th = (int)ceilf(maze.countZ * maze.cell / (tileSize * cfg.cs));
+
+    dtTileCacheParams tcparams;
+    memset(&tcparams, 0, sizeof(tcparams));
+    dtVcopy(tcparams.orig, orig);
+    tcparams.cs = cfg.cs;
+    tcparams.ch = cfg.ch;
+    tcparams.width = tileSize;
+    tcparams.height = tileSize;
+    tcparams.walkableHeight = AGENT_HEIGHT;
+    tcparams.walkableRadius = AGENT_RADIUS;
+    tcparams.walkableClimb = AGENT_CLIMB;
+    tcparams.maxSimplificationError = cfg.maxSimplificationError;
+    tcparams.maxTiles = tw * th * EXPECTED_LAYERS_PER_TILE;
+    tcparams.maxObstacles = 128;
+
+    dtNavMeshParams params;
+    memset(&params, 0, sizeof(params));
+    dtVcopy(params.orig, orig);
+    params.tileWidth = tileSize * cfg.cs;
+    params.tileHeight = tileSize * cfg.cs;
+    params.maxTiles = (int)dtNextPow2((unsigned int)(tw * th * EXPECTED_LAYERS_PER_TILE));
+    params.maxPolys = 1 << 16;
+
+    rcContext ctx(false);
+    FastLZCompressor comp;
+    dtTileCacheAlloc talloc;
+    dtTileCache* tileCache = dtAllocTileCache();
+    dtNavMesh* navMesh = dtAllocNavMesh();
+    int result = 1;
+    do
+    {
+        if (!tileCache || dtStatusFailed(tileCache->init(&tcparams, &talloc, &comp, nullptr)))
+        {
+            fprintf(stderr, "init tile cache failed\n");
+            break;
+        }
+        if (!navMesh || dtStatusFailed(navMesh->init(&params)))
+        {
+            fprintf(stderr, "init nav mesh failed\n");
+            break;
+        }
+
+        int layerCount = 0;
+        bool success = true;
+        for (int y = 0; y < th && success; ++y)
+        {
+            for (int x = 0; x < tw && success; ++x)
+            {
+                const int layers = BuildTileLayers(&ctx, cfg, maze, &comp, tileCache, orig, x, y);
+                if (layers < 0)
+                {
+                    fprintf(stderr, "build tile %d,%d failed\n", x, y);
+                    success = false;
+                    break;
+                }
+                layerCount += layers;
+                tileCache->buildNavMeshTilesAt(x, y, navMesh);
+            }
+        }
+        if (!success)
+            break;
+
+        // poly count of the mesh Navi will build from the set
+        int polyCount = 0;
+        for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+        {
+            const dtMeshTile* tile = navMesh->getTile(i);
+            if (tile && tile->header)
+                polyCount += tile->header->polyCount;
+        }
+
+        const std::string meshPath = options.out + ".bin";
+        const std::string doorPath = options.out + ".door";
+        const std::string regionPath = options.out + ".region";
+        if (!WriteTileCacheSet(meshPath.c_str(), tileCache, navMesh))
+        {
+            fprintf(stderr, "cannot write %s\n", meshPath.c_str());
+            break;
+        }
+        if (!WriteDoors(doorPath.c_str(), maze))
+        {
+            fprintf(stderr, "cannot write %s\n", doorPath.c_str());
+            break;
+        }
+        if (!WriteRegions(regionPath.c_str(), maze, options))
+        {
+            fprintf(stderr, "cannot write %s\n", regionPath.c_str());
+            break;
+        }
+        printf("tiles %dx%d (%d voxels), layers %d, polys %d, doors %d, provinces %d\n",
+            tw, th, tileSize, layerCount, polyCount, (int)maze.doors.size(), options.provinces);
+        result = 0;
+    } while (false);
+
+    dtFreeNavMesh(navMesh);
+    dtFreeTileCache(tileCache);
+    return result;
+}
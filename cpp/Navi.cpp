@@ -6,6 +6,8 @@
 #include "DetourNavMesh.h"
 #include "DetourNavMeshBuilder.h"
 #include "DetourNavMeshQuery.h"
+#include "DetourNode.h"
+#include "DetourCrowd.h"
 #include "DetourTileCache.h"
 #include "DetourTileCacheBuilder.h"
 #include "Recast.h"
@@ -13,7 +15,17 @@
 #include "Filelist.h"
 #include "nlohmann/json.hpp"
 #include <fstream>
+#include <new>
+#include <climits>
+#include <queue>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <cmath>
 #include "Util.h"
+#include "NaviAlloc.h"
+#include "NaviGraph.h"
 #include "Navi.h"
 
 // check if is 64bit
@@ -24,6 +36,17 @@ COMPILE_TEST(POLY_REF_SIZE, sizeof(dtPolyRef) == 8);
 const int TILECACHESET_MAGIC = 'W'<<24 | 'L'<<16 | 'R'<<8 | 'D';
 const int TILECACHESET_VERSION = 1;
 
+// Innermost query context binding of the calling thread, see NaviQueryBinding.
+thread_local NaviQueryBinding* tlQueryBinding = nullptr;
+// Context without buffers handed out when none is bound, PrepareQuery fails on it.
+thread_local NaviQueryContext tlEmptyQueryContext;
+
+static inline long long StatNow()
+{
+    return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 /////////////////////////////////////////////////////////////////
 // GameVolume
 void GameVolume::CalcAABB()
@@ -118,14 +141,27 @@ FastLZCompressor::~FastLZCompressor()
 
 /////////////////////////////////////////////////////////////////
 // LinearAllocator
+// Bump allocator used by dtTileCache while rebuilding a tile. Memory handed
+// out between two reset() calls must stay valid, so a request that does not
+// fit in the main buffer is served from an overflow chunk instead of failing.
+// On the next reset() the main buffer is regrown to cover the high-water mark,
+// so steady state rebuilds never touch the overflow chunks again.
 struct LinearAllocator : public dtTileCacheAlloc
 {
     unsigned char* buffer;
     size_t capacity;
     size_t top;
     size_t high;
+    size_t chunkSize;
+    size_t overflowTop;
+    size_t overflowCap;
+    size_t overflowUsed;
+    int growCount;
+    std::vector<unsigned char*> overflows;
     
-    LinearAllocator(const size_t cap) : buffer(0), capacity(0), top(0), high(0)
+    LinearAllocator(const size_t cap, const size_t chunk)
+    : buffer(0), capacity(0), top(0), high(0), chunkSize(chunk)
+    , overflowTop(0), overflowCap(0), overflowUsed(0), growCount(0)
     {
         resize(cap);
     }
@@ -136,23 +172,61 @@ struct LinearAllocator : public dtTileCacheAlloc
     {
         if (buffer) dtFree(buffer);
         buffer = (unsigned char*)dtAlloc(cap, DT_ALLOC_PERM);
-        capacity = cap;
+        capacity = buffer ? cap : 0;
+        top = 0;
+    }
+    
+    void freeOverflows()
+    {
+        for (int i = 0; i < (int)overflows.size(); ++i)
+            dtFree(overflows[i]);
+        overflows.clear();
+        overflowTop = 0;
+        overflowCap = 0;
+        overflowUsed = 0;
+    }
+    
+    inline size_t used() const
+    {
+        return top + overflowUsed;
     }
     
     virtual void reset()
     {
-        high = dtMax(high, top);
+        high = dtMax(high, used());
         top = 0;
+        if (overflows.empty())
+            return;
+        freeOverflows();
+        // Grow from the observed high-water mark, rounded up to whole chunks.
+        const size_t cap = (high + chunkSize - 1) / chunkSize * chunkSize;
+        resize(cap);
+        ++growCount;
     }
     
     virtual void* alloc(const size_t size)
     {
-        if (!buffer)
-            return 0;
-        if (top+size > capacity)
+        if (buffer && top + size <= capacity)
+        {
+            unsigned char* mem = &buffer[top];
+            top += size;
+            return mem;
+        }
+        if (!overflows.empty() && overflowTop + size <= overflowCap)
+        {
+            unsigned char* mem = overflows.back() + overflowTop;
+            overflowTop += size;
+            overflowUsed += size;
+            return mem;
+        }
+        const size_t chunk = dtMax(size, chunkSize);
+        unsigned char* mem = (unsigned char*)dtAlloc(chunk, DT_ALLOC_TEMP);
+        if (!mem)
             return 0;
-        unsigned char* mem = &buffer[top];
-        top += size;
+        overflows.push_back(mem);
+        overflowTop = size;
+        overflowCap = chunk;
+        overflowUsed += size;
         return mem;
     }
     
@@ -165,6 +239,7 @@ struct LinearAllocator : public dtTileCacheAlloc
 LinearAllocator::~LinearAllocator()
 {
     // Defined out of line to fix the weak v-tables warning
+    freeOverflows();
     dtFree(buffer);
 }
 
@@ -212,37 +287,263 @@ MeshProcess::~MeshProcess()
 
 /////////////////////////////////////////////////////////////////
 // Navi
-Navi::Navi(int maxPolys, int maxObstacles)
+Navi::Navi(int maxPolys, int maxObstacles, bool threadSafe)
 :mNavMesh(nullptr)
-,mNavQuery(nullptr)
 ,mTileCache(nullptr)
-,mSearchedPolyCount(0)
-,mPathCount(0)
+,mAlloc(nullptr)
+,mComp(nullptr)
+,mProc(nullptr)
+,mMemCounter(nullptr)
+,mPolyGraph(nullptr)
+,mLandmarks(nullptr)
+,mGraphVersion(0)
+,mLandmarkInclude(0)
+,mLandmarkExclude(0)
+,mUseLandmarks(false)
+,mMaxSearchNodes(MAX_QUERY_INIT_NODE)
+,mPathFilter(nullptr)
+,mPolyFilter(nullptr)
+,mQueryContext(nullptr)
+,mNodeStats(false)
 ,mDefaultPolySize(0, 6, 0)
 ,mMaxPolys(maxPolys)
 ,mMaxObstacles(maxObstacles)
+,mDoorGraphVersion(0)
+,mDoorGraphInclude(0)
+,mDoorGraphExclude(0)
+,mUseDoorGraph(false)
+,mWorldVersion(0)
+,mMeshVersion(0)
+,mObstaclesPending(false)
+,mPathCacheSize(0)
+,mThreadSafe(threadSafe)
+,mCrowd(nullptr)
+,mCrowdMaxAgents(0)
+,mNextFlowFieldId(1)
 {
-    mAlloc = new LinearAllocator(32000);
-    mComp = new FastLZCompressor;
-    mProc = new MeshProcess;
-    
-    mPathFilter = new dtQueryFilter;
-    mPathFilter->setIncludeFlags(POLYFLAGS_WALK);
-    mPathFilter->setExcludeFlags(~((unsigned short)POLYFLAGS_WALK));
+    // a throwing constructor skips the destructor, so whatever was allocated
+    // before the throw is freed here
+    try
+    {
+        mMemCounter = new NaviMemCounter;
+        NaviAllocScope allocScope(mMemCounter);
 
-    mPolyFilter = new dtQueryFilter;
-    mPolyFilter->setIncludeFlags(POLYFLAGS_ALL);
-    
-    mSearchPolys = new dtPolyRef[mMaxPolys];
-    mPath = new Vector3[mMaxPolys];
-    mPathPolys = new dtPolyRef[mMaxPolys];
-    mPathRemoves = new bool[mMaxPolys];
+        mAlloc = new LinearAllocator(DEFAULT_TILE_ALLOC_CAPACITY, TILE_ALLOC_CHUNK_SIZE);
+        mComp = new FastLZCompressor;
+        mProc = new MeshProcess;
+        
+        mPolyGraph = new PolyGraph;
+        mLandmarks = new LandmarkTable;
+
+        mPathFilter = new dtQueryFilter;
+        mPathFilter->setIncludeFlags(POLYFLAGS_WALK);
+        mPathFilter->setExcludeFlags(~((unsigned short)POLYFLAGS_WALK));
+
+        mPolyFilter = new dtQueryFilter;
+        mPolyFilter->setIncludeFlags(POLYFLAGS_ALL);
+
+        memset(mLastPathStats, 0, sizeof(mLastPathStats));
+        ResetPathStats();
+        
+        mQueryContext = CreateQueryContext();
+        if (!mQueryContext)
+            throw std::bad_alloc();
+        if (mThreadSafe)
+        {
+            mIdleQueryContexts.reserve(MAX_IDLE_QUERY_CONTEXTS);
+            mIdleQueryContexts.push_back(mQueryContext);
+        }
+    }
+    catch (...)
+    {
+        FreeMembers();
+        throw;
+    }
+}
+
+NaviQueryContext* Navi::CreateQueryContext()
+{
+    NaviAllocScope allocScope(mMemCounter);
+    // also created on query paths of the JNI layer, so nothing here throws
+    NaviQueryContext* ctx = new (std::nothrow) NaviQueryContext;
+    if (!ctx)
+        return nullptr;
+    memset(ctx, 0, sizeof(NaviQueryContext));
+    ctx->graphScratch = new (std::nothrow) PolyGraphScratch;
+    ctx->polySearch = new (std::nothrow) PolySearch;
+    ctx->searchPolys = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef) * mMaxPolys, DT_ALLOC_PERM);
+    ctx->path = (Vector3*)dtAlloc(sizeof(Vector3) * mMaxPolys, DT_ALLOC_PERM);
+    ctx->pathPolys = (dtPolyRef*)dtAlloc(sizeof(dtPolyRef) * mMaxPolys, DT_ALLOC_PERM);
+    ctx->pathRemoves = (bool*)dtAlloc(sizeof(bool) * mMaxPolys, DT_ALLOC_PERM);
+    if (!ctx->graphScratch || !ctx->polySearch || !ctx->searchPolys || !ctx->path || !ctx->pathPolys || !ctx->pathRemoves)
+    {
+        DestroyQueryContext(ctx);
+        return nullptr;
+    }
+    try
+    {
+        std::lock_guard<std::mutex> guard(mQueryContextLock);
+        mQueryContexts.push_back(ctx);
+    }
+    catch (const std::bad_alloc&)
+    {
+        DestroyQueryContext(ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+void Navi::DestroyQueryContext(NaviQueryContext* ctx)
+{
+    NaviAllocScope allocScope(mMemCounter);
+    dtFreeNavMeshQuery(ctx->query);
+    dtFree(ctx->path);
+    dtFree(ctx->searchPolys);
+    dtFree(ctx->pathPolys);
+    dtFree(ctx->pathRemoves);
+    delete ctx->graphScratch;
+    delete ctx->polySearch;
+    delete ctx;
+}
+
+NaviQueryContext& Navi::GetQueryContext()
+{
+    if (!mThreadSafe)
+        return *mQueryContext;
+    for (NaviQueryBinding* binding = tlQueryBinding; binding; binding = binding->prev)
+    {
+        // no context if BindQueryContext ran out of memory
+        if (binding->navi == this)
+            return binding->context ? *binding->context : tlEmptyQueryContext;
+    }
+    LOG_ERROR("Navi query of a thread-safe navi without NaviReadLock or NaviWriteLock");
+    return tlEmptyQueryContext;
+}
+
+void Navi::BindQueryContext(NaviQueryBinding& binding)
+{
+    binding.navi = this;
+    binding.context = nullptr;
+    binding.prev = nullptr;
+    if (!mThreadSafe)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(mQueryContextLock);
+        if (!mIdleQueryContexts.empty())
+        {
+            binding.context = mIdleQueryContexts.back();
+            mIdleQueryContexts.pop_back();
+        }
+    }
+    if (!binding.context)
+        binding.context = CreateQueryContext();
+    if (!binding.context)
+        LOG_ERROR("Navi cannot allocate a query context, the call fails");
+    binding.prev = tlQueryBinding;
+    tlQueryBinding = &binding;
+}
+
+void Navi::UnbindQueryContext(NaviQueryBinding& binding)
+{
+    if (!mThreadSafe)
+        return;
+    tlQueryBinding = binding.prev;
+    NaviQueryContext* ctx = binding.context;
+    if (!ctx)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(mQueryContextLock);
+        // reserved by the constructor, the push does not allocate
+        if ((int)mIdleQueryContexts.size() < MAX_IDLE_QUERY_CONTEXTS)
+        {
+            mIdleQueryContexts.push_back(ctx);
+            return;
+        }
+        mQueryContexts.erase(std::find(mQueryContexts.begin(), mQueryContexts.end(), ctx));
+    }
+    DestroyQueryContext(ctx);
+}
+
+bool Navi::PrepareQuery(NaviQueryContext& ctx)
+{
+    if (!mNavMesh || &ctx == &tlEmptyQueryContext)
+        return false;
+    const int nodes = dtMin(mMaxSearchNodes, SMALL_QUERY_INIT_NODE);
+    if (ctx.query && ctx.queryMesh == mNavMesh && ctx.queryNodes == nodes)
+        return true;
+    NaviAllocScope allocScope(mMemCounter);
+    if (!ctx.query)
+        ctx.query = dtAllocNavMeshQuery();
+    if (!ctx.query)
+        return false;
+    dtStatus status = ctx.query->init(mNavMesh, nodes);
+    if (dtStatusFailed(status))
+    {
+        LOG_ERROR("Navi query init failed, maxSearchNodes=%d", nodes);
+        dtFreeNavMeshQuery(ctx.query);
+        ctx.query = nullptr;
+        return false;
+    }
+    ctx.queryMesh = mNavMesh;
+    ctx.queryNodes = nodes;
+    return true;
+}
+
+// Pooled queries are freed by ClearMesh, so every one handed out matches the
+// current mesh and mMaxSearchNodes.
+dtNavMeshQuery* Navi::AcquireLargeQuery()
+{
+    {
+        std::lock_guard<std::mutex> guard(mLargeQueryLock);
+        if (!mLargeQueries.empty())
+        {
+            dtNavMeshQuery* query = mLargeQueries.back();
+            mLargeQueries.pop_back();
+            return query;
+        }
+    }
+    NaviAllocScope allocScope(mMemCounter);
+    dtNavMeshQuery* query = dtAllocNavMeshQuery();
+    if (!query)
+        return nullptr;
+    if (dtStatusFailed(query->init(mNavMesh, mMaxSearchNodes)))
+    {
+        LOG_ERROR("Navi large query init failed, maxSearchNodes=%d", mMaxSearchNodes);
+        dtFreeNavMeshQuery(query);
+        return nullptr;
+    }
+    return query;
+}
+
+void Navi::ReleaseLargeQuery(dtNavMeshQuery* query)
+{
+    std::lock_guard<std::mutex> guard(mLargeQueryLock);
+    mLargeQueries.push_back(query);
 }
 
 void Navi::ClearMesh()
 {
-    dtFreeNavMeshQuery(mNavQuery);
-    mNavQuery = nullptr;
+    ClearCrowd();
+    ClearFlowFields();
+    mPolyGraph->Clear();
+    mLandmarks->Clear();
+    {
+        // Queries of every thread point at the mesh freed below
+        std::lock_guard<std::mutex> guard(mQueryContextLock);
+        for (int i = 0; i < (int)mQueryContexts.size(); ++i)
+        {
+            NaviQueryContext* ctx = mQueryContexts[i];
+            dtFreeNavMeshQuery(ctx->query);
+            ctx->query = nullptr;
+            ctx->queryMesh = nullptr;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(mLargeQueryLock);
+        for (int i = 0; i < (int)mLargeQueries.size(); ++i)
+            dtFreeNavMeshQuery(mLargeQueries[i]);
+        mLargeQueries.clear();
+    }
     dtFreeTileCache(mTileCache);
     mTileCache = nullptr;
     dtFreeNavMesh(mNavMesh);
@@ -252,13 +553,20 @@ void Navi::ClearMesh()
 Navi::~Navi()
 {
     ClearMesh();
-    
-    delete[] mPath;
-    delete[] mSearchPolys;
-    delete[] mPathPolys;
-    delete[] mPathRemoves;
+    FreeMembers();
+}
+
+// Members allocated by the constructor, any of them may still be null.
+void Navi::FreeMembers()
+{
+    for (int i = 0; i < (int)mQueryContexts.size(); ++i)
+        DestroyQueryContext(mQueryContexts[i]);
+    mQueryContexts.clear();
+    mIdleQueryContexts.clear();
     delete mPathFilter;
     delete mPolyFilter;
+    delete mPolyGraph;
+    delete mLandmarks;
     
     delete mAlloc;
     delete mComp;
@@ -266,6 +574,13 @@ Navi::~Navi()
     
     for (int i = 0; i < mRegions.size(); ++i)
         delete mRegions[i];
+
+    delete mMemCounter;
+}
+
+long long Navi::GetMemoryUsage()
+{
+    return mMemCounter->bytes.load(std::memory_order_relaxed);
 }
 
 int Navi::GetPathFilterInclude()
@@ -282,6 +597,17 @@ void Navi::SetPathFilter(int include, int exclude)
 {
     mPathFilter->setIncludeFlags(include);
     mPathFilter->setExcludeFlags(exclude);
+    if (mCrowd)
+        *mCrowd->getEditableFilter(0) = *mPathFilter;
+    BumpWorldVersion();
+    // landmark distances are only admissible for the flags they were built
+    // with, door legs only hold for them
+    dtQueryFilter filter;
+    GetLandmarkFilter(filter);
+    if (filter.getIncludeFlags() != mLandmarkInclude || filter.getExcludeFlags() != mLandmarkExclude)
+        mLandmarks->Clear();
+    if (filter.getIncludeFlags() != mDoorGraphInclude || filter.getExcludeFlags() != mDoorGraphExclude)
+        mDoorGraph.clear();
 }
 
 int Navi::GetPolyFilterInclude()
@@ -298,11 +624,218 @@ void Navi::SetPolyFilter(int include, int exclude)
 {
     mPolyFilter->setIncludeFlags(include);
     mPolyFilter->setExcludeFlags(exclude);
+    BumpWorldVersion();
+}
+
+bool Navi::BuildLandmarks(int count)
+{
+    mLandmarks->Clear();
+    if (!mNavMesh)
+        return false;
+    if (!mPolyGraph->Build(mNavMesh))
+        return false;
+    mGraphVersion = mMeshVersion;
+    dtQueryFilter filter;
+    GetLandmarkFilter(filter);
+    mLandmarkInclude = filter.getIncludeFlags();
+    mLandmarkExclude = filter.getExcludeFlags();
+    return mLandmarks->Build(*mPolyGraph, &filter, count);
+}
+
+void Navi::GetLandmarkFilter(dtQueryFilter& filter)
+{
+    // the path filter with doors passable, distances on the larger graph stay
+    // admissible whichever doors are closed later
+    filter.setIncludeFlags(mPathFilter->getIncludeFlags());
+    filter.setExcludeFlags(mPathFilter->getExcludeFlags() & ~POLYFLAGS_DOOR);
+}
+
+bool Navi::IsLandmarkValid()
+{
+    return mLandmarks->IsBuilt() && mGraphVersion == mMeshVersion;
+}
+
+bool Navi::UseLandmarkPath()
+{
+    return mUseLandmarks && IsLandmarkValid();
+}
+
+dtStatus Navi::FindPolyPath(NaviQueryContext& ctx, dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos,
+    bool recordStats)
+{
+    ctx.searchedPolyCount = 0;
+    if (UseLandmarkPath())
+    {
+        dtStatus status = FindPolyGraphPath(*mPolyGraph, mLandmarks, *ctx.graphScratch, startRef, endRef, mPathFilter,
+            mMaxSearchNodes, ctx.searchPolys, &ctx.searchedPolyCount, mMaxPolys);
+        if (!recordStats)
+            return status;
+        ctx.pathStats[PATH_STAT_NODES_EXPANDED] += ctx.graphScratch->expandedCount;
+        ctx.pathStats[PATH_STAT_NODE_POOL_HIGH] = dtMax(ctx.pathStats[PATH_STAT_NODE_POOL_HIGH], (long long)ctx.graphScratch->visitedCount);
+        ctx.pathStats[PATH_STAT_CORRIDOR_LENGTH] += ctx.searchedPolyCount;
+        return status;
+    }
+    return SearchCorridor(ctx, startRef, endRef, startPos, endPos, mPathFilter, &ctx.searchedPolyCount, recordStats);
+}
+
+// A* into ctx.searchPolys on the small node pool of ctx, rerun on a large
+// pooled query when the small pool runs out.
+dtStatus Navi::SearchCorridor(NaviQueryContext& ctx, dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos,
+    const dtQueryFilter* filter, int* polyCount, bool recordStats)
+{
+    dtStatus status = ctx.query->findPath(startRef, endRef, startPos, endPos, filter, ctx.searchPolys, polyCount, mMaxPolys);
+    if (recordStats)
+        RecordSearchStats(ctx, ctx.query);
+    if (!dtStatusDetail(status, DT_OUT_OF_NODES) || ctx.queryNodes >= mMaxSearchNodes)
+        return status;
+    dtNavMeshQuery* query = AcquireLargeQuery();
+    if (!query)
+        return status;
+    const int droppedCount = *polyCount;
+    status = query->findPath(startRef, endRef, startPos, endPos, filter, ctx.searchPolys, polyCount, mMaxPolys);
+    if (recordStats)
+    {
+        ++ctx.pathStats[PATH_STAT_NODE_POOL_RETRIES];
+        ctx.pathStats[PATH_STAT_CORRIDOR_LENGTH] -= droppedCount;
+        RecordSearchStats(ctx, query);
+    }
+    ReleaseLargeQuery(query);
+    return status;
+}
+
+// Closed nodes need a walk of the node pool of the last Detour search, so
+// they are only counted with SetNodeStats. Nodes are numbered from 1.
+void Navi::RecordSearchStats(NaviQueryContext& ctx, const dtNavMeshQuery* query)
+{
+    const dtNodePool* pool = query->getNodePool();
+    const int nodeCount = pool->getNodeCount();
+    if (mNodeStats)
+    {
+        long long expanded = 0;
+        for (int i = 1; i <= nodeCount; ++i)
+        {
+            const dtNode* node = pool->getNodeAtIdx(i);
+            if (node && (node->flags & DT_NODE_CLOSED))
+                ++expanded;
+        }
+        ctx.pathStats[PATH_STAT_NODES_EXPANDED] += expanded;
+    }
+    ctx.pathStats[PATH_STAT_NODE_POOL_HIGH] = dtMax(ctx.pathStats[PATH_STAT_NODE_POOL_HIGH], (long long)nodeCount);
+    ctx.pathStats[PATH_STAT_CORRIDOR_LENGTH] += ctx.searchedPolyCount;
+}
+
+void Navi::SetPathCacheSize(int size)
+{
+    std::lock_guard<std::mutex> guard(mPathCacheLock);
+    mPathCacheSize = size > 0 ? size : 0;
+    while ((int)mPathCacheList.size() > mPathCacheSize)
+    {
+        mPathCacheMap.erase(mPathCacheList.back().key);
+        mPathCacheList.pop_back();
+    }
+}
+
+void Navi::ClearPathCache()
+{
+    std::lock_guard<std::mutex> guard(mPathCacheLock);
+    mPathCacheList.clear();
+    mPathCacheMap.clear();
+}
+
+Navi::PathCacheHit Navi::FindPathCache(NaviQueryContext& ctx, const PathCacheKey& key, const Vector3& start, const Vector3& end, dtStatus* status)
+{
+    std::lock_guard<std::mutex> guard(mPathCacheLock);
+    PathCacheMap::iterator it = mPathCacheMap.find(key);
+    if (it == mPathCacheMap.end())
+        return PATH_CACHE_MISS;
+    PathCacheList::iterator entryIt = it->second;
+    if (entryIt->version != mWorldVersion)
+    {
+        mPathCacheList.erase(entryIt);
+        mPathCacheMap.erase(it);
+        return PATH_CACHE_MISS;
+    }
+    // move to front as the most recently used
+    mPathCacheList.splice(mPathCacheList.begin(), mPathCacheList, entryIt);
+    const PathCacheEntry& entry = mPathCacheList.front();
+    *status = entry.status;
+    if (!entry.path.empty()
+        && !memcmp(&entry.start, &start, sizeof(Vector3))
+        && !memcmp(&entry.end, &end, sizeof(Vector3)))
+    {
+        ctx.pathCount = (int)entry.path.size();
+        memcpy(ctx.path, &entry.path.front(), sizeof(Vector3) * ctx.pathCount);
+        return PATH_CACHE_PATH;
+    }
+    ctx.searchedPolyCount = (int)entry.polys.size();
+    if (ctx.searchedPolyCount)
+        memcpy(ctx.searchPolys, &entry.polys.front(), sizeof(dtPolyRef) * ctx.searchedPolyCount);
+    return PATH_CACHE_CORRIDOR;
+}
+
+void Navi::AddPathCache(const NaviQueryContext& ctx, const PathCacheKey& key, dtStatus status)
+{
+    std::lock_guard<std::mutex> guard(mPathCacheLock);
+    if (mPathCacheSize <= 0)
+        return;
+    PathCacheMap::iterator it = mPathCacheMap.find(key);
+    if (it != mPathCacheMap.end())
+    {
+        mPathCacheList.erase(it->second);
+        mPathCacheMap.erase(it);
+    }
+    while (!mPathCacheList.empty() && (int)mPathCacheList.size() >= mPathCacheSize)
+    {
+        mPathCacheMap.erase(mPathCacheList.back().key);
+        mPathCacheList.pop_back();
+    }
+    mPathCacheList.push_front(PathCacheEntry());
+    PathCacheEntry& entry = mPathCacheList.front();
+    entry.key = key;
+    entry.version = mWorldVersion;
+    entry.status = status;
+    entry.polys.assign(ctx.searchPolys, ctx.searchPolys + ctx.searchedPolyCount);
+    mPathCacheMap[key] = mPathCacheList.begin();
+}
+
+void Navi::SetPathCachePath(const NaviQueryContext& ctx, const PathCacheKey& key, const Vector3& start, const Vector3& end)
+{
+    std::lock_guard<std::mutex> guard(mPathCacheLock);
+    PathCacheMap::iterator it = mPathCacheMap.find(key);
+    if (it == mPathCacheMap.end() || it->second->version != mWorldVersion)
+        return;
+    PathCacheEntry& entry = *it->second;
+    entry.start = start;
+    entry.end = end;
+    entry.path.assign(ctx.path, ctx.path + ctx.pathCount);
+}
+
+void Navi::SetTileAllocCapacity(int capacity)
+{
+    NaviAllocScope allocScope(mMemCounter);
+    if (capacity <= 0)
+        capacity = DEFAULT_TILE_ALLOC_CAPACITY;
+    mAlloc->freeOverflows();
+    mAlloc->resize(capacity);
+    mAlloc->high = 0;
+    mAlloc->growCount = 0;
+}
+
+void Navi::GetTileAllocStats(long long* stats)
+{
+    stats[TILE_ALLOC_CAPACITY] = (long long)mAlloc->capacity;
+    stats[TILE_ALLOC_USED] = (long long)mAlloc->used();
+    stats[TILE_ALLOC_HIGH] = (long long)dtMax(mAlloc->high, mAlloc->used());
+    stats[TILE_ALLOC_GROW_COUNT] = mAlloc->growCount;
 }
 
 bool Navi::LoadMesh(const char* path, const int maxSearchNodes)
 {
+    NaviAllocScope allocScope(mMemCounter);
     ClearMesh();
+    BumpMeshVersion();
+    mObstaclesPending = false;
+    mDoorGraph.clear();
 
     FILE* fp = fopen(path, "rb");
     if (!fp)
@@ -416,16 +949,11 @@ bool Navi::LoadMesh(const char* path, const int maxSearchNodes)
     
     fclose(fp);
     
-    mNavQuery = dtAllocNavMeshQuery();
-    if (!mNavQuery)
-    {
-        ClearMesh();
-        return false;
-    }
-    status = mNavQuery->init(mNavMesh, maxSearchNodes);
-    if (dtStatusFailed(status))
+    // contexts of other threads initialize their queries on first use
+    mMaxSearchNodes = maxSearchNodes;
+    if (!PrepareQuery(GetQueryContext()))
     {
-        LOG_ERROR("Load Mesh failed by mNavQuery->init");
+        LOG_ERROR("Load Mesh failed by the query init");
         ClearMesh();
         return false;
     }
@@ -488,7 +1016,7 @@ bool Navi::LoadDoors(const char* path)
 
 bool Navi::LoadDoorsInternal(const char* path)
 {
-    if (!mNavQuery || !mNavMesh)
+    if (!mNavMesh)
         return false;
     ClearDoors();
     try
@@ -571,6 +1099,7 @@ void Navi::InitProvinceLink()
 
 void Navi::ClearDoors()
 {
+    mDoorGraph.clear();
     mDoors.clear();
     mDoorMap.clear();
     mDoorTree.Clear();
@@ -579,7 +1108,7 @@ void Navi::ClearDoors()
 
 void Navi::InitDoorsPoly()
 {
-    if (!mNavQuery || !mNavMesh || mDoors.empty())
+    if (!mNavMesh || mDoors.empty())
         return;
     for (int i = 0; i < mDoors.size(); ++i)
     {
@@ -589,7 +1118,8 @@ void Navi::InitDoorsPoly()
 
 void Navi::InitDoorPoly(VolumeDoor& door)
 {
-    if (!mNavMesh || !mNavQuery)
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
     {
         LOG_ERROR("Navi mesh or query is not inited");
         return;
@@ -607,6 +1137,8 @@ void Navi::InitDoorPoly(VolumeDoor& door)
         dtVmax(max, (float*)&door.verts[i]);
     }
     dtVscale(centerPos, centerPos, 1.0f/door.verts.size());
+    door.center.Set(centerPos[0], centerPos[1], centerPos[2]);
+    door.centerRef = 0;
     float halfExtents[3];
     for (int i = 0; i < 3; ++i)
         halfExtents[i] = (max[i] - min[i]) * 0.5f;
@@ -619,10 +1151,10 @@ void Navi::InitDoorPoly(VolumeDoor& door)
     memset(resultRef, 0, sizeof(dtPolyRef) * maxResult);
     int resultCount = 0;
     door.polyRefs.clear();
-    dtStatus status = mNavQuery->queryPolygons(centerPos, halfExtents, &filter, resultRef, &resultCount, maxResult);
+    dtStatus status = ctx.query->queryPolygons(centerPos, halfExtents, &filter, resultRef, &resultCount, maxResult);
     if (!(status & DT_SUCCESS) || !resultCount)
     {
-        LOG_ERROR("InitDoorPoly failed by mNavQuery->queryPolygons");
+        LOG_ERROR("InitDoorPoly failed by queryPolygons");
         return;
     }
     door.polyRefs.resize(resultCount);
@@ -662,6 +1194,7 @@ void Navi::OpenDoor(VolumeDoor* door, const bool open)
 
 void Navi::OpenDoorPoly(VolumeDoor *door, const bool open)
 {
+    BumpWorldVersion();
     const dtMeshTile* tile = nullptr;
     const dtPoly* cpoly = nullptr;
     for (int i = 0; i < door->polyRefs.size(); ++i)
@@ -685,7 +1218,7 @@ bool Navi::LoadRegions(const char* path)
 
 bool Navi::LoadRegionsInternal(const char* path)
 {
-    if (!mNavQuery || !mNavMesh)
+    if (!mNavMesh)
         return false;
     ClearRegions();
     try
@@ -863,22 +1396,37 @@ bool Navi::PointInRegion(float x, float z, const VolumeRegion& region)
 
 dtStatus Navi::AddObstacle(const Vector3& pos, const float radius, const float height, dtObstacleRef* result)
 {
+    NaviAllocScope allocScope(mMemCounter);
     if (!mTileCache)
         return DT_FAILURE;
-    return mTileCache->addObstacle((float*)&pos, radius, height, result);
+    BumpWorldVersion();
+    dtStatus status = mTileCache->addObstacle((float*)&pos, radius, height, result);
+    if (dtStatusSucceed(status))
+        mObstaclesPending = true;
+    return status;
 }
 
 dtStatus Navi::RemoveObstacle(const dtObstacleRef ref)
 {
+    NaviAllocScope allocScope(mMemCounter);
     if (!mTileCache)
         return DT_FAILURE;
-    return mTileCache->removeObstacle(ref);
+    BumpWorldVersion();
+    dtStatus status = mTileCache->removeObstacle(ref);
+    if (dtStatusSucceed(status))
+        mObstaclesPending = true;
+    return status;
 }
 
 dtStatus Navi::RefreshObstacle()
 {
+    NaviAllocScope allocScope(mMemCounter);
     if (!mTileCache)
         return DT_FAILURE;
+    // nothing to rebuild, keep the landmarks, door graph and caches of the mesh
+    if (!mObstaclesPending)
+        return DT_SUCCESS;
+    BumpMeshVersion();
     bool finish = false;
     while (!finish)
     {
@@ -886,6 +1434,7 @@ dtStatus Navi::RefreshObstacle()
         if (!dtStatusSucceed(status))
             return DT_FAILURE;
     }
+    mObstaclesPending = false;
     return DT_SUCCESS;
 }
 
@@ -1002,131 +1551,600 @@ bool Navi::IsPassable(const Vector3& start, const Vector3& end)
     return false;
 }
 
-bool Navi::WalkablePoly(const dtPolyRef polyRef)
-{
-    const dtMeshTile* tile = nullptr;
-    const dtPoly* poly = nullptr;
-    dtStatus status = mNavMesh->getTileAndPolyByRef(polyRef, &tile, &poly);
-    if (status != DT_SUCCESS)
-        return false;
-    return poly->flags == POLYFLAGS_WALK;
-}
-
-void Navi::MakePathOutOfBlock(const Vector3& polySize)
+void Navi::GetProvinceDoors(int province, std::vector<int>& doorIndices)
 {
-    if (mPathCount < 2)
+    doorIndices.clear();
+    ProvinceLinkMap::iterator linkIt = mProvinceLinkMap.find(province);
+    if (linkIt == mProvinceLinkMap.end())
         return;
-    const int lastIndex = mPathCount - 1;
-    for (int i = lastIndex; i > 0; --i)
+    ProvinceDoorMap& doorMap = linkIt->second;
+    for (ProvinceDoorMap::iterator doorIt = doorMap.begin(); doorIt != doorMap.end(); ++doorIt)
     {
-        Vector3& fromPt = mPath[i];
-        Vector3& toPt = mPath[i - 1];
-        Vector3 diffPt(toPt);
-        diffPt.Sub(fromPt);
-        float length = diffPt.Length();
-        int splitCount = (int)(length / 0.1f);
-        if (splitCount < 1)
-            splitCount = 1;
-        diffPt.Mul(1.0f / (float)splitCount);
-        Vector3 pt(fromPt);
-        for (int j = 0; j < splitCount; ++j)
+        DoorList& doors = doorIt->second;
+        for (int i = 0; i < doors.size(); ++i)
         {
-            dtPolyRef polyRef = 0;
-            dtStatus status = mNavQuery->findNearestPoly((float*)&pt, (float*)&polySize, mPolyFilter, &polyRef, nullptr);
-            if (status & DT_SUCCESS)
-            {
-                if (WalkablePoly(polyRef))
-                {
-                    mPath[i] = pt;
-                    mPathCount = i + 1;
-                    return;
-                }
-            }
-            pt.Add(diffPt);
+            VolumeDoor* door = FindDoor(doors[i]);
+            if (!door)
+                continue;
+            doorIndices.push_back((int)(door - &mDoors[0]));
         }
     }
 }
 
-void Navi::StraightenPath()
+float Navi::GetDoorLegCost(NaviQueryContext& ctx, const VolumeDoor& from, const VolumeDoor& to, const dtQueryFilter* filter)
 {
-    if (mPathCount <= 2)
-        return;
-    bool* removes = mPathRemoves;
-    memset(removes, 0, sizeof(bool) * mPathCount);
-    int removeCount = 0;
-    int maxFrom = mPathCount - 2;
-    float* path = (float*)mPath;
-    for (int i = 0; i < maxFrom; ++i)
+    int polyCount = 0;
+    dtStatus status = SearchCorridor(ctx, from.centerRef, to.centerRef, (float*)&from.center, (float*)&to.center,
+        filter, &polyCount, false);
+    if (!dtStatusSucceed(status) || !polyCount || ctx.searchPolys[polyCount - 1] != to.centerRef)
+        return -1.0f;
+    int pathCount = 0;
+    status = ctx.query->findStraightPath((float*)&from.center, (float*)&to.center, ctx.searchPolys, polyCount,
+        (float*)ctx.path, nullptr, nullptr, &pathCount, mMaxPolys, 0);
+    if (!dtStatusSucceed(status))
+        return -1.0f;
+    float cost = 0;
+    for (int i = 1; i < pathCount; ++i)
+        cost += dtVdist((float*)&ctx.path[i - 1], (float*)&ctx.path[i]);
+    return cost;
+}
+
+bool Navi::BuildDoorGraph()
+{
+    mDoorGraph.clear();
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx) || mDoors.empty())
+        return false;
+    mDoorGraphVersion = mMeshVersion;
+
+    // doors are treated as passable here, their state is checked while planning
+    dtQueryFilter filter;
+    GetLandmarkFilter(filter);
+    mDoorGraphInclude = filter.getIncludeFlags();
+    mDoorGraphExclude = filter.getExcludeFlags();
+
+    const int doorCount = (int)mDoors.size();
+    for (int i = 0; i < doorCount; ++i)
     {
-        dtPolyRef fromRef = mPathPolys[i];
-        int j = i + 2;
-        for (; j < mPathCount; ++j)
+        VolumeDoor& door = mDoors[i];
+        door.centerRef = 0;
+        float bestDist = HUGE_VALF;
+        for (int j = 0; j < door.polyRefs.size(); ++j)
         {
-            float t = 0;
-            dtStatus rayStatus = mNavQuery->raycast(fromRef, path + i * 3, path + j * 3, mPathFilter,
-                &t, nullptr, mSearchPolys, &mSearchedPolyCount, mMaxPolys);
-            if (dtStatusSucceed(rayStatus) && t > 1.0f)
-            {
-                removes[j - 1] = true;
-                ++removeCount;
+            float closest[3];
+            dtStatus status = ctx.query->closestPointOnPoly(door.polyRefs[j], (float*)&door.center, closest, nullptr);
+            if (!dtStatusSucceed(status))
                 continue;
+            float dist = dtVdistSqr(closest, (float*)&door.center);
+            if (dist < bestDist)
+            {
+                bestDist = dist;
+                door.centerRef = door.polyRefs[j];
+                door.center.Set(closest[0], closest[1], closest[2]);
             }
-            break;
         }
-        i = j - 2;
+        if (!door.centerRef)
+            LOG_WARN("BuildDoorGraph door %d has no poly", door.id);
     }
-    if (!removeCount)
-        return;
-    int count = mPathCount - removeCount;
-    int src = 0;
-    for (int i = 0; i < count; ++i, ++src)
+
+    mDoorGraph.resize(doorCount);
+    std::vector<int> doorIndices;
+    for (ProvinceLinkMap::iterator linkIt = mProvinceLinkMap.begin(); linkIt != mProvinceLinkMap.end(); ++linkIt)
     {
-        for (; src < mPathCount; ++src)
+        GetProvinceDoors(linkIt->first, doorIndices);
+        for (int i = 0; i < doorIndices.size(); ++i)
         {
-            if (!removes[src])
-                break;
-        }
-        if (i == src)
-            continue;
-        memcpy(path + i * 3, path + src * 3, sizeof(float) * 3);
-        mPathPolys[i] = mPathPolys[src];
-    }
-    mPathCount = count;
+            const int from = doorIndices[i];
+            if (!mDoors[from].centerRef)
+                continue;
+            for (int j = i + 1; j < doorIndices.size(); ++j)
+            {
+                const int to = doorIndices[j];
+                if (!mDoors[to].centerRef || from == to)
+                    continue;
+                std::vector<DoorGraphLink>& links = mDoorGraph[from];
+                bool linked = false;
+                for (int k = 0; k < links.size(); ++k)
+                    linked = linked || links[k].door == to;
+                if (linked)
+                    continue;
+                float cost = GetDoorLegCost(ctx, mDoors[from], mDoors[to], &filter);
+                if (cost < 0)
+                    continue;
+                DoorGraphLink link;
+                link.cost = cost;
+                link.door = to;
+                mDoorGraph[from].push_back(link);
+                link.door = from;
+                mDoorGraph[to].push_back(link);
+            }
+        }
+    }
+    return true;
+}
+
+bool Navi::NeedDoorGraphPath(const Vector3& start, const Vector3& end)
+{
+    if (!mUseDoorGraph || !IsDoorGraphBuilt())
+        return false;
+    std::vector<int> startProvinces;
+    std::vector<int> endProvinces;
+    if (!FindProvince(start, startProvinces) || !FindProvince(end, endProvinces))
+        return false;
+    for (int i = 0; i < startProvinces.size(); ++i)
+    {
+        for (int j = 0; j < endProvinces.size(); ++j)
+        {
+            if (startProvinces[i] == endProvinces[j])
+                return false;
+        }
+    }
+    return true;
+}
+
+dtStatus Navi::AppendPathLeg(NaviQueryContext& ctx, dtPolyRef fromRef, dtPolyRef toRef, const float* fromPos, const float* toPos, bool allowPartial)
+{
+    dtStatus status = FindPolyPath(ctx, fromRef, toRef, fromPos, toPos, true);
+    if (!dtStatusSucceed(status) || !ctx.searchedPolyCount)
+        return DT_FAILURE;
+    float epos[3];
+    dtVcopy(epos, toPos);
+    if (ctx.searchPolys[ctx.searchedPolyCount - 1] != toRef)
+    {
+        if (!allowPartial)
+            return DT_FAILURE;
+        ctx.query->closestPointOnPoly(ctx.searchPolys[ctx.searchedPolyCount - 1], toPos, epos, nullptr);
+    }
+    // the first point of a leg is the last point of the previous one
+    const int offset = ctx.pathCount > 0 ? ctx.pathCount - 1 : 0;
+    int count = 0;
+    dtStatus straightStatus = ctx.query->findStraightPath(fromPos, epos, ctx.searchPolys, ctx.searchedPolyCount,
+        (float*)(ctx.path + offset), nullptr, ctx.pathPolys + offset, &count, mMaxPolys - offset, 0);
+    if (!dtStatusSucceed(straightStatus) || dtStatusDetail(straightStatus, DT_BUFFER_TOO_SMALL))
+        return DT_FAILURE;
+    ctx.pathCount = offset + count;
+    return status;
+}
+
+dtStatus Navi::FindDoorGraphPath(NaviQueryContext& ctx, dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos)
+{
+    std::vector<int> startProvinces;
+    std::vector<int> endProvinces;
+    if (!FindProvince(*(const Vector3*)startPos, startProvinces) || !FindProvince(*(const Vector3*)endPos, endProvinces))
+        return DT_FAILURE;
+
+    const int doorCount = (int)mDoors.size();
+    std::vector<float> costs(doorCount, HUGE_VALF);
+    std::vector<float> exitCosts(doorCount, -1.0f);
+    std::vector<int> parents(doorCount, -1);
+    typedef std::pair<float, int> OpenNode;
+    std::priority_queue<OpenNode, std::vector<OpenNode>, std::greater<OpenNode>> openList;
+
+    std::vector<int> doorIndices;
+    for (int i = 0; i < endProvinces.size(); ++i)
+    {
+        GetProvinceDoors(endProvinces[i], doorIndices);
+        for (int j = 0; j < doorIndices.size(); ++j)
+        {
+            const VolumeDoor& door = mDoors[doorIndices[j]];
+            exitCosts[doorIndices[j]] = dtVdist((float*)&door.center, endPos);
+        }
+    }
+    for (int i = 0; i < startProvinces.size(); ++i)
+    {
+        GetProvinceDoors(startProvinces[i], doorIndices);
+        for (int j = 0; j < doorIndices.size(); ++j)
+        {
+            const int index = doorIndices[j];
+            const VolumeDoor& door = mDoors[index];
+            if (!door.open || !door.centerRef)
+                continue;
+            const float cost = dtVdist(startPos, (float*)&door.center);
+            if (cost < costs[index])
+            {
+                costs[index] = cost;
+                openList.push(OpenNode(cost, index));
+            }
+        }
+    }
+
+    int bestDoor = -1;
+    float bestCost = HUGE_VALF;
+    while (!openList.empty())
+    {
+        OpenNode node = openList.top();
+        openList.pop();
+        const float cost = node.first;
+        const int index = node.second;
+        if (cost > costs[index])
+            continue;
+        if (cost >= bestCost)
+            break;
+        if (exitCosts[index] >= 0 && cost + exitCosts[index] < bestCost)
+        {
+            bestCost = cost + exitCosts[index];
+            bestDoor = index;
+        }
+        const std::vector<DoorGraphLink>& links = mDoorGraph[index];
+        for (int i = 0; i < links.size(); ++i)
+        {
+            const DoorGraphLink& link = links[i];
+            if (!mDoors[link.door].open)
+                continue;
+            const float newCost = cost + link.cost;
+            if (newCost >= costs[link.door])
+                continue;
+            costs[link.door] = newCost;
+            parents[link.door] = index;
+            openList.push(OpenNode(newCost, link.door));
+        }
+    }
+    if (bestDoor < 0)
+        return DT_FAILURE;
+
+    std::vector<int> doorChain;
+    for (int index = bestDoor; index >= 0; index = parents[index])
+        doorChain.push_back(index);
+    std::reverse(doorChain.begin(), doorChain.end());
+
+    // refine every leg with a short local search
+    ctx.pathCount = 0;
+    dtStatus status = DT_SUCCESS;
+    dtPolyRef fromRef = startRef;
+    const float* fromPos = startPos;
+    const int legCount = (int)doorChain.size() + 1;
+    for (int i = 0; i < legCount; ++i)
+    {
+        const bool lastLeg = i == legCount - 1;
+        dtPolyRef toRef = endRef;
+        const float* toPos = endPos;
+        if (!lastLeg)
+        {
+            const VolumeDoor& door = mDoors[doorChain[i]];
+            toRef = door.centerRef;
+            toPos = (const float*)&door.center;
+        }
+        status = AppendPathLeg(ctx, fromRef, toRef, fromPos, toPos, lastLeg);
+        if (!dtStatusSucceed(status))
+            return status;
+        fromRef = toRef;
+        fromPos = toPos;
+    }
+    return status;
+}
+
+bool Navi::FindRandomPoint(float (*frand)(), Vector3& pos)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+        return false;
+    dtPolyRef polyRef = 0;
+    dtStatus status = ctx.query->findRandomPoint(mPathFilter, frand, &polyRef, (float*)&pos);
+    return dtStatusSucceed(status);
+}
+
+// findRandomPoint takes a plain function, so the seeded generator is per thread
+static thread_local std::minstd_rand tlRandom;
+
+static float RandomFloat()
+{
+    // the float distribution may round up to 1, callers expect [0, 1)
+    const float value = std::uniform_real_distribution<float>(0.0f, 1.0f)(tlRandom);
+    return value < 1.0f ? value : std::nextafter(1.0f, 0.0f);
+}
+
+// Ground poly of a region draw and the area of it and all before it.
+struct RandomPoly
+{
+    dtPolyRef ref;
+    float areaSum;
+};
+static thread_local std::vector<RandomPoly> tlRandomPolys;
+
+// Ground polys passing filter whose bounds overlap the XZ box, with their
+// running area. Returns the total area.
+static float CollectRandomPolys(const dtNavMesh* navMesh, const Recast::AABB& box, const dtQueryFilter& filter,
+    std::vector<RandomPoly>& polys)
+{
+    polys.clear();
+    float areaSum = 0;
+    for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+    {
+        const dtMeshTile* tile = navMesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize)
+            continue;
+        const dtMeshHeader* header = tile->header;
+        if (header->bmin[0] > box.GetRight() || header->bmax[0] < box.GetLeft()
+            || header->bmin[2] > box.GetTop() || header->bmax[2] < box.GetBottom())
+            continue;
+        const dtPolyRef base = navMesh->getPolyRefBase(tile);
+        for (int j = 0; j < header->polyCount; ++j)
+        {
+            const dtPoly* poly = &tile->polys[j];
+            if (poly->getType() != DT_POLYTYPE_GROUND)
+                continue;
+            const dtPolyRef ref = base | (dtPolyRef)j;
+            if (!filter.passFilter(ref, tile, poly))
+                continue;
+            float bmin[3];
+            float bmax[3];
+            dtVcopy(bmin, &tile->verts[poly->verts[0] * 3]);
+            dtVcopy(bmax, bmin);
+            for (int k = 1; k < poly->vertCount; ++k)
+            {
+                dtVmin(bmin, &tile->verts[poly->verts[k] * 3]);
+                dtVmax(bmax, &tile->verts[poly->verts[k] * 3]);
+            }
+            if (bmin[0] > box.GetRight() || bmax[0] < box.GetLeft() || bmin[2] > box.GetTop() || bmax[2] < box.GetBottom())
+                continue;
+            // area on the XZ plane, the way findRandomPoint weighs polys
+            float area = 0;
+            const float* va = &tile->verts[poly->verts[0] * 3];
+            for (int k = 2; k < poly->vertCount; ++k)
+                area += dtTriArea2D(va, &tile->verts[poly->verts[k - 1] * 3], &tile->verts[poly->verts[k] * 3]);
+            if (area <= 0)
+                continue;
+            areaSum += area;
+            RandomPoly randomPoly;
+            randomPoly.ref = ref;
+            randomPoly.areaSum = areaSum;
+            polys.push_back(randomPoly);
+        }
+    }
+    return areaSum;
+}
+
+// Point on one of polys picked by area, uniform inside it like findRandomPoint.
+static dtStatus FindRandomPointInPolys(const dtNavMesh* navMesh, const dtNavMeshQuery* query,
+    const std::vector<RandomPoly>& polys, float areaSum, dtPolyRef* ref, float* pos)
+{
+    const float target = RandomFloat() * areaSum;
+    std::vector<RandomPoly>::const_iterator it = std::upper_bound(polys.begin(), polys.end(), target,
+        [](float value, const RandomPoly& poly) { return value < poly.areaSum; });
+    if (it == polys.end())
+        --it;
+    const dtMeshTile* tile = nullptr;
+    const dtPoly* poly = nullptr;
+    navMesh->getTileAndPolyByRefUnsafe(it->ref, &tile, &poly);
+    float verts[3 * DT_VERTS_PER_POLYGON];
+    float areas[DT_VERTS_PER_POLYGON];
+    for (int k = 0; k < poly->vertCount; ++k)
+        dtVcopy(&verts[k * 3], &tile->verts[poly->verts[k] * 3]);
+    const float s = RandomFloat();
+    const float t = RandomFloat();
+    dtRandomPointInConvexPoly(verts, poly->vertCount, areas, s, t, pos);
+    float height = 0;
+    dtStatus status = query->getPolyHeight(it->ref, pos, &height);
+    if (!dtStatusSucceed(status))
+        return status;
+    pos[1] = height;
+    *ref = it->ref;
+    return DT_SUCCESS;
+}
+
+int Navi::FindRandomPoints(int count, const Vector3& center, float radius, int regionId, int include, int exclude,
+    unsigned int seed, float minSpacing, Vector3* points)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx) || count <= 0)
+        return 0;
+    dtQueryFilter filter = *mPathFilter;
+    filter.setIncludeFlags((unsigned short)include);
+    filter.setExcludeFlags((unsigned short)exclude);
+    dtPolyRef centerRef = 0;
+    if (radius > 0)
+    {
+        ctx.query->findNearestPoly((const float*)&center, (const float*)&mDefaultPolySize, &filter, &centerRef, nullptr);
+        if (!centerRef)
+            return 0;
+    }
+    // without a circle a region draws from the polys under its bounds only,
+    // instead of rejecting draws over the whole mesh
+    float regionArea = 0;
+    if (radius <= 0 && regionId)
+    {
+        const VolumeRegion* region = FindRegion(regionId);
+        if (!region)
+            return 0;
+        regionArea = CollectRandomPolys(mNavMesh, region->aabb, filter, tlRandomPolys);
+        if (regionArea <= 0)
+            return 0;
+    }
+    tlRandom.seed(seed);
+    const float minSpacingSqr = minSpacing > 0 ? minSpacing * minSpacing : 0;
+    dtNavMeshQuery* query = ctx.query;
+    dtNavMeshQuery* largeQuery = nullptr;
+    bool poolChecked = radius <= 0;
+    int found = 0;
+    for (int tries = count * RANDOM_POINT_TRIES; tries > 0 && found < count; --tries)
+    {
+        dtPolyRef ref = 0;
+        Vector3& pos = points[found];
+        dtStatus status = DT_FAILURE;
+        if (radius > 0)
+            status = query->findRandomPointAroundCircle(centerRef, (const float*)&center, radius, &filter, RandomFloat, &ref, (float*)&pos);
+        else if (regionArea > 0)
+            status = FindRandomPointInPolys(mNavMesh, query, tlRandomPolys, regionArea, &ref, (float*)&pos);
+        else
+            status = query->findRandomPoint(&filter, RandomFloat, &ref, (float*)&pos);
+        // the circle search reports no DT_OUT_OF_NODES, a full small pool means
+        // it missed polys, so this and the remaining draws use a large pool.
+        // Every draw searches the same circle, the first one tells.
+        if (!poolChecked)
+        {
+            poolChecked = true;
+            const dtNodePool* pool = query->getNodePool();
+            if (pool->getNodeCount() >= pool->getMaxNodes() && ctx.queryNodes < mMaxSearchNodes)
+                largeQuery = AcquireLargeQuery();
+            if (largeQuery)
+            {
+                query = largeQuery;
+                ++tries;
+                continue;
+            }
+        }
+        if (!dtStatusSucceed(status))
+            continue;
+        // findRandomPointAroundCircle picks polys touching the circle, not points inside it
+        if (radius > 0 && dtVdist2DSqr((const float*)&pos, (const float*)&center) > radius * radius)
+            continue;
+        // the region is no box, polys under its bounds may reach outside it
+        if (regionId && GetRegionId(pos) != regionId)
+            continue;
+        bool spaced = true;
+        for (int i = 0; i < found && spaced && minSpacingSqr > 0; ++i)
+            spaced = dtVdistSqr((const float*)&points[i], (const float*)&pos) >= minSpacingSqr;
+        if (spaced)
+            ++found;
+    }
+    if (largeQuery)
+        ReleaseLargeQuery(largeQuery);
+    return found;
+}
+
+bool Navi::WalkablePoly(const dtPolyRef polyRef)
+{
+    const dtMeshTile* tile = nullptr;
+    const dtPoly* poly = nullptr;
+    dtStatus status = mNavMesh->getTileAndPolyByRef(polyRef, &tile, &poly);
+    if (status != DT_SUCCESS)
+        return false;
+    return poly->flags == POLYFLAGS_WALK;
+}
+
+void Navi::MakePathOutOfBlock(NaviQueryContext& ctx, const Vector3& polySize, dtPolyRef endRef)
+{
+    if (ctx.pathCount < 2)
+        return;
+    const int lastIndex = ctx.pathCount - 1;
+    for (int i = lastIndex; i > 0; --i)
+    {
+        Vector3& fromPt = ctx.path[i];
+        Vector3& toPt = ctx.path[i - 1];
+        Vector3 diffPt(toPt);
+        diffPt.Sub(fromPt);
+        float length = diffPt.Length();
+        int splitCount = (int)(length / 0.1f);
+        if (splitCount < 1)
+            splitCount = 1;
+        diffPt.Mul(1.0f / (float)splitCount);
+        Vector3 pt(fromPt);
+        for (int j = 0; j < splitCount; ++j)
+        {
+            dtPolyRef polyRef = 0;
+            dtStatus status = DT_SUCCESS;
+            // the end usually is walkable, its poly is known from the corridor
+            if (i == lastIndex && j == 0 && IsPolyHintValid(ctx, endRef, pt, polySize, mPolyFilter))
+            {
+                polyRef = endRef;
+            }
+            else
+            {
+                ++ctx.pathStats[PATH_STAT_OUT_OF_BLOCK_NEAREST];
+                status = ctx.query->findNearestPoly((float*)&pt, (float*)&polySize, mPolyFilter, &polyRef, nullptr);
+            }
+            if (status & DT_SUCCESS)
+            {
+                if (WalkablePoly(polyRef))
+                {
+                    ctx.path[i] = pt;
+                    ctx.pathCount = i + 1;
+                    return;
+                }
+            }
+            pt.Add(diffPt);
+        }
+    }
+}
+
+void Navi::StraightenPath(NaviQueryContext& ctx)
+{
+    if (ctx.pathCount <= 2)
+        return;
+    bool* removes = ctx.pathRemoves;
+    memset(removes, 0, sizeof(bool) * ctx.pathCount);
+    int removeCount = 0;
+    int maxFrom = ctx.pathCount - 2;
+    float* path = (float*)ctx.path;
+    for (int i = 0; i < maxFrom; ++i)
+    {
+        dtPolyRef fromRef = ctx.pathPolys[i];
+        int j = i + 2;
+        for (; j < ctx.pathCount; ++j)
+        {
+            float t = 0;
+            ++ctx.pathStats[PATH_STAT_STRAIGHTEN_RAYCASTS];
+            dtStatus rayStatus = ctx.query->raycast(fromRef, path + i * 3, path + j * 3, mPathFilter,
+                &t, nullptr, ctx.searchPolys, &ctx.searchedPolyCount, mMaxPolys);
+            if (dtStatusSucceed(rayStatus) && t > 1.0f)
+            {
+                removes[j - 1] = true;
+                ++removeCount;
+                continue;
+            }
+            break;
+        }
+        i = j - 2;
+    }
+    if (!removeCount)
+        return;
+    int count = ctx.pathCount - removeCount;
+    int src = 0;
+    for (int i = 0; i < count; ++i, ++src)
+    {
+        for (; src < ctx.pathCount; ++src)
+        {
+            if (!removes[src])
+                break;
+        }
+        if (i == src)
+            continue;
+        memcpy(path + i * 3, path + src * 3, sizeof(float) * 3);
+        ctx.pathPolys[i] = ctx.pathPolys[src];
+    }
+    ctx.pathCount = count;
 }
 
-void Navi::MakePathStraight(int& pathCount, float* path, const Vector3& polySize)
+void Navi::MakePathStraight(int& pathCount, float* path, const Vector3& polySize, dtPolyRef startRef)
 {
     if (pathCount <= 2)
         return;
-    bool* removes = mPathRemoves;
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+        return;
+    bool* removes = ctx.pathRemoves;
     memset(removes, 0, sizeof(bool) * pathCount);
     int removeCount = 0;
     int maxFrom = pathCount - 2;
+    // poly of path[i] when known, the next start is the end of the last clear ray
+    dtPolyRef fromRef = startRef;
     for (int i = 0; i < maxFrom; ++i)
     {
-        dtPolyRef fromRef;
         float* start = path + i * 3;
-        dtStatus status = mNavQuery->findNearestPoly(start, (float*)&polySize, mPathFilter, &fromRef, nullptr);
-        if (!dtStatusSucceed(status))
+        fromRef = ResolvePolyHint(ctx, fromRef, (const Vector3&)*start, polySize, mPathFilter);
+        if (!fromRef)
         {
             LOG_ERROR("Cannot find from poly (%f, %f, %f)", start[0], start[1], start[2]);
             return;
         }
+        dtPolyRef nextRef = 0;
         int j = i + 2;
         for (; j < pathCount; ++j)
         {
             float t = 0;
-            dtStatus rayStatus = mNavQuery->raycast(fromRef, path + i * 3, path + j * 3, mPathFilter,
-                &t, nullptr, mSearchPolys, &mSearchedPolyCount, mMaxPolys);
+            dtStatus rayStatus = ctx.query->raycast(fromRef, path + i * 3, path + j * 3, mPathFilter,
+                &t, nullptr, ctx.searchPolys, &ctx.searchedPolyCount, mMaxPolys);
             if (dtStatusSucceed(rayStatus) && t > 1.0f)
             {
                 removes[j - 1] = true;
                 ++removeCount;
+                nextRef = ctx.searchedPolyCount ? ctx.searchPolys[ctx.searchedPolyCount - 1] : 0;
                 continue;
             }
             break;
         }
         i = j - 2;
+        fromRef = nextRef;
     }
     if (!removeCount)
         return;
@@ -1146,9 +2164,46 @@ void Navi::MakePathStraight(int& pathCount, float* path, const Vector3& polySize
     pathCount = count;
 }
 
-int Navi::FindPath(const Vector3& start, const Vector3& end, const Vector3& polySize)
+void Navi::GetPathStats(long long* stats)
 {
-    if (!mNavMesh || !mNavQuery)
+    std::lock_guard<std::mutex> guard(mStatLock);
+    memcpy(stats, mLastPathStats, sizeof(mLastPathStats));
+    memcpy(stats + PATH_STAT_COUNT, mPathStatTotals, sizeof(mPathStatTotals));
+}
+
+void Navi::ResetPathStats()
+{
+    std::lock_guard<std::mutex> guard(mStatLock);
+    memset(mPathStatTotals, 0, sizeof(mPathStatTotals));
+}
+
+int Navi::FindPath(const Vector3& start, const Vector3& end, const Vector3& polySize, dtPolyRef startRef, dtPolyRef endRef)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    memset(ctx.pathStats, 0, sizeof(ctx.pathStats));
+    const long long begin = StatNow();
+    int status = FindPathInternal(ctx, start, end, polySize, startRef, endRef);
+    ctx.pathStats[PATH_STAT_QUERIES] = 1;
+    ctx.pathStats[PATH_STAT_TOTAL_NS] = StatNow() - begin;
+    std::lock_guard<std::mutex> guard(mStatLock);
+    memcpy(mLastPathStats, ctx.pathStats, sizeof(mLastPathStats));
+    for (int i = 0; i < PATH_STAT_COUNT; ++i)
+    {
+        if (i == PATH_STAT_NODE_POOL_HIGH)
+            mPathStatTotals[i] = dtMax(mPathStatTotals[i], ctx.pathStats[i]);
+        else
+            mPathStatTotals[i] += ctx.pathStats[i];
+    }
+    return status;
+}
+
+int Navi::FindPathInternal(NaviQueryContext& ctx, const Vector3& start, const Vector3& end, const Vector3& polySize,
+    dtPolyRef startHint, dtPolyRef endHint)
+{
+    long long phaseBegin = StatNow();
+    ctx.pathStartRef = 0;
+    ctx.pathEndRef = 0;
+    if (!PrepareQuery(ctx))
     {
         LOG_ERROR("Navi mesh or query is not inited");
         return DT_FAILURE;
@@ -1161,22 +2216,30 @@ int Navi::FindPath(const Vector3& start, const Vector3& end, const Vector3& poly
     }
     
     dtStatus status = DT_SUCCESS;
-    dtPolyRef startRef = 0;
-    dtPolyRef endRef = 0;
+    dtPolyRef startRef = startHint;
+    dtPolyRef endRef = endHint;
 
-    status = mNavQuery->findNearestPoly((float*)&start, (float*)&polySize, mPolyFilter, &startRef, nullptr);
-    if (!(status & DT_SUCCESS))
+    if (!IsPolyHintValid(ctx, startRef, start, polySize, mPolyFilter))
     {
-        LOG_ERROR("Cannot find start poly (%f, %f, %f)", start.x, start.y, start.z);
-        return status;
+        status = ctx.query->findNearestPoly((float*)&start, (float*)&polySize, mPolyFilter, &startRef, nullptr);
+        if (!(status & DT_SUCCESS))
+        {
+            LOG_ERROR("Cannot find start poly (%f, %f, %f)", start.x, start.y, start.z);
+            return status;
+        }
     }
     
-    status = mNavQuery->findNearestPoly((float*)&end, (float*)&polySize, mPolyFilter, &endRef, nullptr);
-    if (!(status & DT_SUCCESS))
+    if (!IsPolyHintValid(ctx, endRef, end, polySize, mPolyFilter))
     {
-        LOG_ERROR("Cannot find end poly (%f, %f, %f)", end.x, end.y, end.z);
-        return status;
+        status = ctx.query->findNearestPoly((float*)&end, (float*)&polySize, mPolyFilter, &endRef, nullptr);
+        if (!(status & DT_SUCCESS))
+        {
+            LOG_ERROR("Cannot find end poly (%f, %f, %f)", end.x, end.y, end.z);
+            return status;
+        }
     }
+    ctx.pathStartRef = startRef;
+    ctx.pathEndRef = endRef;
 
     bool startWalkable = WalkablePoly(startRef);
     bool endWalkable = WalkablePoly(endRef);
@@ -1188,6 +2251,9 @@ int Navi::FindPath(const Vector3& start, const Vector3& end, const Vector3& poly
     float* startPtr = (float*)&start;
     float* endPtr = (float*)&end;
     bool exchanged = false;
+    long long phaseEnd = StatNow();
+    ctx.pathStats[PATH_STAT_LOCATE_NS] = phaseEnd - phaseBegin;
+    phaseBegin = phaseEnd;
     if (!startWalkable)
     {
         exchanged = true;
@@ -1201,56 +2267,782 @@ int Navi::FindPath(const Vector3& start, const Vector3& end, const Vector3& poly
         endPtr = tempPtr;
     }
     
-    mSearchedPolyCount = 0;
-    status = mNavQuery->findPath(startRef, endRef, startPtr, endPtr, mPathFilter, mSearchPolys, &mSearchedPolyCount, mMaxPolys);
-    if (!(status & DT_SUCCESS))
+    ctx.pathCount = 0;
+    PathCacheKey cacheKey;
+    bool cachePath = false;
+    if (NeedDoorGraphPath((const Vector3&)*startPtr, (const Vector3&)*endPtr))
     {
-        LOG_ERROR("Cannot find path from start(%f, %f, %f) to end(%f, %f, %f)", start.x, start.y, start.z, end.x, end.y, end.z);
-        return status;
+        status = FindDoorGraphPath(ctx, startRef, endRef, startPtr, endPtr);
+        if (!dtStatusSucceed(status))
+        {
+            // fall back to a full-mesh search below
+            LOG_WARN("Cannot find door graph path from start(%f, %f, %f) to end(%f, %f, %f)", start.x, start.y, start.z, end.x, end.y, end.z);
+            ctx.pathCount = 0;
+        }
     }
-    mPathCount = 0;
-    if (mSearchedPolyCount)
+    if (!ctx.pathCount)
     {
-        // In case of partial path, make sure the end point is clamped to the last polygon.
-        float epos[3];
-        dtVcopy(epos, endPtr);
-        if (mSearchPolys[mSearchedPolyCount - 1] != endRef)
-            mNavQuery->closestPointOnPoly(mSearchPolys[mSearchedPolyCount - 1], endPtr, epos, nullptr);
-        
-        mNavQuery->findStraightPath(startPtr, epos, mSearchPolys, mSearchedPolyCount,
-                                     (float*)mPath, nullptr, mPathPolys, &mPathCount, mMaxPolys, 0);
-        StraightenPath();
-        MakePathOutOfBlock(polySize);
-        if (mPathCount > 1 && exchanged)
+        ctx.searchedPolyCount = 0;
+        PathCacheHit cacheHit = PATH_CACHE_MISS;
+        if (mPathCacheSize > 0)
+        {
+            cacheKey.startRef = startRef;
+            cacheKey.endRef = endRef;
+            cacheKey.include = mPathFilter->getIncludeFlags();
+            cacheKey.exclude = mPathFilter->getExcludeFlags();
+            memcpy(cacheKey.polySize, &polySize, sizeof(float) * 3);
+            cacheHit = FindPathCache(ctx, cacheKey, start, end, &status);
+            if (cacheHit == PATH_CACHE_PATH)
+                return status;
+        }
+
+        if (cacheHit == PATH_CACHE_CORRIDOR)
+        {
+            // same poly pair as a cached query, skip A* and reuse the corridor
+            cachePath = true;
+            ctx.pathStats[PATH_STAT_CORRIDOR_LENGTH] += ctx.searchedPolyCount;
+        }
+        else
+        {
+            status = FindPolyPath(ctx, startRef, endRef, startPtr, endPtr, true);
+            if (!(status & DT_SUCCESS))
+            {
+                LOG_ERROR("Cannot find path from start(%f, %f, %f) to end(%f, %f, %f)", start.x, start.y, start.z, end.x, end.y, end.z);
+                return status;
+            }
+            if (mPathCacheSize > 0)
+            {
+                AddPathCache(ctx, cacheKey, status);
+                cachePath = true;
+            }
+        }
+        phaseEnd = StatNow();
+        ctx.pathStats[PATH_STAT_SEARCH_NS] += phaseEnd - phaseBegin;
+        phaseBegin = phaseEnd;
+        if (ctx.searchedPolyCount)
+        {
+            // In case of partial path, make sure the end point is clamped to the last polygon.
+            float epos[3];
+            dtVcopy(epos, endPtr);
+            if (ctx.searchPolys[ctx.searchedPolyCount - 1] != endRef)
+                ctx.query->closestPointOnPoly(ctx.searchPolys[ctx.searchedPolyCount - 1], endPtr, epos, nullptr);
+            
+            ctx.query->findStraightPath(startPtr, epos, ctx.searchPolys, ctx.searchedPolyCount,
+                                         (float*)ctx.path, nullptr, ctx.pathPolys, &ctx.pathCount, mMaxPolys, 0);
+        }
+        phaseEnd = StatNow();
+        ctx.pathStats[PATH_STAT_STRAIGHT_PATH_NS] = phaseEnd - phaseBegin;
+    }
+    else
+    {
+        phaseEnd = StatNow();
+        ctx.pathStats[PATH_STAT_SEARCH_NS] = phaseEnd - phaseBegin;
+    }
+    if (ctx.pathCount)
+    {
+        // last corridor poly holds the end, taken before the raycasts reuse the buffer
+        const dtPolyRef lastRef = ctx.searchedPolyCount ? ctx.searchPolys[ctx.searchedPolyCount - 1] : endRef;
+        phaseBegin = phaseEnd;
+        StraightenPath(ctx);
+        phaseEnd = StatNow();
+        ctx.pathStats[PATH_STAT_STRAIGHTEN_NS] = phaseEnd - phaseBegin;
+        MakePathOutOfBlock(ctx, polySize, lastRef);
+        ctx.pathStats[PATH_STAT_OUT_OF_BLOCK_NS] = StatNow() - phaseEnd;
+        if (ctx.pathCount > 1 && exchanged)
         {
             const int vectorSize = sizeof(float) * 3;
-            float* pathPtr = (float*)mPath;
-            int mid = mPathCount / 2;
-            int lastIndex = mPathCount - 1;
+            float* pathPtr = (float*)ctx.path;
+            float temp[3];
+            int mid = ctx.pathCount / 2;
+            int lastIndex = ctx.pathCount - 1;
             for (int i = 0; i < mid; ++i)
             {
                 int exchangePos = lastIndex - i;
-                memcpy(epos, pathPtr + i * 3, vectorSize);
+                memcpy(temp, pathPtr + i * 3, vectorSize);
                 memcpy(pathPtr + i * 3, pathPtr + exchangePos * 3, vectorSize);
-                memcpy(pathPtr + exchangePos * 3, epos, vectorSize);
+                memcpy(pathPtr + exchangePos * 3, temp, vectorSize);
             }
         }
     }
-    if (mPathCount < 2)
+    if (ctx.pathCount < 2)
         return DT_FAILURE;
+    if (cachePath)
+        SetPathCachePath(ctx, cacheKey, start, end);
     return status;
 }
 
-float Navi::PathRaycast(const Vector3& start, const Vector3& end, const Vector3& polySize)
+int Navi::FindNearestGoalPath(const Vector3& start, int goalCount, const Vector3* goals)
 {
-    dtPolyRef fromRef;
-    dtStatus status = mNavQuery->findNearestPoly((float*)&start, (float*)&polySize, mPathFilter, &fromRef, nullptr);
-    if (!dtStatusSucceed(status))
+    NaviQueryContext& ctx = GetQueryContext();
+    ctx.pathCount = 0;
+    if (!PrepareQuery(ctx) || goalCount <= 0)
+        return -1;
+    dtPolyRef startRef = 0;
+    float startPos[3];
+    dtStatus status = ctx.query->findNearestPoly((const float*)&start, (const float*)&mDefaultPolySize, mPathFilter,
+        &startRef, startPos);
+    if (!dtStatusSucceed(status) || !startRef)
+    {
+        LOG_ERROR("Cannot find start poly (%f, %f, %f)", start.x, start.y, start.z);
+        return -1;
+    }
+    std::vector<dtPolyRef> goalRefs(goalCount);
+    std::vector<float> goalPos(goalCount * 3);
+    for (int i = 0; i < goalCount; ++i)
+    {
+        goalRefs[i] = 0;
+        ctx.query->findNearestPoly((const float*)&goals[i], (const float*)&mDefaultPolySize, mPathFilter,
+            &goalRefs[i], &goalPos[i * 3]);
+    }
+
+    PolySearch& search = *ctx.polySearch;
+    const int goal = search.Run(mNavMesh, startRef, startPos, mPathFilter, HUGE_VALF, mMaxSearchNodes,
+        goalCount, &goalRefs.front(), &goalPos.front());
+    if (goal < 0)
+        return -1;
+    ctx.searchedPolyCount = search.GetPath(goalRefs[goal], ctx.searchPolys, mMaxPolys);
+    // corridor cut at mMaxPolys, clamp the end like a partial path
+    float epos[3];
+    dtVcopy(epos, &goalPos[goal * 3]);
+    if (ctx.searchPolys[ctx.searchedPolyCount - 1] != goalRefs[goal])
+        ctx.query->closestPointOnPoly(ctx.searchPolys[ctx.searchedPolyCount - 1], &goalPos[goal * 3], epos, nullptr);
+    ctx.query->findStraightPath(startPos, epos, ctx.searchPolys, ctx.searchedPolyCount,
+        (float*)ctx.path, nullptr, ctx.pathPolys, &ctx.pathCount, mMaxPolys, 0);
+    if (ctx.pathCount)
+    {
+        const dtPolyRef lastRef = ctx.searchPolys[ctx.searchedPolyCount - 1];
+        StraightenPath(ctx);
+        MakePathOutOfBlock(ctx, mDefaultPolySize, lastRef);
+    }
+    return goal;
+}
+
+int Navi::FindReachablePolys(const Vector3& start, float maxCost, int maxCount, dtPolyRef* refs, float* costs, Vector3* centers)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx) || maxCost < 0 || maxCount <= 0)
+        return 0;
+    dtPolyRef startRef = 0;
+    float startPos[3];
+    dtStatus status = ctx.query->findNearestPoly((const float*)&start, (const float*)&mDefaultPolySize, mPathFilter,
+        &startRef, startPos);
+    if (!dtStatusSucceed(status) || !startRef)
+        return 0;
+
+    PolySearch& search = *ctx.polySearch;
+    search.Run(mNavMesh, startRef, startPos, mPathFilter, maxCost, mMaxSearchNodes);
+    const std::vector<dtPolyRef>& closed = search.GetClosed();
+    const int count = dtMin((int)closed.size(), maxCount);
+    for (int i = 0; i < count; ++i)
+    {
+        refs[i] = closed[i];
+        costs[i] = search.Find(closed[i])->cost;
+        if (centers)
+        {
+            const dtMeshTile* tile = nullptr;
+            const dtPoly* poly = nullptr;
+            mNavMesh->getTileAndPolyByRefUnsafe(closed[i], &tile, &poly);
+            GetPolyCenter(tile, poly, (float*)&centers[i]);
+        }
+    }
+    return count;
+}
+
+float Navi::GetPathDistance(const Vector3& start, const Vector3& end, const Vector3& polySize)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+        return PATH_DISTANCE_UNREACHABLE;
+    dtPolyRef startRef = 0;
+    dtPolyRef endRef = 0;
+    return GetPathDistanceInternal(ctx, start, end, polySize, startRef, endRef);
+}
+
+int Navi::GetPathDistances(int count, const Vector3* pairs, float* distances)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+    {
+        for (int i = 0; i < count; ++i)
+            distances[i] = PATH_DISTANCE_UNREACHABLE;
+        return 0;
+    }
+    int reachableCount = 0;
+    dtPolyRef startRef = 0;
+    dtPolyRef endRef = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        // the polys of the previous pair are the hints of this one
+        distances[i] = GetPathDistanceInternal(ctx, pairs[i * 2], pairs[i * 2 + 1], mDefaultPolySize, startRef, endRef);
+        if (distances[i] >= 0)
+            ++reachableCount;
+    }
+    return reachableCount;
+}
+
+float Navi::GetPathDistanceInternal(NaviQueryContext& ctx, const Vector3& start, const Vector3& end, const Vector3& polySize,
+    dtPolyRef& startRef, dtPolyRef& endRef)
+{
+    if (!IsPolyHintValid(ctx, startRef, start, polySize, mPolyFilter))
+    {
+        startRef = 0;
+        ctx.query->findNearestPoly((const float*)&start, (const float*)&polySize, mPolyFilter, &startRef, nullptr);
+    }
+    if (!IsPolyHintValid(ctx, endRef, end, polySize, mPolyFilter))
+    {
+        endRef = 0;
+        ctx.query->findNearestPoly((const float*)&end, (const float*)&polySize, mPolyFilter, &endRef, nullptr);
+    }
+    if (!startRef || !endRef || (!WalkablePoly(startRef) && !WalkablePoly(endRef)))
+        return PATH_DISTANCE_UNREACHABLE;
+    if (!IsPassable(start, end))
+        return PATH_DISTANCE_UNREACHABLE;
+
+    dtStatus status = FindPolyPath(ctx, startRef, endRef, (const float*)&start, (const float*)&end, false);
+    if (!dtStatusSucceed(status) || !ctx.searchedPolyCount)
+        return PATH_DISTANCE_UNREACHABLE;
+    if (ctx.searchPolys[ctx.searchedPolyCount - 1] != endRef)
+    {
+        // a search that ran out of nodes or corridor may still get to end
+        if (dtStatusDetail(status, DT_OUT_OF_NODES) || dtStatusDetail(status, DT_BUFFER_TOO_SMALL))
+            return PATH_DISTANCE_PARTIAL;
+        return PATH_DISTANCE_UNREACHABLE;
+    }
+    // a straight path longer than the buffer goes on from its last corner over
+    // the rest of the corridor
+    float distance = 0;
+    Vector3 from(start);
+    const dtPolyRef* corridor = ctx.searchPolys;
+    int corridorCount = ctx.searchedPolyCount;
+    for (;;)
+    {
+        int pathCount = 0;
+        status = ctx.query->findStraightPath((const float*)&from, (const float*)&end, corridor, corridorCount,
+            (float*)ctx.path, nullptr, ctx.pathPolys, &pathCount, mMaxPolys, 0);
+        if (!dtStatusSucceed(status))
+            return PATH_DISTANCE_UNREACHABLE;
+        for (int i = 1; i < pathCount; ++i)
+            distance += dtVdist((const float*)&ctx.path[i], (const float*)&ctx.path[i - 1]);
+        if (!dtStatusDetail(status, DT_BUFFER_TOO_SMALL) || pathCount < 2)
+            return distance;
+        // the corner lies on the portal into the poly it is reported with
+        const dtPolyRef cornerRef = ctx.pathPolys[pathCount - 1];
+        int index = 0;
+        while (index < corridorCount && corridor[index] != cornerRef)
+            ++index;
+        if (index >= corridorCount)
+            return PATH_DISTANCE_PARTIAL;
+        from = ctx.path[pathCount - 1];
+        corridor += index;
+        corridorCount -= index;
+    }
+}
+
+float Navi::PathRaycast(const Vector3& start, const Vector3& end, const Vector3& polySize, dtPolyRef* startRef)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+        return -1.0f;
+    const dtPolyRef fromRef = ResolvePolyHint(ctx, startRef ? *startRef : 0, start, polySize, mPathFilter);
+    if (startRef)
+        *startRef = fromRef;
+    if (!fromRef)
         return -1.0f;
     float t = 0;
-    dtStatus rayStatus = mNavQuery->raycast(fromRef, (float*)&start, (float*)&end, mPathFilter,
-        &t, nullptr, mSearchPolys, &mSearchedPolyCount, mMaxPolys);
+    dtStatus rayStatus = ctx.query->raycast(fromRef, (float*)&start, (float*)&end, mPathFilter,
+        &t, nullptr, ctx.searchPolys, &ctx.searchedPolyCount, mMaxPolys);
     if (dtStatusSucceed(rayStatus))
         return t;
     return -1.0f;
 }
+
+int Navi::BatchRaycast(int count, dtPolyRef* refs, const Vector3* segments, float* ts, Vector3* normals)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        ts[i] = -1.0f;
+        normals[i].Set(0, 0, 0);
+    }
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+        return 0;
+    // segments starting in the same tile run back to back so its polys and
+    // the nearest poly lookups stay in cache
+    std::vector<std::pair<long long, int>> order(count);
+    for (int i = 0; i < count; ++i)
+    {
+        int tx = 0;
+        int ty = 0;
+        mNavMesh->calcTileLoc((const float*)&segments[i * 2], &tx, &ty);
+        order[i].first = ((long long)ty << 32) | (unsigned int)tx;
+        order[i].second = i;
+    }
+    std::sort(order.begin(), order.end());
+    int hitCount = 0;
+    for (int k = 0; k < count; ++k)
+    {
+        const int i = order[k].second;
+        const Vector3& start = segments[i * 2];
+        // a hint on the floor above or below would cast along the wrong level,
+        // ResolvePolyHint drops it for the nearest poly at the start height
+        refs[i] = ResolvePolyHint(ctx, refs[i], start);
+        if (!refs[i])
+            continue;
+        dtRaycastHit hit;
+        memset(&hit, 0, sizeof(hit));
+        dtStatus status = ctx.query->raycast(refs[i], (const float*)&start, (const float*)&segments[i * 2 + 1], mPathFilter, 0, &hit);
+        if (!dtStatusSucceed(status))
+            continue;
+        ts[i] = hit.t;
+        if (hit.t <= 1.0f)
+        {
+            normals[i].Set(hit.hitNormal[0], hit.hitNormal[1], hit.hitNormal[2]);
+            ++hitCount;
+        }
+    }
+    return hitCount;
+}
+
+bool Navi::IsPolyHintValid(NaviQueryContext& ctx, dtPolyRef hint, const Vector3& pos, const Vector3& polySize,
+    const dtQueryFilter* filter)
+{
+    // getPolyHeight fails unless pos lies inside the poly seen from above, the
+    // height check rejects a floor above or below pos like findNearestPoly would
+    float height = 0;
+    return hint && ctx.query->isValidPolyRef(hint, filter)
+        && dtStatusSucceed(ctx.query->getPolyHeight(hint, (const float*)&pos, &height))
+        && fabsf(height - pos.y) <= polySize.y;
+}
+
+// Poly queried for the points of one tile, with its xz bounds so most polys
+// are skipped without a getPolyHeight.
+struct HeightCandidate
+{
+    dtPolyRef ref;
+    float bmin[2];
+    float bmax[2];
+};
+
+static void SnapHeight(const dtNavMeshQuery* query, const std::vector<HeightCandidate>& candidates, const float* pos,
+    float maxY, float* height, dtPolyRef* ref)
+{
+    for (int k = 0; k < (int)candidates.size(); ++k)
+    {
+        const HeightCandidate& candidate = candidates[k];
+        if (pos[0] < candidate.bmin[0] || pos[0] > candidate.bmax[0] || pos[2] < candidate.bmin[1] || pos[2] > candidate.bmax[1])
+            continue;
+        float y = 0;
+        if (!dtStatusSucceed(query->getPolyHeight(candidate.ref, pos, &y)) || y < pos[1] || y > maxY)
+            continue;
+        if (!*ref || y > *height)
+        {
+            *height = y;
+            *ref = candidate.ref;
+        }
+    }
+}
+
+int Navi::SnapHeights(int count, const float* xz, float minY, float maxY, float* heights, dtPolyRef* refs)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        heights[i] = minY;
+        refs[i] = 0;
+    }
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx) || count <= 0 || maxY < minY)
+        return 0;
+    // points of one tile share a single BV tree query over their bounds
+    std::vector<std::pair<long long, int>> order(count);
+    for (int i = 0; i < count; ++i)
+    {
+        const float pos[3] = {xz[i * 2], minY, xz[i * 2 + 1]};
+        int tx = 0;
+        int ty = 0;
+        mNavMesh->calcTileLoc(pos, &tx, &ty);
+        order[i].first = ((long long)ty << 32) | (unsigned int)tx;
+        order[i].second = i;
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<HeightCandidate> candidates;
+    int snappedCount = 0;
+    for (int begin = 0; begin < count;)
+    {
+        int end = begin + 1;
+        while (end < count && order[end].first == order[begin].first)
+            ++end;
+        float bmin[2] = {HUGE_VALF, HUGE_VALF};
+        float bmax[2] = {-HUGE_VALF, -HUGE_VALF};
+        for (int k = begin; k < end; ++k)
+        {
+            const float* point = &xz[order[k].second * 2];
+            bmin[0] = dtMin(bmin[0], point[0]);
+            bmin[1] = dtMin(bmin[1], point[1]);
+            bmax[0] = dtMax(bmax[0], point[0]);
+            bmax[1] = dtMax(bmax[1], point[1]);
+        }
+        const float center[3] = {(bmin[0] + bmax[0]) * 0.5f, (minY + maxY) * 0.5f, (bmin[1] + bmax[1]) * 0.5f};
+        const float halfExtents[3] = {(bmax[0] - bmin[0]) * 0.5f + 0.01f, (maxY - minY) * 0.5f + 0.01f,
+            (bmax[1] - bmin[1]) * 0.5f + 0.01f};
+        int polyCount = 0;
+        dtStatus status = ctx.query->queryPolygons(center, halfExtents, mPathFilter, ctx.searchPolys, &polyCount, mMaxPolys);
+        // a tile too crowded for the buffer falls back to a query per point
+        const bool perPoint = !dtStatusSucceed(status) || dtStatusDetail(status, DT_BUFFER_TOO_SMALL);
+        for (int k = begin; k < end; ++k)
+        {
+            const int i = order[k].second;
+            const float pos[3] = {xz[i * 2], minY, xz[i * 2 + 1]};
+            if (perPoint)
+            {
+                const float pointCenter[3] = {pos[0], center[1], pos[2]};
+                const float pointExtents[3] = {0.01f, halfExtents[1], 0.01f};
+                polyCount = 0;
+                ctx.query->queryPolygons(pointCenter, pointExtents, mPathFilter, ctx.searchPolys, &polyCount, mMaxPolys);
+            }
+            if (perPoint || k == begin)
+            {
+                candidates.resize(polyCount);
+                for (int p = 0; p < polyCount; ++p)
+                {
+                    const dtMeshTile* tile = nullptr;
+                    const dtPoly* poly = nullptr;
+                    mNavMesh->getTileAndPolyByRefUnsafe(ctx.searchPolys[p], &tile, &poly);
+                    HeightCandidate& candidate = candidates[p];
+                    candidate.ref = ctx.searchPolys[p];
+                    candidate.bmin[0] = candidate.bmin[1] = HUGE_VALF;
+                    candidate.bmax[0] = candidate.bmax[1] = -HUGE_VALF;
+                    for (int v = 0; v < poly->vertCount; ++v)
+                    {
+                        const float* vert = &tile->verts[poly->verts[v] * 3];
+                        candidate.bmin[0] = dtMin(candidate.bmin[0], vert[0]);
+                        candidate.bmin[1] = dtMin(candidate.bmin[1], vert[2]);
+                        candidate.bmax[0] = dtMax(candidate.bmax[0], vert[0]);
+                        candidate.bmax[1] = dtMax(candidate.bmax[1], vert[2]);
+                    }
+                }
+            }
+            SnapHeight(ctx.query, candidates, pos, maxY, &heights[i], &refs[i]);
+            if (refs[i])
+                ++snappedCount;
+        }
+        begin = end;
+    }
+    return snappedCount;
+}
+
+dtPolyRef Navi::ResolvePolyHint(NaviQueryContext& ctx, dtPolyRef hint, const Vector3& pos, const Vector3& polySize,
+    const dtQueryFilter* filter)
+{
+    if (IsPolyHintValid(ctx, hint, pos, polySize, filter))
+        return hint;
+    dtPolyRef ref = 0;
+    ctx.query->findNearestPoly((const float*)&pos, (const float*)&polySize, filter, &ref, nullptr);
+    return ref;
+}
+
+int Navi::MoveAlongSurface(int count, dtPolyRef* refs, const Vector3* from, const Vector3* to, Vector3* result)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            refs[i] = 0;
+            result[i] = from[i];
+        }
+        return 0;
+    }
+    int movedCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const dtPolyRef startRef = ResolvePolyHint(ctx, refs[i], from[i]);
+        refs[i] = 0;
+        result[i] = from[i];
+        if (!startRef)
+            continue;
+        int visitedCount = 0;
+        dtStatus status = ctx.query->moveAlongSurface(startRef, (const float*)&from[i], (const float*)&to[i], mPathFilter,
+            (float*)&result[i], ctx.searchPolys, &visitedCount, mMaxPolys);
+        if (!dtStatusSucceed(status) || !visitedCount)
+        {
+            result[i] = from[i];
+            continue;
+        }
+        refs[i] = ctx.searchPolys[visitedCount - 1];
+        // moveAlongSurface keeps the height of from, put the result on the poly
+        float height = 0;
+        if (dtStatusSucceed(ctx.query->getPolyHeight(refs[i], (const float*)&result[i], &height)))
+            result[i].y = height;
+        ++movedCount;
+    }
+    return movedCount;
+}
+
+/////////////////////////////////////////////////////////////////
+// FlowField
+void Navi::ClearFlowFields()
+{
+    for (FlowFieldList::iterator it = mFlowFields.begin(); it != mFlowFields.end(); ++it)
+        delete it->field;
+    mFlowFields.clear();
+}
+
+bool Navi::IsSameFlowField(const FlowFieldEntry& a, const FlowFieldEntry& b)
+{
+    return a.goal.x == b.goal.x && a.goal.y == b.goal.y && a.goal.z == b.goal.z && a.maxCost == b.maxCost
+        && a.include == b.include && a.exclude == b.exclude
+        && a.worldVersion == b.worldVersion && a.meshVersion == b.meshVersion;
+}
+
+int Navi::BuildFlowField(const Vector3& goal, float maxCost)
+{
+    const int fieldId = FindFlowField(goal, maxCost);
+    if (fieldId)
+        return fieldId;
+    FlowFieldEntry entry;
+    if (!CreateFlowField(goal, maxCost, entry))
+        return 0;
+    return PublishFlowField(entry);
+}
+
+int Navi::FindFlowField(const Vector3& goal, float maxCost)
+{
+    FlowFieldEntry key;
+    key.goal = goal;
+    key.maxCost = maxCost;
+    key.worldVersion = mWorldVersion;
+    key.meshVersion = mMeshVersion;
+    key.include = mPathFilter->getIncludeFlags();
+    key.exclude = mPathFilter->getExcludeFlags();
+    std::lock_guard<std::mutex> guard(mFlowFieldLock);
+    for (FlowFieldList::iterator it = mFlowFields.begin(); it != mFlowFields.end(); ++it)
+    {
+        if (IsSameFlowField(*it, key))
+        {
+            mFlowFields.splice(mFlowFields.begin(), mFlowFields, it);
+            return it->id;
+        }
+    }
+    return 0;
+}
+
+bool Navi::CreateFlowField(const Vector3& goal, float maxCost, FlowFieldEntry& entry)
+{
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx) || maxCost <= 0)
+        return false;
+    dtPolyRef goalRef = 0;
+    Vector3 goalPos;
+    dtStatus status = ctx.query->findNearestPoly((const float*)&goal, (const float*)&mDefaultPolySize, mPathFilter,
+        &goalRef, (float*)&goalPos);
+    if (!dtStatusSucceed(status) || !goalRef)
+        return false;
+
+    FlowField* field = new FlowField;
+    if (!field->Build(mNavMesh, goalRef, (const float*)&goalPos, mPathFilter, maxCost, mMaxSearchNodes))
+    {
+        delete field;
+        return false;
+    }
+    entry.id = 0;
+    entry.goal = goal;
+    entry.maxCost = maxCost;
+    entry.worldVersion = mWorldVersion;
+    entry.meshVersion = mMeshVersion;
+    entry.include = mPathFilter->getIncludeFlags();
+    entry.exclude = mPathFilter->getExcludeFlags();
+    entry.field = field;
+    return true;
+}
+
+int Navi::PublishFlowField(FlowFieldEntry& entry)
+{
+    // a door, obstacle or filter change between the locks left it stale
+    if (entry.worldVersion != mWorldVersion || entry.meshVersion != mMeshVersion
+        || entry.include != mPathFilter->getIncludeFlags() || entry.exclude != mPathFilter->getExcludeFlags())
+    {
+        delete entry.field;
+        entry.field = nullptr;
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(mFlowFieldLock);
+    FlowFieldList::iterator it = mFlowFields.begin();
+    while (it != mFlowFields.end())
+    {
+        if (it->worldVersion != mWorldVersion || it->meshVersion != mMeshVersion)
+        {
+            delete it->field;
+            it = mFlowFields.erase(it);
+            continue;
+        }
+        if (IsSameFlowField(*it, entry))
+        {
+            delete entry.field;
+            entry.field = nullptr;
+            mFlowFields.splice(mFlowFields.begin(), mFlowFields, it);
+            return it->id;
+        }
+        ++it;
+    }
+
+    // ids stay positive, 0 means no field
+    entry.id = mNextFlowFieldId;
+    mNextFlowFieldId = mNextFlowFieldId < INT_MAX ? mNextFlowFieldId + 1 : 1;
+    mFlowFields.push_front(entry);
+    while ((int)mFlowFields.size() > FLOW_FIELD_CACHE_SIZE)
+    {
+        delete mFlowFields.back().field;
+        mFlowFields.pop_back();
+    }
+    return entry.id;
+}
+
+int Navi::SampleFlowField(int fieldId, int count, dtPolyRef* refs, const Vector3* pos, Vector3* dirs, float* costs)
+{
+    // fields are only freed under the write lock, so the one found stays
+    // valid after the guard while the caller holds the read lock
+    const FlowField* field = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(mFlowFieldLock);
+        for (FlowFieldList::const_iterator it = mFlowFields.begin(); it != mFlowFields.end(); ++it)
+        {
+            if (it->id == fieldId)
+            {
+                if (it->worldVersion == mWorldVersion && it->meshVersion == mMeshVersion)
+                    field = it->field;
+                break;
+            }
+        }
+    }
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!field || !PrepareQuery(ctx))
+        return -1;
+    int insideCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        refs[i] = ResolvePolyHint(ctx, refs[i], pos[i]);
+        dirs[i].Set(0, 0, 0);
+        costs[i] = -1.0f;
+        const FlowCell* cell = field->Find(refs[i]);
+        if (!cell)
+            continue;
+        ++insideCount;
+        costs[i] = cell->cost;
+        float dir[3];
+        dtVsub(dir, cell->waypoint, (const float*)&pos[i]);
+        const float length = dtVlen(dir);
+        if (length > 1e-4f)
+            dirs[i].Set(dir[0] / length, dir[1] / length, dir[2] / length);
+    }
+    return insideCount;
+}
+
+/////////////////////////////////////////////////////////////////
+// Crowd
+bool Navi::InitCrowd(int maxAgents, float maxAgentRadius)
+{
+    ClearCrowd();
+    if (!mNavMesh || maxAgents <= 0 || maxAgentRadius <= 0)
+        return false;
+    NaviAllocScope allocScope(mMemCounter);
+    mCrowd = dtAllocCrowd();
+    if (!mCrowd)
+        return false;
+    if (!mCrowd->init(maxAgents, maxAgentRadius, mNavMesh))
+    {
+        LOG_ERROR("Navi crowd init failed, maxAgents=%d, maxAgentRadius=%f", maxAgents, maxAgentRadius);
+        ClearCrowd();
+        return false;
+    }
+    // agents steer with the path filter
+    *mCrowd->getEditableFilter(0) = *mPathFilter;
+    mCrowdMaxAgents = maxAgents;
+    return true;
+}
+
+void Navi::ClearCrowd()
+{
+    dtFreeCrowd(mCrowd);
+    mCrowd = nullptr;
+    mCrowdMaxAgents = 0;
+}
+
+int Navi::AddCrowdAgent(const Vector3& pos, float radius, float height, float maxSpeed, float maxAcceleration)
+{
+    if (!mCrowd)
+        return -1;
+    // the RecastDemo defaults for everything but the body and speed
+    dtCrowdAgentParams params;
+    memset(&params, 0, sizeof(params));
+    params.radius = radius;
+    params.height = height;
+    params.maxAcceleration = maxAcceleration;
+    params.maxSpeed = maxSpeed;
+    params.collisionQueryRange = radius * 12.0f;
+    params.pathOptimizationRange = radius * 30.0f;
+    params.separationWeight = 2.0f;
+    params.updateFlags = DT_CROWD_ANTICIPATE_TURNS | DT_CROWD_OBSTACLE_AVOIDANCE | DT_CROWD_SEPARATION
+        | DT_CROWD_OPTIMIZE_VIS | DT_CROWD_OPTIMIZE_TOPO;
+    params.obstacleAvoidanceType = 0;
+    params.queryFilterType = 0;
+    const int idx = mCrowd->addAgent((const float*)&pos, &params);
+    if (idx < 0)
+        return -1;
+    // dtCrowd keeps agents placed off the mesh as invalid, they would never move
+    if (mCrowd->getAgent(idx)->state == DT_CROWDAGENT_STATE_INVALID)
+    {
+        mCrowd->removeAgent(idx);
+        return -1;
+    }
+    return idx;
+}
+
+bool Navi::RemoveCrowdAgent(int idx)
+{
+    if (!mCrowd || idx < 0 || idx >= mCrowdMaxAgents || !mCrowd->getAgent(idx)->active)
+        return false;
+    mCrowd->removeAgent(idx);
+    return true;
+}
+
+bool Navi::SetCrowdTarget(int idx, const Vector3& target)
+{
+    if (!mCrowd || idx < 0 || idx >= mCrowdMaxAgents || !mCrowd->getAgent(idx)->active)
+        return false;
+    NaviQueryContext& ctx = GetQueryContext();
+    if (!PrepareQuery(ctx))
+        return false;
+    dtPolyRef targetRef = 0;
+    Vector3 targetPos;
+    dtStatus status = ctx.query->findNearestPoly((const float*)&target, (const float*)&mDefaultPolySize, mPathFilter,
+        &targetRef, (float*)&targetPos);
+    if (!dtStatusSucceed(status) || !targetRef)
+        return false;
+    return mCrowd->requestMoveTarget(idx, targetRef, (const float*)&targetPos);
+}
+
+int Navi::UpdateCrowd(float dt, float* state)
+{
+    if (!mCrowd)
+        return 0;
+    mCrowd->update(dt, nullptr);
+
+    const int maxAgents = mCrowdMaxAgents;
+    memset(state, 0, sizeof(float) * CROWD_LANE_COUNT * maxAgents);
+    int activeCount = 0;
+    for (int i = 0; i < maxAgents; ++i)
+    {
+        const dtCrowdAgent* agent = mCrowd->getAgent(i);
+        if (!agent->active)
+            continue;
+        ++activeCount;
+        state[CROWD_LANE_POS_X * maxAgents + i] = agent->npos[0];
+        state[CROWD_LANE_POS_Y * maxAgents + i] = agent->npos[1];
+        state[CROWD_LANE_POS_Z * maxAgents + i] = agent->npos[2];
+        state[CROWD_LANE_VEL_X * maxAgents + i] = agent->vel[0];
+        state[CROWD_LANE_VEL_Y * maxAgents + i] = agent->vel[1];
+        state[CROWD_LANE_VEL_Z * maxAgents + i] = agent->vel[2];
+        state[CROWD_LANE_STATE * maxAgents + i] = (float)agent->state;
+    }
+    return activeCount;
+}
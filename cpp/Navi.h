@@ -2,6 +2,9 @@
 
 #include <vector>
 #include <map>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
 #include "QuadTree.h"
 
 #ifdef _WIN32
@@ -15,7 +18,25 @@
 #endif
 
 #define MAX_QUERY_INIT_NODE 65535
+// node pool of the per-context queries, larger searches retry on a pooled
+// query of maxSearchNodes: corridor searches through SearchCorridor and the
+// circle of FindRandomPoints. Raycasts use no nodes, moveAlongSurface has the
+// fixed tiny pool of Detour, and PolySearch and landmark searches size their
+// own pools by maxSearchNodes.
+#define SMALL_QUERY_INIT_NODE 2048
 #define MAX_SEARCH_POLYS 1024
+#define DEFAULT_TILE_ALLOC_CAPACITY 32000
+#define TILE_ALLOC_CHUNK_SIZE 32768
+#define FLOW_FIELD_CACHE_SIZE 16
+// idle query contexts a thread-safe navi keeps, more concurrent callers get
+// contexts that are freed when they return them
+#define MAX_IDLE_QUERY_CONTEXTS 32
+// draws per point FindRandomPoints makes before giving up on the rest
+#define RANDOM_POINT_TRIES 16
+// GetPathDistance results that are no distance: end is not reachable, or the
+// node pool or MAX_SEARCH_POLYS cut the corridor before it got to end
+#define PATH_DISTANCE_UNREACHABLE -1.0f
+#define PATH_DISTANCE_PARTIAL -2.0f
 
 enum PolyAreas
 {
@@ -38,6 +59,50 @@ enum PolyFlags
     POLYFLAGS_ALL           = 0xffff    // All abilities.
 };
 
+enum TileAllocStat
+{
+    TILE_ALLOC_CAPACITY,        // Bytes reserved by the tile cache allocator.
+    TILE_ALLOC_USED,            // Bytes used by the last tile rebuild.
+    TILE_ALLOC_HIGH,            // Peak bytes used by a single tile rebuild.
+    TILE_ALLOC_GROW_COUNT,      // Times the allocator had to grow.
+    TILE_ALLOC_STAT_COUNT
+};
+
+// Counters of FindPath. GetPathStats fills the values of the last call
+// followed by the totals since the last reset, PATH_STAT_COUNT each. Totals
+// are sums except PATH_STAT_NODE_POOL_HIGH which keeps the peak.
+enum PathStat
+{
+    PATH_STAT_QUERIES,              // FindPath calls, 1 for the last call.
+    PATH_STAT_NODES_EXPANDED,       // A* nodes closed, over all searches of the call. Detour searches need SetNodeStats.
+    PATH_STAT_NODE_POOL_HIGH,       // Most search nodes in use by one search.
+    PATH_STAT_CORRIDOR_LENGTH,      // Polys of the searched or cached corridors.
+    PATH_STAT_STRAIGHTEN_RAYCASTS,  // Raycasts issued by StraightenPath.
+    PATH_STAT_OUT_OF_BLOCK_NEAREST, // findNearestPoly calls by MakePathOutOfBlock.
+    PATH_STAT_LOCATE_NS,            // Region check and endpoint polys.
+    PATH_STAT_SEARCH_NS,            // Corridor search, door graph legs or path cache.
+    PATH_STAT_STRAIGHT_PATH_NS,     // findStraightPath of the corridor.
+    PATH_STAT_STRAIGHTEN_NS,        // StraightenPath.
+    PATH_STAT_OUT_OF_BLOCK_NS,      // MakePathOutOfBlock.
+    PATH_STAT_TOTAL_NS,             // The whole call.
+    PATH_STAT_NODE_POOL_RETRIES,    // Searches rerun on a large node pool.
+    PATH_STAT_COUNT
+};
+
+// Lanes of the UpdateCrowd state, each GetCrowdMaxAgents floats indexed by
+// agent. Slots without an agent are all zero.
+enum CrowdLane
+{
+    CROWD_LANE_POS_X,
+    CROWD_LANE_POS_Y,
+    CROWD_LANE_POS_Z,
+    CROWD_LANE_VEL_X,
+    CROWD_LANE_VEL_Y,
+    CROWD_LANE_VEL_Z,
+    CROWD_LANE_STATE,               // dtCrowdAgent state, 0 for an empty slot.
+    CROWD_LANE_COUNT
+};
+
 struct Vector3
 {
     float x;
@@ -140,6 +205,9 @@ struct NAVI_API VolumeDoor : public GameVolume
     std::vector<dtPolyRef> polyRefs;
     int links[2];
     bool open;
+    // waypoint used by the door graph, snapped onto one of polyRefs
+    Vector3 center;
+    dtPolyRef centerRef;
 };
 
 struct NAVI_API VolumeRegion : public GameVolume
@@ -172,24 +240,124 @@ typedef std::map<int, DoorList> ProvinceDoorMap;
 // province => neighbor province
 typedef std::map<int, ProvinceDoorMap> ProvinceLinkMap;
 
+struct DoorGraphLink
+{
+    int door;       // index in mDoors
+    float cost;     // path length between the two door centers
+};
+// door index => doors sharing a province with it
+typedef std::vector<std::vector<DoorGraphLink>> DoorGraph;
+
+struct PathCacheKey
+{
+    dtPolyRef startRef;
+    dtPolyRef endRef;
+    unsigned short include;
+    unsigned short exclude;
+    float polySize[3];
+
+    bool operator<(const PathCacheKey& other) const
+    {
+        if (startRef != other.startRef)
+            return startRef < other.startRef;
+        if (endRef != other.endRef)
+            return endRef < other.endRef;
+        if (include != other.include)
+            return include < other.include;
+        if (exclude != other.exclude)
+            return exclude < other.exclude;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (polySize[i] != other.polySize[i])
+                return polySize[i] < other.polySize[i];
+        }
+        return false;
+    }
+};
+
+struct PathCacheEntry
+{
+    PathCacheKey key;
+    unsigned int version;
+    dtStatus status;
+    // poly corridor found by A*, reused for any start/end inside the same polys
+    // although other points in them may have a shorter corridor
+    std::vector<dtPolyRef> polys;
+    // final path of the last query, returned as is when start and end repeat
+    Vector3 start;
+    Vector3 end;
+    std::vector<Vector3> path;
+};
+typedef std::list<PathCacheEntry> PathCacheList;
+typedef std::map<PathCacheKey, PathCacheList::iterator> PathCacheMap;
+
+// Cached flow field, valid while neither version nor the path filter moved.
+// Keyed on the requested goal, as the goal cell heads for the goal itself.
+struct FlowFieldEntry
+{
+    int id;
+    Vector3 goal;
+    float maxCost;
+    unsigned int worldVersion;
+    unsigned int meshVersion;
+    unsigned short include;
+    unsigned short exclude;
+    class FlowField* field;
+};
+typedef std::list<FlowFieldEntry> FlowFieldList;
+
+// Scratch of one call: the Detour query and the buffers FindPath and the
+// raycasts work in. A navi has one of its own, in thread-safe mode every call
+// takes one from a pool for as long as it holds the navi lock.
+struct NaviQueryContext
+{
+    class dtNavMeshQuery* query;
+    // mesh and node pool size the query was initialized for, the pool is
+    // SMALL_QUERY_INIT_NODE at most
+    const class dtNavMesh* queryMesh;
+    int queryNodes;
+    struct PolyGraphScratch* graphScratch;
+    class PolySearch* polySearch;
+    dtPolyRef* searchPolys;
+    int searchedPolyCount;
+    Vector3* path;
+    dtPolyRef* pathPolys;
+    bool* pathRemoves;
+    int pathCount;
+    // polys of the start and end of the last FindPath, returned as hints
+    dtPolyRef pathStartRef;
+    dtPolyRef pathEndRef;
+    long long pathStats[PATH_STAT_COUNT];
+};
+
 class NAVI_API Navi
 {
     class dtNavMesh* mNavMesh;
-    class dtNavMeshQuery* mNavQuery;
     class dtTileCache* mTileCache;
     
     struct LinearAllocator* mAlloc;
     struct FastLZCompressor* mComp;
     struct MeshProcess* mProc;
+    struct NaviMemCounter* mMemCounter;
+    
+    class PolyGraph* mPolyGraph;
+    class LandmarkTable* mLandmarks;
+    // mesh version the poly graph was built from
+    unsigned int mGraphVersion;
+    // relaxed path filter flags the landmark table was built with
+    unsigned short mLandmarkInclude;
+    unsigned short mLandmarkExclude;
+    bool mUseLandmarks;
+    int mMaxSearchNodes;
     
     class dtQueryFilter* mPathFilter;
     class dtQueryFilter* mPolyFilter;
-    dtPolyRef* mSearchPolys;
-    int mSearchedPolyCount;
-    Vector3* mPath;
-    dtPolyRef* mPathPolys;
-    bool* mPathRemoves;
-    int mPathCount;
+    // context of a navi that is not thread-safe, else the first one in the pool
+    NaviQueryContext* mQueryContext;
+    long long mLastPathStats[PATH_STAT_COUNT];
+    long long mPathStatTotals[PATH_STAT_COUNT];
+    std::mutex mStatLock;
+    bool mNodeStats;
     int mMaxPolys;
     int mMaxObstacles;
     
@@ -221,8 +389,49 @@ class NAVI_API Navi
 #endif
 
     ProvinceLinkMap mProvinceLinkMap;
+    DoorGraph mDoorGraph;
+    // mesh version the door graph and door center refs were built from
+    unsigned int mDoorGraphVersion;
+    // relaxed path filter flags the door legs were costed with
+    unsigned short mDoorGraphInclude;
+    unsigned short mDoorGraphExclude;
+    bool mUseDoorGraph;
+
+    // bumped by anything that can change a path result: doors, obstacles, filters
+    unsigned int mWorldVersion;
+    // bumped when tiles are rebuilt, poly refs of the old tiles become invalid
+    unsigned int mMeshVersion;
+    // obstacles added or removed since the last RefreshObstacle, which only
+    // rebuilds tiles and bumps mMeshVersion when set
+    bool mObstaclesPending;
+    int mPathCacheSize;
+    PathCacheList mPathCacheList;
+    PathCacheMap mPathCacheMap;
+    std::mutex mPathCacheLock;
+
+    // Thread-safe mode, fixed at construction. Queries hold mLock shared and
+    // mutations exclusive, through NaviReadLock and NaviWriteLock.
+    const bool mThreadSafe;
+    std::shared_timed_mutex mLock;
+    // every context allocated and the idle ones of them, freed with the navi
+    std::vector<NaviQueryContext*> mQueryContexts;
+    std::vector<NaviQueryContext*> mIdleQueryContexts;
+    std::mutex mQueryContextLock;
+    // idle queries of mMaxSearchNodes, shared by all contexts for the searches
+    // the small pool runs out on
+    std::vector<class dtNavMeshQuery*> mLargeQueries;
+    std::mutex mLargeQueryLock;
+    // agent simulation on the mesh, freed with the mesh
+    class dtCrowd* mCrowd;
+    int mCrowdMaxAgents;
+    // most recently requested first, published and dropped under the write
+    // lock, walked and reordered under the read lock and mFlowFieldLock
+    FlowFieldList mFlowFields;
+    std::mutex mFlowFieldLock;
+    int mNextFlowFieldId;
     
     void InitProvinceLink();
+    void FreeMembers();
     void ClearMesh();
     bool LoadDoorsInternal(const char* path);
     void ClearDoors();
@@ -238,13 +447,114 @@ class NAVI_API Navi
     bool PointInRegion(float x, float z, const VolumeRegion& region);
     bool IsProvincePassable(int startProvince, int endProvince);
     bool FindProvince(const Vector3& pos, std::vector<int>& provinces);
+    void GetProvinceDoors(int province, std::vector<int>& doorIndices);
+    float GetDoorLegCost(NaviQueryContext& ctx, const VolumeDoor& from, const VolumeDoor& to, const dtQueryFilter* filter);
+    bool NeedDoorGraphPath(const Vector3& start, const Vector3& end);
+    dtStatus FindDoorGraphPath(NaviQueryContext& ctx, dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos);
+    dtStatus AppendPathLeg(NaviQueryContext& ctx, dtPolyRef fromRef, dtPolyRef toRef, const float* fromPos, const float* toPos, bool allowPartial);
     bool WalkablePoly(const dtPolyRef polyRef);
-    void MakePathOutOfBlock(const Vector3& polySize);
-    void StraightenPath();
+    // endRef is a hint for the poly holding the last point
+    void MakePathOutOfBlock(NaviQueryContext& ctx, const Vector3& polySize, dtPolyRef endRef);
+    void StraightenPath(NaviQueryContext& ctx);
+    int FindPathInternal(NaviQueryContext& ctx, const Vector3& start, const Vector3& end, const Vector3& polySize,
+        dtPolyRef startHint, dtPolyRef endHint);
+    // startRef and endRef are hints and get the polys located
+    float GetPathDistanceInternal(NaviQueryContext& ctx, const Vector3& start, const Vector3& end, const Vector3& polySize,
+        dtPolyRef& startRef, dtPolyRef& endRef);
+    void RecordSearchStats(NaviQueryContext& ctx, const class dtNavMeshQuery* query);
+    // Whether hint passes filter and holds pos within polySize.y of its
+    // height, cheaper than findNearestPoly
+    bool IsPolyHintValid(NaviQueryContext& ctx, dtPolyRef hint, const Vector3& pos, const Vector3& polySize,
+        const dtQueryFilter* filter);
+    // hint while it is valid, else the nearest poly
+    dtPolyRef ResolvePolyHint(NaviQueryContext& ctx, dtPolyRef hint, const Vector3& pos, const Vector3& polySize,
+        const dtQueryFilter* filter);
+    inline dtPolyRef ResolvePolyHint(NaviQueryContext& ctx, dtPolyRef hint, const Vector3& pos)
+    {
+        return ResolvePolyHint(ctx, hint, pos, mDefaultPolySize, mPathFilter);
+    }
+    void ClearFlowFields();
+    // Same goal, bound, filter and versions
+    bool IsSameFlowField(const FlowFieldEntry& a, const FlowFieldEntry& b);
+    dtStatus SearchCorridor(NaviQueryContext& ctx, dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos,
+        const dtQueryFilter* filter, int* polyCount, bool recordStats);
+    class dtNavMeshQuery* AcquireLargeQuery();
+    void ReleaseLargeQuery(class dtNavMeshQuery* query);
+
+    // Null when out of memory.
+    NaviQueryContext* CreateQueryContext();
+    void DestroyQueryContext(NaviQueryContext* ctx);
+    // Context of the calling thread, the navi's own one unless thread-safe.
+    // Without a bound context it is an empty one PrepareQuery fails on.
+    NaviQueryContext& GetQueryContext();
+    // Initializes the query of ctx for the current mesh, false without a mesh
+    // or for the empty context.
+    bool PrepareQuery(NaviQueryContext& ctx);
+
+    inline void BumpWorldVersion()
+    {
+        ++mWorldVersion;
+    }
+    inline void BumpMeshVersion()
+    {
+        ++mMeshVersion;
+        ++mWorldVersion;
+    }
+    bool UseLandmarkPath();
+    // Path filter relaxed for the landmark table and the door graph, door
+    // state ignored.
+    void GetLandmarkFilter(dtQueryFilter& filter);
+    dtStatus FindPolyPath(NaviQueryContext& ctx, dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos,
+        bool recordStats);
+    // Copies a cached corridor into the search polys of ctx, or the whole
+    // path when start and end repeat too. Entries are copied in and out under
+    // mPathCacheLock, so queries of other threads can evict them meanwhile.
+    enum PathCacheHit
+    {
+        PATH_CACHE_MISS,
+        PATH_CACHE_CORRIDOR,
+        PATH_CACHE_PATH,
+    };
+    PathCacheHit FindPathCache(NaviQueryContext& ctx, const PathCacheKey& key, const Vector3& start, const Vector3& end, dtStatus* status);
+    void AddPathCache(const NaviQueryContext& ctx, const PathCacheKey& key, dtStatus status);
+    void SetPathCachePath(const NaviQueryContext& ctx, const PathCacheKey& key, const Vector3& start, const Vector3& end);
     
 public:
-    Navi(int maxPoly, int maxObstacles);
+    // A thread-safe navi lets threads call it concurrently. Queries run in
+    // parallel, each with a query context from a pool, and mutations wait for
+    // them. Every call, loading included, goes through NaviReadLock or
+    // NaviWriteLock, and reads GetPath before releasing it.
+    Navi(int maxPoly, int maxObstacles, bool threadSafe = false);
     ~Navi();
+
+    inline bool IsThreadSafe()
+    {
+        return mThreadSafe;
+    }
+    // Take a pooled query context for the calling thread until unbound, no-ops
+    // unless thread-safe. Called by NaviReadLock and NaviWriteLock.
+    void BindQueryContext(struct NaviQueryBinding& binding);
+    void UnbindQueryContext(struct NaviQueryBinding& binding);
+    inline void LockShared()
+    {
+        if (mThreadSafe)
+            mLock.lock_shared();
+    }
+    inline void UnlockShared()
+    {
+        if (mThreadSafe)
+            mLock.unlock_shared();
+    }
+    inline void Lock()
+    {
+        if (mThreadSafe)
+            mLock.lock();
+    }
+    inline void Unlock()
+    {
+        if (mThreadSafe)
+            mLock.unlock();
+    }
     
     inline void SetDefaultPolySize(float x, float y, float z)
     {
@@ -258,6 +568,36 @@ public:
         return mMaxPolys;
     }
 
+    inline int GetMaxSearchNodes()
+    {
+        return mMaxSearchNodes;
+    }
+
+    // Bytes currently held by Detour allocations made for this instance.
+    long long GetMemoryUsage();
+
+    inline unsigned int GetWorldVersion()
+    {
+        return mWorldVersion;
+    }
+
+    // Precompute graph distances from count landmark polys to every poly, so
+    // FindPath can use the tighter ALT heuristic. The table follows the path
+    // filter flags with doors passable. Tile rebuilds by obstacles and path
+    // filter changes invalidate it, FindPath then uses Detour until it is rebuilt.
+    bool BuildLandmarks(int count);
+    inline void SetLandmarkPath(bool enable)
+    {
+        mUseLandmarks = enable;
+    }
+    bool IsLandmarkValid();
+
+    // Keep up to size recent FindPath corridors, 0 disables the cache. A query
+    // reusing the corridor of another start and end in the same polys skips
+    // A*, its path can be longer than the one a fresh search finds.
+    void SetPathCacheSize(int size);
+    void ClearPathCache();
+
     int GetPathFilterInclude();
     int GetPathFilterExclude();
     void SetPathFilter(int include, int exclude);
@@ -265,6 +605,11 @@ public:
     int GetPolyFilterInclude();
     int GetPolyFilterExclude();
     void SetPolyFilter(int include, int exclude);
+
+    // Preset the tile cache allocator capacity for this map, grows on demand.
+    void SetTileAllocCapacity(int capacity);
+    // Fill stats with TILE_ALLOC_STAT_COUNT values, indexed by TileAllocStat.
+    void GetTileAllocStats(long long* stats);
     
     bool LoadMesh(const char* path, const int maxSearchNodes);
     bool LoadDoors(const char* path);
@@ -312,6 +657,21 @@ public:
 #endif
     }
     void InitDoorsPoly();
+    // Precompute door to door costs inside each province, call after LoadDoors.
+    // FindPath then plans routes that cross provinces over the door graph and
+    // only searches the mesh per leg. Legs are costed with the path filter,
+    // doors passable. The graph is ignored once the mesh changes (obstacles,
+    // reload) until InitDoorsPoly and BuildDoorGraph run again, and dropped
+    // when SetPathFilter changes the flags it was built with.
+    bool BuildDoorGraph();
+    inline void SetDoorGraphPath(bool enable)
+    {
+        mUseDoorGraph = enable;
+    }
+    inline bool IsDoorGraphBuilt()
+    {
+        return !mDoorGraph.empty() && mDoorGraphVersion == mMeshVersion;
+    }
     inline bool IsDoorExist(const int doorId)
     {
         VolumeDoor* door = FindDoor(doorId);
@@ -372,23 +732,101 @@ public:
         return mTileCache->getObstacleReqRemainCount();
     }
     bool IsPassable(const Vector3& start, const Vector3& end);
-    int FindPath(const Vector3& start, const Vector3& end, const Vector3& polySize);
+    // Random point on a poly passing the path filter, frand returns [0, 1).
+    bool FindRandomPoint(float (*frand)(), Vector3& pos);
+    // Up to count random points on polys passing include and exclude, within
+    // radius of center when radius > 0, inside region regionId when it is not
+    // 0, and at least minSpacing apart. Without a circle, a region draws from
+    // the polys under its bounds weighted by area. The same seed gives the
+    // same points on the same mesh. Returns the points found, fewer when the
+    // draws run out.
+    int FindRandomPoints(int count, const Vector3& center, float radius, int regionId, int include, int exclude,
+        unsigned int seed, float minSpacing, Vector3* points);
+    // startRef and endRef are hints for the polys of start and end, usually
+    // GetPathStartRef and GetPathEndRef of the previous call, 0 or a ref that
+    // does not hold the point within polySize.y of its height falls back to
+    // findNearestPoly.
+    int FindPath(const Vector3& start, const Vector3& end, const Vector3& polySize, dtPolyRef startRef, dtPolyRef endRef);
+    inline int FindPath(const Vector3& start, const Vector3& end, const Vector3& polySize)
+    {
+        return FindPath(start, end, polySize, 0, 0);
+    }
     inline int FindPath(const Vector3& start, const Vector3& end)
     {
-        return FindPath(start, end, mDefaultPolySize);
+        return FindPath(start, end, mDefaultPolySize, 0, 0);
+    }
+    // Path to the goal of goals reached at the lowest cost, searching once
+    // from start. Returns the goal index, -1 if none is reachable, the path
+    // is left in GetPath like FindPath.
+    int FindNearestGoalPath(const Vector3& start, int goalCount, const Vector3* goals);
+    // Polys reachable from start within maxCost, cheapest first, at most
+    // maxCount of them. Costs are measured between portal midpoints like
+    // findPolysAroundCircle, centers may be null. Returns the polys found.
+    int FindReachablePolys(const Vector3& start, float maxCost, int maxCount, dtPolyRef* refs, float* costs, Vector3* centers);
+    // Length of the straight path along the corridor FindPolyPath searches
+    // for FindPath, without the door graph, the path cache, straightening,
+    // moving it out of blocks or keeping it for GetPath.
+    // PATH_DISTANCE_UNREACHABLE when end is not reachable,
+    // PATH_DISTANCE_PARTIAL when the search limits stopped short of it.
+    // Path stats are left alone.
+    float GetPathDistance(const Vector3& start, const Vector3& end, const Vector3& polySize);
+    inline float GetPathDistance(const Vector3& start, const Vector3& end)
+    {
+        return GetPathDistance(start, end, mDefaultPolySize);
+    }
+    // GetPathDistance of count pairs packed as start and end. Consecutive
+    // pairs sharing a start poly or an end poly locate it once. Returns the
+    // pairs with a distance.
+    int GetPathDistances(int count, const Vector3* pairs, float* distances);
+    // Fill stats with PATH_STAT_COUNT * 2 values, see PathStat. The last call
+    // is the last FindPath on any thread.
+    void GetPathStats(long long* stats);
+    void ResetPathStats();
+    // Count the nodes closed by Detour searches, off by default as it walks
+    // the node pool after every search.
+    inline void SetNodeStats(bool enable)
+    {
+        mNodeStats = enable;
+    }
+    // Result of the last FindPath of the calling thread.
+    inline const int GetPathCount() { return GetQueryContext().pathCount; }
+    inline const Vector3* GetPath() { return GetQueryContext().path; }
+    // Polys start and end of the last FindPath were found in, 0 if not located.
+    inline dtPolyRef GetPathStartRef() { return GetQueryContext().pathStartRef; }
+    inline dtPolyRef GetPathEndRef() { return GetQueryContext().pathEndRef; }
+    // startRef is a hint for the poly of the first point like FindPath.
+    // pathCount is at most GetMaxPolys when path is GetPath.
+    void MakePathStraight(int& pathCount, float* path, const Vector3& polySize, dtPolyRef startRef);
+    inline void MakePathStraight(int& pathCount, float* path, const Vector3& polySize)
+    {
+        return MakePathStraight(pathCount, path, polySize, 0);
     }
-    inline const int GetPathCount() { return mPathCount; }
-    inline const Vector3* GetPath() { return mPath; }
-    void MakePathStraight(int& pathCount, float* path, const Vector3& polySize);
     inline void MakePathStraight(int& pathCount, float* path)
     {
-        return MakePathStraight(pathCount, path, mDefaultPolySize);
+        return MakePathStraight(pathCount, path, mDefaultPolySize, 0);
+    }
+    // startRef holds a hint for the poly of start like FindPath and gets the
+    // poly the ray started from, 0 if start is off the mesh.
+    float PathRaycast(const Vector3& start, const Vector3& end, const Vector3& polySize, dtPolyRef* startRef);
+    inline float PathRaycast(const Vector3& start, const Vector3& end, const Vector3& polySize)
+    {
+        return PathRaycast(start, end, polySize, nullptr);
     }
-    float PathRaycast(const Vector3& start, const Vector3& end, const Vector3& polySize);
     inline float PathRaycast(const Vector3& start, const Vector3& end)
     {
-        return PathRaycast(start, end, mDefaultPolySize);
+        return PathRaycast(start, end, mDefaultPolySize, nullptr);
     }
+    // Heights of the mesh below count points packed as x z, taking the highest
+    // surface between minY and maxY of the polys passing the path filter.
+    // refs gets the poly, 0 where no poly covers the point in the range, with
+    // the height left at minY. Returns the points snapped.
+    int SnapHeights(int count, const float* xz, float minY, float maxY, float* heights, dtPolyRef* refs);
+    // Raycasts count segments packed as start and end, refs are poly hints of
+    // the starts like MoveAlongSurface, checked against the start height as
+    // well. ts gets the hit t, FLT_MAX when the
+    // segment is clear and -1 when its start is off the mesh, normals the wall
+    // normal of hits. Returns the segments that hit a wall.
+    int BatchRaycast(int count, dtPolyRef* refs, const Vector3* segments, float* ts, Vector3* normals);
     inline bool CanPathForward(const Vector3& start, const Vector3& end, const Vector3& polySize)
     {
         float t = PathRaycast(start, end, polySize);
@@ -399,4 +837,94 @@ public:
         float t = PathRaycast(start, end, mDefaultPolySize);
         return t > 1.0f;
     }
+    // Moves count agents along the surface, from and to and result are count
+    // Vector3 each. refs holds the poly of each from as hint, 0, a stale ref or
+    // one whose floor is more than the default poly height away from the
+    // point falls back to the nearest poly, and gets the poly of the result. Agents
+    // not on the mesh keep their from with ref 0. Returns the moved agents.
+    int MoveAlongSurface(int count, dtPolyRef* refs, const Vector3* from, const Vector3* to, Vector3* result);
+    // Flow field towards goal over the polys within maxCost, 0 if goal is off
+    // the mesh. A field requested again for the same goal, bound and filter
+    // keeps its id, until a door, obstacle or filter change makes it stale
+    // and the next request builds it under a new id. Runs the three calls
+    // below in turn, so the caller holds the write lock.
+    int BuildFlowField(const Vector3& goal, float maxCost);
+    // Id of the fresh cached field for goal, 0 if there is none. Read lock.
+    int FindFlowField(const Vector3& goal, float maxCost);
+    // Builds the field for goal into entry without caching it, false if goal
+    // is off the mesh. Read lock, so fields for several goals build at once.
+    bool CreateFlowField(const Vector3& goal, float maxCost, FlowFieldEntry& entry);
+    // Caches the field of entry and returns its id, or frees it for the id of
+    // the same field published first by another thread. Frees it and returns
+    // 0 when the world or filter changed since it was built. Write lock.
+    int PublishFlowField(FlowFieldEntry& entry);
+    // Direction towards the goal and the remaining cost for count agents, dirs
+    // is zero and cost -1 outside the field. refs are poly hints like
+    // MoveAlongSurface. Returns the agents inside, -1 if the field is stale.
+    int SampleFlowField(int fieldId, int count, dtPolyRef* refs, const Vector3* pos, Vector3* dirs, float* costs);
+    // Crowd of the loaded mesh, replacing the previous one. LoadMesh drops
+    // the crowd, so it has to be initialized again after every load.
+    bool InitCrowd(int maxAgents, float maxAgentRadius);
+    void ClearCrowd();
+    inline int GetCrowdMaxAgents()
+    {
+        return mCrowd ? mCrowdMaxAgents : 0;
+    }
+    // Agent index, -1 if the crowd is full or pos is off the mesh.
+    int AddCrowdAgent(const Vector3& pos, float radius, float height, float maxSpeed, float maxAcceleration);
+    bool RemoveCrowdAgent(int idx);
+    // Moves the agent towards the poly nearest to target within the default poly size.
+    bool SetCrowdTarget(int idx, const Vector3& target);
+    // Steps the crowd by dt seconds and fills state with CROWD_LANE_COUNT *
+    // GetCrowdMaxAgents() floats, see CrowdLane. Returns the active agents.
+    int UpdateCrowd(float dt, float* state);
+};
+
+// Query context a NaviReadLock or NaviWriteLock of a thread-safe navi holds
+// for the calling thread, innermost first.
+struct NaviQueryBinding
+{
+    Navi* navi;
+    NaviQueryContext* context;
+    NaviQueryBinding* prev;
+};
+
+// Holds a navi for a query, shared with other queries in thread-safe mode.
+class NaviReadLock
+{
+    Navi* mNavi;
+    NaviQueryBinding mBinding;
+
+public:
+    inline NaviReadLock(Navi* navi)
+    :mNavi(navi)
+    {
+        mNavi->LockShared();
+        mNavi->BindQueryContext(mBinding);
+    }
+    inline ~NaviReadLock()
+    {
+        mNavi->UnbindQueryContext(mBinding);
+        mNavi->UnlockShared();
+    }
+};
+
+// Holds a navi for a mutation, exclusive in thread-safe mode.
+class NaviWriteLock
+{
+    Navi* mNavi;
+    NaviQueryBinding mBinding;
+
+public:
+    inline NaviWriteLock(Navi* navi)
+    :mNavi(navi)
+    {
+        mNavi->Lock();
+        mNavi->BindQueryContext(mBinding);
+    }
+    inline ~NaviWriteLock()
+    {
+        mNavi->UnbindQueryContext(mBinding);
+        mNavi->Unlock();
+    }
 };
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <mutex>
+#include "DetourAlloc.h"
+#include "Util.h"
+#include "NaviAlloc.h"
+
+// Every block starts with a header, blocks are carved from slabs by size class.
+// Requests larger than the last size class go straight to malloc.
+struct BlockHeader
+{
+    NaviMemCounter* counter;
+    unsigned int size;
+    unsigned int sizeClass;
+};
+
+COMPILE_TEST(BLOCK_HEADER_SIZE, sizeof(BlockHeader) == 16);
+
+const int SIZE_CLASS_COUNT = 11;                 // 32 bytes .. 32 KB
+const unsigned int MIN_BLOCK_SHIFT = 5;
+const unsigned int LARGE_BLOCK = 0xffffffff;
+const size_t SLAB_SIZE = 256 * 1024;
+const int CACHE_BATCH = 32;                      // blocks moved between a thread cache and the central pool
+const int CACHE_MAX = CACHE_BATCH * 2;
+
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+static inline size_t GetClassSize(int sizeClass)
+{
+    return (size_t)1 << (MIN_BLOCK_SHIFT + sizeClass);
+}
+
+static inline int GetSizeClass(size_t blockSize)
+{
+    int sizeClass = 0;
+    while (sizeClass < SIZE_CLASS_COUNT && GetClassSize(sizeClass) < blockSize)
+        ++sizeClass;
+    return sizeClass;
+}
+
+/////////////////////////////////////////////////////////////////
+// CentralPool
+// Shared free list of one size class. Slabs are never returned to the system,
+// the pool only grows to the peak of its size class.
+struct CentralPool
+{
+    std::mutex lock;
+    FreeBlock* head;
+    int count;
+
+    CentralPool()
+    :head(nullptr)
+    ,count(0)
+    {}
+
+    // Pop up to maxCount blocks into a null terminated list.
+    int Fetch(int sizeClass, FreeBlock** outList, int maxCount)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!head)
+            Refill(sizeClass);
+        int fetched = 0;
+        FreeBlock* list = nullptr;
+        while (head && fetched < maxCount)
+        {
+            FreeBlock* block = head;
+            head = block->next;
+            block->next = list;
+            list = block;
+            ++fetched;
+        }
+        count -= fetched;
+        *outList = list;
+        return fetched;
+    }
+
+    void Release(FreeBlock* first, FreeBlock* last, int releaseCount)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        last->next = head;
+        head = first;
+        count += releaseCount;
+    }
+
+    void Refill(int sizeClass)
+    {
+        const size_t blockSize = GetClassSize(sizeClass);
+        const size_t slabSize = blockSize > SLAB_SIZE ? blockSize : SLAB_SIZE;
+        unsigned char* slab = (unsigned char*)malloc(slabSize);
+        if (!slab)
+            return;
+        const int blockCount = (int)(slabSize / blockSize);
+        for (int i = blockCount - 1; i >= 0; --i)
+        {
+            FreeBlock* block = (FreeBlock*)(slab + i * blockSize);
+            block->next = head;
+            head = block;
+        }
+        count += blockCount;
+    }
+};
+
+static CentralPool* GetCentralPools()
+{
+    // Leaked on purpose, thread caches may flush into it during process exit.
+    static CentralPool* pools = new CentralPool[SIZE_CLASS_COUNT];
+    return pools;
+}
+
+/////////////////////////////////////////////////////////////////
+// ThreadCache
+// Set once the cache of the thread is destroyed at thread exit. A plain bool
+// has no destructor, so it stays readable for thread_local destructors that
+// run later and still free Detour memory, those go to the central pool.
+thread_local bool tlCacheDestroyed = false;
+
+// Per-thread free lists, so the common alloc/free pair takes no lock.
+struct ThreadCache
+{
+    FreeBlock* heads[SIZE_CLASS_COUNT];
+    int counts[SIZE_CLASS_COUNT];
+
+    ThreadCache()
+    {
+        for (int i = 0; i < SIZE_CLASS_COUNT; ++i)
+        {
+            heads[i] = nullptr;
+            counts[i] = 0;
+        }
+    }
+
+    ~ThreadCache()
+    {
+        for (int i = 0; i < SIZE_CLASS_COUNT; ++i)
+            Flush(i, counts[i]);
+        tlCacheDestroyed = true;
+    }
+
+    void* Pop(int sizeClass)
+    {
+        if (!heads[sizeClass])
+        {
+            counts[sizeClass] = GetCentralPools()[sizeClass].Fetch(sizeClass, &heads[sizeClass], CACHE_BATCH);
+            if (!heads[sizeClass])
+                return nullptr;
+        }
+        FreeBlock* block = heads[sizeClass];
+        heads[sizeClass] = block->next;
+        --counts[sizeClass];
+        return block;
+    }
+
+    void Push(int sizeClass, void* ptr)
+    {
+        FreeBlock* block = (FreeBlock*)ptr;
+        block->next = heads[sizeClass];
+        heads[sizeClass] = block;
+        ++counts[sizeClass];
+        if (counts[sizeClass] > CACHE_MAX)
+            Flush(sizeClass, CACHE_BATCH);
+    }
+
+    void Flush(int sizeClass, int flushCount)
+    {
+        if (flushCount <= 0 || !heads[sizeClass])
+            return;
+        FreeBlock* first = heads[sizeClass];
+        FreeBlock* last = first;
+        int released = 1;
+        while (released < flushCount && last->next)
+        {
+            last = last->next;
+            ++released;
+        }
+        heads[sizeClass] = last->next;
+        counts[sizeClass] -= released;
+        GetCentralPools()[sizeClass].Release(first, last, released);
+    }
+};
+
+thread_local ThreadCache tlCache;
+thread_local NaviMemCounter* tlCounter = nullptr;
+static std::atomic<long long> sTotalBytes(0);
+
+static void* NaviAlloc(size_t size, dtAllocHint /*hint*/)
+{
+    const size_t blockSize = size + sizeof(BlockHeader);
+    const int sizeClass = GetSizeClass(blockSize);
+    BlockHeader* header = nullptr;
+    if (sizeClass < SIZE_CLASS_COUNT)
+    {
+        if (tlCacheDestroyed)
+        {
+            FreeBlock* block = nullptr;
+            GetCentralPools()[sizeClass].Fetch(sizeClass, &block, 1);
+            header = (BlockHeader*)block;
+        }
+        else
+        {
+            header = (BlockHeader*)tlCache.Pop(sizeClass);
+        }
+        if (!header)
+            return nullptr;
+        header->sizeClass = sizeClass;
+    }
+    else
+    {
+        header = (BlockHeader*)malloc(blockSize);
+        if (!header)
+            return nullptr;
+        header->sizeClass = LARGE_BLOCK;
+    }
+    header->size = (unsigned int)size;
+    header->counter = tlCounter;
+    if (header->counter)
+        header->counter->bytes.fetch_add(size, std::memory_order_relaxed);
+    sTotalBytes.fetch_add(size, std::memory_order_relaxed);
+    return header + 1;
+}
+
+static void NaviFree(void* ptr)
+{
+    if (!ptr)
+        return;
+    BlockHeader* header = (BlockHeader*)ptr - 1;
+    if (header->counter)
+        header->counter->bytes.fetch_sub(header->size, std::memory_order_relaxed);
+    sTotalBytes.fetch_sub(header->size, std::memory_order_relaxed);
+    if (header->sizeClass == LARGE_BLOCK)
+    {
+        free(header);
+    }
+    else if (tlCacheDestroyed)
+    {
+        FreeBlock* block = (FreeBlock*)header;
+        GetCentralPools()[header->sizeClass].Release(block, block, 1);
+    }
+    else
+    {
+        tlCache.Push(header->sizeClass, header);
+    }
+}
+
+void NaviAllocInstall()
+{
+    dtAllocSetCustom(NaviAlloc, NaviFree);
+}
+
+long long NaviAllocGetTotalBytes()
+{
+    return sTotalBytes.load(std::memory_order_relaxed);
+}
+
+NaviAllocScope::NaviAllocScope(NaviMemCounter* counter)
+:mPrev(tlCounter)
+{
+    tlCounter = counter;
+}
+
+NaviAllocScope::~NaviAllocScope()
+{
+    tlCounter = mPrev;
+}
+
+#ifdef NAVI_POOL_ALLOC
+static struct NaviAllocInstaller
+{
+    NaviAllocInstaller()
+    {
+        NaviAllocInstall();
+    }
+} sInstaller;
+#endif
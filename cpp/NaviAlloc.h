@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+
+// Byte counter charged by every Detour allocation made inside a NaviAllocScope.
+// The counter is remembered in the block header, so the block is credited back
+// to the same counter whichever thread frees it.
+struct NaviMemCounter
+{
+    std::atomic<long long> bytes;
+
+    NaviMemCounter()
+    :bytes(0)
+    {}
+};
+
+// Routes dtAlloc/dtFree through the size-class pools. Called automatically when
+// the library is loaded if NAVI_POOL_ALLOC is defined, and must run before the
+// first Detour allocation.
+void NaviAllocInstall();
+
+// Bytes currently allocated through the pools by all Navi instances.
+long long NaviAllocGetTotalBytes();
+
+class NaviAllocScope
+{
+    NaviMemCounter* mPrev;
+
+public:
+    NaviAllocScope(NaviMemCounter* counter);
+    ~NaviAllocScope();
+};
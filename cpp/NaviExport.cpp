@@ -1,12 +1,16 @@
 #include <jni.h>
 #include <new>
 #include <exception>
+#include <vector>
 #include "stdlib.h"
 #include "cstring"
 #include "DetourCommon.h"
 #include "DetourNavMesh.h"
 #include "DetourTileCache.h"
 #include "Util.h"
+#include "NaviAlloc.h"
+#include "NaviLatency.h"
+#include "NaviTrace.h"
 #include "Navi.h"
 
 void JniClearPendingException(JNIEnv* env);
@@ -14,127 +18,93 @@ void JniDeleteLocalRef(JNIEnv* env, jobject ref);
 
 COMPILE_TEST(JLONG_SIZE, sizeof(jlong) == 8);
 
-char* Jstring2String(JNIEnv* env, jstring jstr)
-{
-	if (!env || !jstr)
-		return nullptr;
-
-	char* str = nullptr;
-	jbyte* bytes = nullptr;
-	jbyteArray byteArray = nullptr;
-
-	jclass jstringClass = env->FindClass("java/lang/String");
-	if (!jstringClass || env->ExceptionCheck())
-	{
-		JniDeleteLocalRef(env, jstringClass);
-		JniClearPendingException(env);
-		return nullptr;
-	}
+// Classes and methods resolved once in JNI_OnLoad.
+static jclass sNaviClass = nullptr;
+static jclass sStringClass = nullptr;
+static jmethodID sStringInit = nullptr;
+static jstring sUtf8Name = nullptr;
 
-	jstring stringCode = env->NewStringUTF("utf-8");
-	if (!stringCode || env->ExceptionCheck())
-	{
-		JniDeleteLocalRef(env, stringCode);
-		JniDeleteLocalRef(env, jstringClass);
-		JniClearPendingException(env);
-		return nullptr;
-	}
+// Grow to the longest string converted on the thread and are never shrunk.
+thread_local std::vector<jchar> tlCharBuffer;
+thread_local std::vector<char> tlStringBuffer;
 
-	jmethodID methodID = env->GetMethodID(jstringClass, "getBytes", "(Ljava/lang/String;)[B");
-	if (!methodID || env->ExceptionCheck())
-	{
-		JniDeleteLocalRef(env, stringCode);
-		JniDeleteLocalRef(env, jstringClass);
-		JniClearPendingException(env);
+// Standard UTF-8 copy of jstr, encoded here from the UTF-16 chars as JNI only
+// offers Modified UTF-8, which differs for supplementary characters. Unpaired
+// surrogates become '?' like String.getBytes("utf-8"). Points into a buffer of
+// the calling thread that the next call on the thread overwrites.
+const char* Jstring2String(JNIEnv* env, jstring jstr)
+{
+	if (!env || !jstr)
 		return nullptr;
-	}
 
-	byteArray = (jbyteArray)env->CallObjectMethod(jstr, methodID, stringCode);
-	if (!byteArray || env->ExceptionCheck())
+	const jsize length = env->GetStringLength(jstr);
+	if (env->ExceptionCheck())
 	{
-		JniDeleteLocalRef(env, byteArray);
-		JniDeleteLocalRef(env, stringCode);
-		JniDeleteLocalRef(env, jstringClass);
 		JniClearPendingException(env);
 		return nullptr;
 	}
-
-	const jsize byteLength = env->GetArrayLength(byteArray);
+	if ((jsize)tlCharBuffer.size() < length + 1)
+		tlCharBuffer.resize(length + 1);
+	env->GetStringRegion(jstr, 0, length, &tlCharBuffer[0]);
 	if (env->ExceptionCheck())
 	{
-		JniDeleteLocalRef(env, byteArray);
-		JniDeleteLocalRef(env, stringCode);
-		JniDeleteLocalRef(env, jstringClass);
 		JniClearPendingException(env);
 		return nullptr;
 	}
 
-	if (byteLength > 0)
+	// at most 3 bytes per char, a surrogate pair takes 4 bytes for 2 chars
+	if ((jsize)tlStringBuffer.size() < length * 3 + 1)
+		tlStringBuffer.resize(length * 3 + 1);
+	const jchar* chars = &tlCharBuffer[0];
+	char* out = &tlStringBuffer[0];
+	for (jsize i = 0; i < length; ++i)
 	{
-		bytes = env->GetByteArrayElements(byteArray, JNI_FALSE);
-		if (!bytes || env->ExceptionCheck())
+		unsigned int c = chars[i];
+		if (c >= 0xd800 && c <= 0xdfff)
 		{
-			JniDeleteLocalRef(env, byteArray);
-			JniDeleteLocalRef(env, stringCode);
-			JniDeleteLocalRef(env, jstringClass);
-			JniClearPendingException(env);
-			return nullptr;
+			if (c <= 0xdbff && i + 1 < length && chars[i + 1] >= 0xdc00 && chars[i + 1] <= 0xdfff)
+				c = 0x10000 + ((c - 0xd800) << 10) + (chars[++i] - 0xdc00);
+			else
+				c = '?';
+		}
+		if (c < 0x80)
+		{
+			*out++ = (char)c;
+		}
+		else if (c < 0x800)
+		{
+			*out++ = (char)(0xc0 | (c >> 6));
+			*out++ = (char)(0x80 | (c & 0x3f));
+		}
+		else if (c < 0x10000)
+		{
+			*out++ = (char)(0xe0 | (c >> 12));
+			*out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+			*out++ = (char)(0x80 | (c & 0x3f));
+		}
+		else
+		{
+			*out++ = (char)(0xf0 | (c >> 18));
+			*out++ = (char)(0x80 | ((c >> 12) & 0x3f));
+			*out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+			*out++ = (char)(0x80 | (c & 0x3f));
 		}
 	}
-
-	str = (char*)malloc(byteLength + 1);
-	if (!str)
-	{
-		if (bytes)
-			env->ReleaseByteArrayElements(byteArray, bytes, JNI_ABORT);
-		JniDeleteLocalRef(env, byteArray);
-		JniDeleteLocalRef(env, stringCode);
-		JniDeleteLocalRef(env, jstringClass);
-		JniClearPendingException(env);
-		return nullptr;
-	}
-
-	if (byteLength > 0)
-		memcpy(str, bytes, byteLength);
-	str[byteLength] = 0;
-
-	if (bytes)
-		env->ReleaseByteArrayElements(byteArray, bytes, JNI_ABORT);
-	JniDeleteLocalRef(env, byteArray);
-	JniDeleteLocalRef(env, stringCode);
-	JniDeleteLocalRef(env, jstringClass);
-	JniClearPendingException(env);
-	return str;
+	*out = 0;
+	return &tlStringBuffer[0];
 }
 
 jstring String2Jstring(JNIEnv* env, const char* str)
 {
-	if (!env || !str)
+	if (!env || !str || !sStringClass)
 		return nullptr;
 
 	const int strSize = (int)strlen(str);
 
-	jclass jstringClass = env->FindClass("java/lang/String");
-	if (!jstringClass || env->ExceptionCheck())
-	{
-		JniDeleteLocalRef(env, jstringClass);
-		JniClearPendingException(env);
-		return nullptr;
-	}
-
-	jmethodID methodID = env->GetMethodID(jstringClass, "<init>", "([BLjava/lang/String;)V");
-	if (!methodID || env->ExceptionCheck())
-	{
-		JniDeleteLocalRef(env, jstringClass);
-		JniClearPendingException(env);
-		return nullptr;
-	}
-
 	jbyteArray byteArray = env->NewByteArray(strSize);
 	if (!byteArray || env->ExceptionCheck())
 	{
 		JniDeleteLocalRef(env, byteArray);
-		JniDeleteLocalRef(env, jstringClass);
 		JniClearPendingException(env);
 		return nullptr;
 	}
@@ -143,35 +113,20 @@ jstring String2Jstring(JNIEnv* env, const char* str)
 	if (env->ExceptionCheck())
 	{
 		JniDeleteLocalRef(env, byteArray);
-		JniDeleteLocalRef(env, jstringClass);
 		JniClearPendingException(env);
 		return nullptr;
 	}
 
-	jstring stringCode = env->NewStringUTF("utf-8");
-	if (!stringCode || env->ExceptionCheck())
-	{
-		JniDeleteLocalRef(env, stringCode);
-		JniDeleteLocalRef(env, byteArray);
-		JniDeleteLocalRef(env, jstringClass);
-		JniClearPendingException(env);
-		return nullptr;
-	}
-
-	jstring result = (jstring)env->NewObject(jstringClass, methodID, byteArray, stringCode);
+	jstring result = (jstring)env->NewObject(sStringClass, sStringInit, byteArray, sUtf8Name);
 	if (env->ExceptionCheck())
 	{
 		JniDeleteLocalRef(env, result);
-		JniDeleteLocalRef(env, stringCode);
 		JniDeleteLocalRef(env, byteArray);
-		JniDeleteLocalRef(env, jstringClass);
 		JniClearPendingException(env);
 		return nullptr;
 	}
 
-	JniDeleteLocalRef(env, stringCode);
 	JniDeleteLocalRef(env, byteArray);
-	JniDeleteLocalRef(env, jstringClass);
 	JniClearPendingException(env);
 	return result;
 }
@@ -200,17 +155,26 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_getMaxPosSizeNative
     (JNIEnv *env, jobject obj)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_MAX_POS_SIZE);
     //printf("Java_org_navi_Navi_getMaxPosSizeNative:env=%p obj=%p\n", env, obj);
     return MAX_SEARCH_POLYS;
 }
     
 JNIEXPORT jlong JNICALL Java_org_navi_Navi_createNative
-    (JNIEnv *env, jobject obj, jint maxPoly, jint maxObstacle)
+    (JNIEnv *env, jobject obj, jint maxPoly, jint maxObstacle, jboolean threadSafe)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_CREATE);
     try
     {
-        Navi* navi = new Navi(maxPoly <= 0 ? 1024 : maxPoly, maxObstacle);
+        const NaviTraceStamp traceStamp = NaviTraceBegin();
+        Navi* navi = new Navi(maxPoly <= 0 ? 1024 : maxPoly, maxObstacle, threadSafe);
+        if (traceStamp)
+        {
+            NaviTraceRecord trace(TRACE_CREATE, navi, traceStamp);
+            trace.Write((int)maxPoly);
+            trace.Write((int)maxObstacle);
+        }
         return Ptr2Long(navi);
     }
     catch (const std::bad_alloc&)
@@ -234,39 +198,60 @@ JNIEXPORT void JNICALL Java_org_navi_Navi_destroyNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_DESTROY);
     //printf("Java_org_navi_Navi_destroyNative:env=%p obj=%p\n", env, obj);
     if (!ptr)
         return;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     delete navi;
+    if (traceStamp)
+        NaviTraceRecord trace(TRACE_DESTROY, navi, traceStamp);
 }
-    
+
 JNIEXPORT void JNICALL Java_org_navi_Navi_setDefaultPolySizeNative
     (JNIEnv *env, jobject obj, jlong ptr, jfloat x, jfloat y, jfloat z)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SET_DEFAULT_POLY_SIZE);
     //printf("Java_org_navi_Navi_destroyNative:env=%p obj=%p\n", env, obj);
     if (!ptr)
         return;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     navi->SetDefaultPolySize(x, y, z);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_SET_DEFAULT_POLY_SIZE, navi, traceStamp);
+        trace.Write(Vector3(x, y, z));
+    }
 }
 
 JNIEXPORT jboolean JNICALL Java_org_navi_Navi_loadMeshNative
   (JNIEnv *env, jobject obj, jlong ptr, jstring filePath, jint maxSearchNodes)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_LOAD_MESH);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
     if (!filePath)
         return false;
-	char* path = Jstring2String(env, filePath);
+	const char* path = Jstring2String(env, filePath);
     if (!path)
         return false;
     printf("load mesh native:%s\n", path);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     jboolean success = navi->LoadMesh(path, maxSearchNodes);
-	free(path);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_LOAD_MESH, navi, traceStamp);
+        trace.WriteString(path);
+        trace.Write((int)maxSearchNodes);
+        trace.Write((bool)success);
+    }
 	return success;
 }
     
@@ -274,17 +259,25 @@ JNIEXPORT jboolean JNICALL Java_org_navi_Navi_loadDoorsNative
     (JNIEnv *env, jobject obj, jlong ptr, jstring filePath)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_LOAD_DOORS);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
     if (!filePath)
         return false;
-    char* path = Jstring2String(env, filePath);
+    const char* path = Jstring2String(env, filePath);
     if (!path)
         return false;
     printf("load doors native:%s\n", path);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     jboolean success = navi->LoadDoors(path);
-    free(path);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_LOAD_DOORS, navi, traceStamp);
+        trace.WriteString(path);
+        trace.Write((bool)success);
+    }
     return success;
 }
     
@@ -292,17 +285,25 @@ JNIEXPORT jboolean JNICALL Java_org_navi_Navi_loadRegionsNative
     (JNIEnv *env, jobject obj, jlong ptr, jstring filePath)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_LOAD_REGIONS);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
     if (!filePath)
         return false;
-    char* path = Jstring2String(env, filePath);
+    const char* path = Jstring2String(env, filePath);
     if (!path)
         return false;
     printf("load regions native:%s\n", path);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     jboolean success = navi->LoadRegions(path);
-    free(path);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_LOAD_REGIONS, navi, traceStamp);
+        trace.WriteString(path);
+        trace.Write((bool)success);
+    }
     return success;
 }
     
@@ -310,30 +311,47 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_getRegionIdNative
     (JNIEnv *env, jobject obj, jlong ptr, jfloat x, jfloat z)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_REGION_ID);
     if (!ptr)
         return 0;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 pos(x, 0, z);
-    return navi->GetRegionId(pos);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int regionId = navi->GetRegionId(pos);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_GET_REGION_ID, navi, traceStamp);
+        trace.Write((float)x);
+        trace.Write((float)z);
+    }
+    return regionId;
 }
     
 JNIEXPORT void JNICALL Java_org_navi_Navi_initDoorsPolyNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_INIT_DOORS_POLY);
     if (!ptr)
         return;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     navi->InitDoorsPoly();
+    if (traceStamp)
+        NaviTraceRecord trace(TRACE_INIT_DOORS_POLY, navi, traceStamp);
 }
 
 JNIEXPORT jboolean JNICALL Java_org_navi_Navi_isDoorExistNative
     (JNIEnv *env, jobject obj, jlong ptr, jint doorId)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_IS_DOOR_EXIST);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     return navi->IsDoorExist(doorId);
 }
     
@@ -341,9 +359,11 @@ JNIEXPORT jboolean JNICALL Java_org_navi_Navi_isDoorOpenNative
     (JNIEnv *env, jobject obj, jlong ptr, jint doorId)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_IS_DOOR_OPEN);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     return navi->IsDoorOpen(doorId);
 }
 
@@ -351,40 +371,138 @@ JNIEXPORT void JNICALL Java_org_navi_Navi_openDoorNative
     (JNIEnv *env, jobject obj, jlong ptr, jint doorId, jboolean open)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_OPEN_DOOR);
     if (!ptr)
         return;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     navi->OpenDoor(doorId, open);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_OPEN_DOOR, navi, traceStamp);
+        trace.Write((int)doorId);
+        trace.Write((bool)open);
+    }
 }
     
 JNIEXPORT void JNICALL Java_org_navi_Navi_openAllDoorsNative
     (JNIEnv *env, jobject obj, jlong ptr, jboolean open)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_OPEN_ALL_DOORS);
     if (!ptr)
         return;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     navi->OpenAllDoors(open);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_OPEN_ALL_DOORS, navi, traceStamp);
+        trace.Write((bool)open);
+    }
 }
     
 JNIEXPORT void JNICALL Java_org_navi_Navi_closeAllDoorsPolyNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_CLOSE_ALL_DOORS_POLY);
     if (!ptr)
         return;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     navi->CloseAllDoorsPoly();
+    if (traceStamp)
+        NaviTraceRecord trace(TRACE_CLOSE_ALL_DOORS_POLY, navi, traceStamp);
 }
     
 JNIEXPORT void JNICALL Java_org_navi_Navi_recoverAllDoorsPolyNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_RECOVER_ALL_DOORS_POLY);
     if (!ptr)
         return;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     navi->RecoverAllDoorsPoly();
+    if (traceStamp)
+        NaviTraceRecord trace(TRACE_RECOVER_ALL_DOORS_POLY, navi, traceStamp);
+}
+    
+JNIEXPORT jboolean JNICALL Java_org_navi_Navi_buildDoorGraphNative
+    (JNIEnv *env, jobject obj, jlong ptr)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_BUILD_DOOR_GRAPH);
+    if (!ptr)
+        return false;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const bool success = navi->BuildDoorGraph();
+    if (traceStamp)
+        NaviTraceRecord trace(TRACE_BUILD_DOOR_GRAPH, navi, traceStamp);
+    return success;
+}
+
+JNIEXPORT void JNICALL Java_org_navi_Navi_setDoorGraphPathNative
+    (JNIEnv *env, jobject obj, jlong ptr, jboolean enable)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SET_DOOR_GRAPH_PATH);
+    if (!ptr)
+        return;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    navi->SetDoorGraphPath(enable);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_SET_DOOR_GRAPH_PATH, navi, traceStamp);
+        trace.Write((bool)enable);
+    }
+}
+    
+JNIEXPORT jboolean JNICALL Java_org_navi_Navi_buildLandmarksNative
+    (JNIEnv *env, jobject obj, jlong ptr, jint count)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_BUILD_LANDMARKS);
+    if (!ptr)
+        return false;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const bool success = navi->BuildLandmarks(count);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_BUILD_LANDMARKS, navi, traceStamp);
+        trace.Write((int)count);
+    }
+    return success;
+}
+
+JNIEXPORT void JNICALL Java_org_navi_Navi_setLandmarkPathNative
+    (JNIEnv *env, jobject obj, jlong ptr, jboolean enable)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SET_LANDMARK_PATH);
+    if (!ptr)
+        return;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    navi->SetLandmarkPath(enable);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_SET_LANDMARK_PATH, navi, traceStamp);
+        trace.Write((bool)enable);
+    }
 }
     
 JNIEXPORT jint JNICALL Java_org_navi_Navi_addObstacleNative
@@ -393,14 +511,25 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_addObstacleNative
      jfloat radius, jfloat height)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_ADD_OBSTACLE);
     if (!ptr)
         return 0;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
     Vector3 pos(posX, posY, posZ);
     dtObstacleRef ref = 0;
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     int result = navi->AddObstacle(pos, radius, height, &ref);
     if (!dtStatusSucceed(result))
-        return 0;
+        ref = 0;
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_ADD_OBSTACLE, navi, traceStamp);
+        trace.Write(pos);
+        trace.Write((float)radius);
+        trace.Write((float)height);
+        trace.Write((int)ref);
+    }
     return ref;
 }
     
@@ -408,10 +537,18 @@ JNIEXPORT jboolean JNICALL Java_org_navi_Navi_removeObstacleNative
     (JNIEnv *env, jobject obj, jlong ptr, jint obstacleRef)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_REMOVE_OBSTACLE);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     int result = navi->RemoveObstacle(obstacleRef);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_REMOVE_OBSTACLE, navi, traceStamp);
+        trace.Write((int)obstacleRef);
+    }
     if (!dtStatusSucceed(result))
         return false;
     return true;
@@ -421,10 +558,15 @@ JNIEXPORT jboolean JNICALL Java_org_navi_Navi_refreshObstacleNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_REFRESH_OBSTACLE);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     int result = navi->RefreshObstacle();
+    if (traceStamp)
+        NaviTraceRecord trace(TRACE_REFRESH_OBSTACLE, navi, traceStamp);
     if (!dtStatusSucceed(result))
         return false;
     return true;
@@ -434,9 +576,11 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_getMaxObstacleReqCountNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_MAX_OBSTACLE_REQ_COUNT);
     if (!ptr)
         return 0;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     return navi->GetMaxObstacleReqCount();
 }
 
@@ -444,9 +588,11 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_getAddedObstacleReqCountNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_ADDED_OBSTACLE_REQ_COUNT);
     if (!ptr)
         return 0;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     return navi->GetAddedObstacleReqCount();
 }
 
@@ -454,25 +600,201 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_getObstacleReqRemainCountNative
     (JNIEnv *env, jobject obj, jlong ptr)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_OBSTACLE_REQ_REMAIN_COUNT);
     if (!ptr)
         return 0;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     return navi->GetObstacleReqRemainCount();
 }
 
+JNIEXPORT void JNICALL Java_org_navi_Navi_setTileAllocCapacityNative
+    (JNIEnv *env, jobject obj, jlong ptr, jint capacity)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SET_TILE_ALLOC_CAPACITY);
+    if (!ptr)
+        return;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    navi->SetTileAllocCapacity(capacity);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_SET_TILE_ALLOC_CAPACITY, navi, traceStamp);
+        trace.Write((int)capacity);
+    }
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_getTileAllocStatsNative
+    (JNIEnv *env, jobject obj, jlong ptr, jlongArray statArray, jint arraySize)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_TILE_ALLOC_STATS);
+    if (!ptr)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    long long stats[TILE_ALLOC_STAT_COUNT];
+    navi->GetTileAllocStats(stats);
+    const int count = arraySize < TILE_ALLOC_STAT_COUNT ? arraySize : TILE_ALLOC_STAT_COUNT;
+    env->SetLongArrayRegion(statArray, 0, count, (const jlong*)stats);
+    return count;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_getPathStatsNative
+    (JNIEnv *env, jobject obj, jlong ptr, jlongArray statArray, jint arraySize)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_PATH_STATS);
+    if (!ptr)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    long long stats[PATH_STAT_COUNT * 2];
+    navi->GetPathStats(stats);
+    const int count = arraySize < PATH_STAT_COUNT * 2 ? arraySize : PATH_STAT_COUNT * 2;
+    env->SetLongArrayRegion(statArray, 0, count, (const jlong*)stats);
+    return count;
+}
+
+JNIEXPORT void JNICALL Java_org_navi_Navi_resetPathStatsNative
+    (JNIEnv *env, jobject obj, jlong ptr)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_RESET_PATH_STATS);
+    if (!ptr)
+        return;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    navi->ResetPathStats();
+}
+
+JNIEXPORT void JNICALL Java_org_navi_Navi_setNodeStatsNative
+    (JNIEnv *env, jobject obj, jlong ptr, jboolean enable)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SET_NODE_STATS);
+    if (!ptr)
+        return;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    navi->SetNodeStats(enable);
+}
+
+JNIEXPORT jlong JNICALL Java_org_navi_Navi_getMemoryUsageNative
+    (JNIEnv *env, jobject obj, jlong ptr)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_MEMORY_USAGE);
+    if (!ptr)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    return navi->GetMemoryUsage();
+}
+
+JNIEXPORT jlong JNICALL Java_org_navi_Navi_getTotalMemoryUsageNative
+    (JNIEnv *env, jclass cls)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_TOTAL_MEMORY_USAGE);
+    return NaviAllocGetTotalBytes();
+}
+
+JNIEXPORT jboolean JNICALL Java_org_navi_Navi_startTraceNative
+    (JNIEnv *env, jclass cls, jstring filePath)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_START_TRACE);
+    if (!filePath)
+        return false;
+    const char* path = Jstring2String(env, filePath);
+    if (!path)
+        return false;
+    const bool success = NaviTraceStart(path);
+    return success;
+}
+
+JNIEXPORT void JNICALL Java_org_navi_Navi_stopTraceNative
+    (JNIEnv *env, jclass cls)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_STOP_TRACE);
+    NaviTraceStop();
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_snapshotLatencyNative
+    (JNIEnv *env, jclass cls, jlongArray latencyArray, jint arraySize)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SNAPSHOT_LATENCY);
+    if (!latencyArray)
+        return 0;
+    std::vector<long long> latency(NATIVE_CALL_COUNT * LATENCY_STRIDE);
+    NaviLatencySnapshot(&latency[0]);
+    const int count = arraySize < (int)latency.size() ? arraySize : (int)latency.size();
+    env->SetLongArrayRegion(latencyArray, 0, count, (const jlong*)&latency[0]);
+    return count;
+}
+
+JNIEXPORT void JNICALL Java_org_navi_Navi_setPathCacheSizeNative
+    (JNIEnv *env, jobject obj, jlong ptr, jint size)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SET_PATH_CACHE_SIZE);
+    if (!ptr)
+        return;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    navi->SetPathCacheSize(size);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_SET_PATH_CACHE_SIZE, navi, traceStamp);
+        trace.Write((int)size);
+    }
+}
+
+JNIEXPORT void JNICALL Java_org_navi_Navi_clearPathCacheNative
+    (JNIEnv *env, jobject obj, jlong ptr)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_CLEAR_PATH_CACHE);
+    if (!ptr)
+        return;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    navi->ClearPathCache();
+    if (traceStamp)
+        NaviTraceRecord trace(TRACE_CLEAR_PATH_CACHE, navi, traceStamp);
+}
+
 JNIEXPORT jint JNICALL Java_org_navi_Navi_findPathNative
     (JNIEnv *env, jobject obj, jlong ptr, jfloatArray posArray, jint arraySize,
      jintArray posSize, jfloat startX, jfloat startY, jfloat startZ,
      jfloat endX, jfloat endY, jfloat endZ, jfloat sizeX, jfloat sizeY, jfloat sizeZ)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_FIND_PATH);
     if (!ptr)
         return DT_FAILURE;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 start(startX, startY, startZ);
     Vector3 end(endX, endY, endZ);
     Vector3 size(sizeX, sizeY, sizeZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     int result = navi->FindPath(start, end, size);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_FIND_PATH, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+        trace.Write(size);
+        trace.Write(result);
+    }
     if (!dtStatusSucceed(result))
         return result;
     
@@ -491,12 +813,22 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_findPathDefaultNative
      jfloat endX, jfloat endY, jfloat endZ)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_FIND_PATH_DEFAULT);
     if (!ptr)
         return DT_FAILURE;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 start(startX, startY, startZ);
     Vector3 end(endX, endY, endZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
     int result = navi->FindPath(start, end);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_FIND_PATH_DEFAULT, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+        trace.Write(result);
+    }
     if (!dtStatusSucceed(result))
         return result;
     
@@ -509,19 +841,113 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_findPathDefaultNative
     return result;
 }
 
+JNIEXPORT jint JNICALL Java_org_navi_Navi_findPathHintNative
+    (JNIEnv *env, jobject obj, jlong ptr, jfloatArray posArray, jint arraySize,
+     jintArray posSize, jlongArray refArray, jfloat startX, jfloat startY, jfloat startZ,
+     jfloat endX, jfloat endY, jfloat endZ, jfloat sizeX, jfloat sizeY, jfloat sizeZ)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_FIND_PATH_HINT);
+    if (!ptr || !refArray || env->GetArrayLength(refArray) < 2)
+        return DT_FAILURE;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    Vector3 start(startX, startY, startZ);
+    Vector3 end(endX, endY, endZ);
+    Vector3 size(sizeX, sizeY, sizeZ);
+    dtPolyRef refs[2];
+    env->GetLongArrayRegion(refArray, 0, 2, (jlong*)refs);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    int result = navi->FindPath(start, end, size, refs[0], refs[1]);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_FIND_PATH_HINT, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+        trace.Write(size);
+        trace.Write(refs[0]);
+        trace.Write(refs[1]);
+        trace.Write(result);
+    }
+    refs[0] = navi->GetPathStartRef();
+    refs[1] = navi->GetPathEndRef();
+    env->SetLongArrayRegion(refArray, 0, 2, (const jlong*)refs);
+    if (!dtStatusSucceed(result))
+        return result;
+    
+    const int pathCount = navi->GetPathCount();
+    const Vector3* path = navi->GetPath();
+    const int maxCount = pathCount < arraySize ? pathCount : arraySize;
+    env->SetFloatArrayRegion(posArray, 0, maxCount * 3, (const jfloat*)path);
+    env->SetIntArrayRegion(posSize, 0, 1, (const jint*)&maxCount);
+    
+    return result;
+}
+
+JNIEXPORT jfloat JNICALL Java_org_navi_Navi_getPathDistanceNative
+(JNIEnv* env, jobject obj, jlong ptr, jfloat startX, jfloat startY, jfloat startZ,
+    jfloat endX, jfloat endY, jfloat endZ, jfloat sizeX, jfloat sizeY, jfloat sizeZ)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_PATH_DISTANCE);
+    if (!ptr)
+        return PATH_DISTANCE_UNREACHABLE;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    Vector3 start(startX, startY, startZ);
+    Vector3 end(endX, endY, endZ);
+    Vector3 size(sizeX, sizeY, sizeZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const float distance = navi->GetPathDistance(start, end, size);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_GET_PATH_DISTANCE, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+        trace.Write(size);
+        trace.Write(distance);
+    }
+    return distance;
+}
+
 JNIEXPORT jint JNICALL Java_org_navi_Navi_makePathStraightNative
 (JNIEnv* env, jobject obj, jlong ptr, jfloatArray posArray, jint arraySize,
     jfloat sizeX, jfloat sizeY, jfloat sizeZ)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_MAKE_PATH_STRAIGHT);
     if (!ptr)
         return arraySize;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 size(sizeX, sizeY, sizeZ);
     Vector3* path = (Vector3*)navi->GetPath();
+    if (!path)
+        return arraySize;
+    // the path buffer holds GetMaxPolys points, a longer input is left as is
+    if (arraySize > navi->GetMaxPolys())
+    {
+        LOG_ERROR("makePathStraightNative path of %d points is longer than %d", arraySize, navi->GetMaxPolys());
+        return arraySize;
+    }
     env->GetFloatArrayRegion(posArray, 0, arraySize * 3, (jfloat*)path);
     int pathCount = arraySize;
-    navi->MakePathStraight(pathCount, (float*)path, size);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    if (traceStamp)
+    {
+        // the call overwrites the input path, so the record is filled first
+        NaviTraceRecord trace(TRACE_MAKE_PATH_STRAIGHT, navi, traceStamp);
+        trace.Write(size);
+        trace.Write(pathCount);
+        trace.Write(path, pathCount * (int)sizeof(Vector3));
+        trace.Start();
+        navi->MakePathStraight(pathCount, (float*)path, size);
+        trace.Stop();
+    }
+    else
+    {
+        navi->MakePathStraight(pathCount, (float*)path, size);
+    }
     if (pathCount < arraySize)
         env->SetFloatArrayRegion(posArray, 0, pathCount * 3, (const jfloat*)path);
 
@@ -532,13 +958,82 @@ JNIEXPORT jint JNICALL Java_org_navi_Navi_makePathStraightDefaultNative
 (JNIEnv* env, jobject obj, jlong ptr, jfloatArray posArray, jint arraySize)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_MAKE_PATH_STRAIGHT_DEFAULT);
     if (!ptr)
         return arraySize;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3* path = (Vector3*)navi->GetPath();
+    if (!path)
+        return arraySize;
+    // the path buffer holds GetMaxPolys points, a longer input is left as is
+    if (arraySize > navi->GetMaxPolys())
+    {
+        LOG_ERROR("makePathStraightDefaultNative path of %d points is longer than %d", arraySize, navi->GetMaxPolys());
+        return arraySize;
+    }
+    env->GetFloatArrayRegion(posArray, 0, arraySize * 3, (jfloat*)path);
+    int pathCount = arraySize;
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    if (traceStamp)
+    {
+        // the call overwrites the input path, so the record is filled first
+        NaviTraceRecord trace(TRACE_MAKE_PATH_STRAIGHT_DEFAULT, navi, traceStamp);
+        trace.Write(pathCount);
+        trace.Write(path, pathCount * (int)sizeof(Vector3));
+        trace.Start();
+        navi->MakePathStraight(pathCount, (float*)path);
+        trace.Stop();
+    }
+    else
+    {
+        navi->MakePathStraight(pathCount, (float*)path);
+    }
+    if (pathCount < arraySize)
+        env->SetFloatArrayRegion(posArray, 0, pathCount * 3, (const jfloat*)path);
+
+    return pathCount;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_makePathStraightHintNative
+(JNIEnv* env, jobject obj, jlong ptr, jfloatArray posArray, jint arraySize, jlong startRef,
+    jfloat sizeX, jfloat sizeY, jfloat sizeZ)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_MAKE_PATH_STRAIGHT_HINT);
+    if (!ptr)
+        return arraySize;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    Vector3 size(sizeX, sizeY, sizeZ);
+    Vector3* path = (Vector3*)navi->GetPath();
+    if (!path)
+        return arraySize;
+    // the path buffer holds GetMaxPolys points, a longer input is left as is
+    if (arraySize > navi->GetMaxPolys())
+    {
+        LOG_ERROR("makePathStraightHintNative path of %d points is longer than %d", arraySize, navi->GetMaxPolys());
+        return arraySize;
+    }
     env->GetFloatArrayRegion(posArray, 0, arraySize * 3, (jfloat*)path);
     int pathCount = arraySize;
-    navi->MakePathStraight(pathCount, (float*)path);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    if (traceStamp)
+    {
+        // the call overwrites the input path, so the record is filled first
+        NaviTraceRecord trace(TRACE_MAKE_PATH_STRAIGHT_HINT, navi, traceStamp);
+        trace.Write(size);
+        trace.Write((dtPolyRef)startRef);
+        trace.Write(pathCount);
+        trace.Write(path, pathCount * (int)sizeof(Vector3));
+        trace.Start();
+        navi->MakePathStraight(pathCount, (float*)path, size, (dtPolyRef)startRef);
+        trace.Stop();
+    }
+    else
+    {
+        navi->MakePathStraight(pathCount, (float*)path, size, (dtPolyRef)startRef);
+    }
     if (pathCount < arraySize)
         env->SetFloatArrayRegion(posArray, 0, pathCount * 3, (const jfloat*)path);
 
@@ -550,13 +1045,61 @@ JNIEXPORT jfloat JNICALL Java_org_navi_Navi_pathRaycastNative
     jfloat endX, jfloat endY, jfloat endZ, jfloat sizeX, jfloat sizeY, jfloat sizeZ)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_PATH_RAYCAST);
     if (!ptr)
         return -1.0f;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 start(startX, startY, startZ);
     Vector3 end(endX, endY, endZ);
     Vector3 size(sizeX, sizeY, sizeZ);
-    return navi->PathRaycast(start, end, size);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const float result = navi->PathRaycast(start, end, size);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_PATH_RAYCAST, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+        trace.Write(size);
+    }
+    return result;
+}
+
+JNIEXPORT jfloat JNICALL Java_org_navi_Navi_pathRaycastHintNative
+(JNIEnv* env, jobject obj, jlong ptr, jlongArray refArray, jfloat startX, jfloat startY, jfloat startZ,
+    jfloat endX, jfloat endY, jfloat endZ, jfloat sizeX, jfloat sizeY, jfloat sizeZ)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_PATH_RAYCAST_HINT);
+    if (!ptr || !refArray || env->GetArrayLength(refArray) < 1)
+        return -1.0f;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    Vector3 start(startX, startY, startZ);
+    Vector3 end(endX, endY, endZ);
+    Vector3 size(sizeX, sizeY, sizeZ);
+    dtPolyRef startRef = 0;
+    env->GetLongArrayRegion(refArray, 0, 1, (jlong*)&startRef);
+    float result = -1.0f;
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    if (traceStamp)
+    {
+        // the call overwrites the hint, so the record is filled first
+        NaviTraceRecord trace(TRACE_PATH_RAYCAST_HINT, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+        trace.Write(size);
+        trace.Write(startRef);
+        trace.Start();
+        result = navi->PathRaycast(start, end, size, &startRef);
+        trace.Stop();
+    }
+    else
+    {
+        result = navi->PathRaycast(start, end, size, &startRef);
+    }
+    env->SetLongArrayRegion(refArray, 0, 1, (const jlong*)&startRef);
+    return result;
 }
 
 JNIEXPORT jfloat JNICALL Java_org_navi_Navi_pathRaycastDefaultNative
@@ -564,12 +1107,22 @@ JNIEXPORT jfloat JNICALL Java_org_navi_Navi_pathRaycastDefaultNative
     jfloat endX, jfloat endY, jfloat endZ)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_PATH_RAYCAST_DEFAULT);
     if (!ptr)
         return -1.0f;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 start(startX, startY, startZ);
     Vector3 end(endX, endY, endZ);
-    return navi->PathRaycast(start, end);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const float result = navi->PathRaycast(start, end);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_PATH_RAYCAST_DEFAULT, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+    }
+    return result;
 }
 
 JNIEXPORT jboolean JNICALL Java_org_navi_Navi_canPathForwardNative
@@ -577,13 +1130,24 @@ JNIEXPORT jboolean JNICALL Java_org_navi_Navi_canPathForwardNative
     jfloat endX, jfloat endY, jfloat endZ, jfloat sizeX, jfloat sizeY, jfloat sizeZ)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_CAN_PATH_FORWARD);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 start(startX, startY, startZ);
     Vector3 end(endX, endY, endZ);
     Vector3 size(sizeX, sizeY, sizeZ);
-    return navi->CanPathForward(start, end, size);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const bool result = navi->CanPathForward(start, end, size);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_CAN_PATH_FORWARD, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+        trace.Write(size);
+    }
+    return result;
 }
 
 JNIEXPORT jboolean JNICALL Java_org_navi_Navi_canPathForwardDefaultNative
@@ -591,12 +1155,689 @@ JNIEXPORT jboolean JNICALL Java_org_navi_Navi_canPathForwardDefaultNative
     jfloat endX, jfloat endY, jfloat endZ)
 {
     JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_CAN_PATH_FORWARD_DEFAULT);
     if (!ptr)
         return false;
     Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
     Vector3 start(startX, startY, startZ);
     Vector3 end(endX, endY, endZ);
-    return navi->CanPathForward(start, end);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const bool result = navi->CanPathForward(start, end);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_CAN_PATH_FORWARD_DEFAULT, navi, traceStamp);
+        trace.Write(start);
+        trace.Write(end);
+    }
+    return result;
+}
+
+JNIEXPORT jboolean JNICALL Java_org_navi_Navi_initCrowdNative
+(JNIEnv* env, jobject obj, jlong ptr, jint maxAgents, jfloat maxAgentRadius)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_INIT_CROWD);
+    if (!ptr)
+        return false;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const bool result = navi->InitCrowd(maxAgents, maxAgentRadius);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_INIT_CROWD, navi, traceStamp);
+        trace.Write((int)maxAgents);
+        trace.Write((float)maxAgentRadius);
+        trace.Write(result);
+    }
+    return result;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_getCrowdMaxAgentsNative
+(JNIEnv* env, jobject obj, jlong ptr)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_CROWD_MAX_AGENTS);
+    if (!ptr)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    return navi->GetCrowdMaxAgents();
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_addCrowdAgentNative
+(JNIEnv* env, jobject obj, jlong ptr, jfloat posX, jfloat posY, jfloat posZ,
+    jfloat radius, jfloat height, jfloat maxSpeed, jfloat maxAcceleration)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_ADD_CROWD_AGENT);
+    if (!ptr)
+        return -1;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    Vector3 pos(posX, posY, posZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int idx = navi->AddCrowdAgent(pos, radius, height, maxSpeed, maxAcceleration);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_ADD_CROWD_AGENT, navi, traceStamp);
+        trace.Write(pos);
+        trace.Write((float)radius);
+        trace.Write((float)height);
+        trace.Write((float)maxSpeed);
+        trace.Write((float)maxAcceleration);
+        trace.Write(idx);
+    }
+    return idx;
+}
+
+JNIEXPORT jboolean JNICALL Java_org_navi_Navi_removeCrowdAgentNative
+(JNIEnv* env, jobject obj, jlong ptr, jint idx)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_REMOVE_CROWD_AGENT);
+    if (!ptr)
+        return false;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const bool result = navi->RemoveCrowdAgent(idx);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_REMOVE_CROWD_AGENT, navi, traceStamp);
+        trace.Write((int)idx);
+    }
+    return result;
+}
+
+JNIEXPORT jboolean JNICALL Java_org_navi_Navi_setCrowdTargetNative
+(JNIEnv* env, jobject obj, jlong ptr, jint idx, jfloat targetX, jfloat targetY, jfloat targetZ)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SET_CROWD_TARGET);
+    if (!ptr)
+        return false;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    Vector3 target(targetX, targetY, targetZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const bool result = navi->SetCrowdTarget(idx, target);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_SET_CROWD_TARGET, navi, traceStamp);
+        trace.Write((int)idx);
+        trace.Write(target);
+        trace.Write(result);
+    }
+    return result;
+}
+
+// Grows to the largest crowd updated on the thread and is never shrunk.
+thread_local std::vector<float> tlCrowdState;
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_updateCrowdNative
+(JNIEnv* env, jobject obj, jlong ptr, jfloat dt, jfloatArray stateArray, jint arraySize)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_UPDATE_CROWD);
+    if (!ptr)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviWriteLock lock(navi);
+    const int stateSize = CROWD_LANE_COUNT * navi->GetCrowdMaxAgents();
+    if (stateSize <= 0)
+        return 0;
+    if ((int)tlCrowdState.size() < stateSize)
+        tlCrowdState.resize(stateSize);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int activeCount = navi->UpdateCrowd(dt, &tlCrowdState[0]);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_UPDATE_CROWD, navi, traceStamp);
+        trace.Write((float)dt);
+    }
+    const int count = arraySize < stateSize ? arraySize : stateSize;
+    if (stateArray && count > 0)
+        env->SetFloatArrayRegion(stateArray, 0, count, (const jfloat*)&tlCrowdState[0]);
+    return activeCount;
+}
+
+// Inputs and results of the batch natives, grown to the largest batch of the
+// thread and never shrunk.
+thread_local std::vector<dtPolyRef> tlBatchRefs;
+thread_local std::vector<Vector3> tlBatchPositions;
+thread_local std::vector<float> tlBatchValues;
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_moveAlongSurfaceNative
+(JNIEnv* env, jobject obj, jlong ptr, jint count, jlongArray refArray,
+    jfloatArray fromArray, jfloatArray toArray, jfloatArray resultArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_MOVE_ALONG_SURFACE);
+    if (!ptr || count <= 0 || !refArray || !fromArray || !toArray || !resultArray)
+        return 0;
+    if (env->GetArrayLength(refArray) < count || env->GetArrayLength(fromArray) < count * 3
+        || env->GetArrayLength(toArray) < count * 3 || env->GetArrayLength(resultArray) < count * 3)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchRefs.size() < count)
+        tlBatchRefs.resize(count);
+    if ((int)tlBatchPositions.size() < count * 3)
+        tlBatchPositions.resize(count * 3);
+    dtPolyRef* refs = &tlBatchRefs[0];
+    Vector3* from = &tlBatchPositions[0];
+    Vector3* to = from + count;
+    Vector3* result = to + count;
+    env->GetLongArrayRegion(refArray, 0, count, (jlong*)refs);
+    env->GetFloatArrayRegion(fromArray, 0, count * 3, (jfloat*)from);
+    env->GetFloatArrayRegion(toArray, 0, count * 3, (jfloat*)to);
+    int movedCount = 0;
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    if (traceStamp)
+    {
+        // the call overwrites the hints, so the record is filled first
+        NaviTraceRecord trace(TRACE_MOVE_ALONG_SURFACE, navi, traceStamp);
+        trace.Write((int)count);
+        for (int i = 0; i < count; ++i)
+        {
+            trace.Write(refs[i]);
+            trace.Write(from[i]);
+            trace.Write(to[i]);
+        }
+        trace.Start();
+        movedCount = navi->MoveAlongSurface(count, refs, from, to, result);
+        trace.Stop();
+    }
+    else
+    {
+        movedCount = navi->MoveAlongSurface(count, refs, from, to, result);
+    }
+    env->SetLongArrayRegion(refArray, 0, count, (const jlong*)refs);
+    env->SetFloatArrayRegion(resultArray, 0, count * 3, (const jfloat*)result);
+    return movedCount;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_batchRaycastNative
+(JNIEnv* env, jobject obj, jlong ptr, jint count, jlongArray refArray,
+    jfloatArray segmentArray, jfloatArray tArray, jfloatArray normalArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_BATCH_RAYCAST);
+    if (!ptr || count <= 0 || !segmentArray || !tArray || !normalArray)
+        return 0;
+    if ((refArray && env->GetArrayLength(refArray) < count) || env->GetArrayLength(segmentArray) < count * 6
+        || env->GetArrayLength(tArray) < count || env->GetArrayLength(normalArray) < count * 3)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchRefs.size() < count)
+        tlBatchRefs.resize(count);
+    if ((int)tlBatchPositions.size() < count * 3)
+        tlBatchPositions.resize(count * 3);
+    if ((int)tlBatchValues.size() < count)
+        tlBatchValues.resize(count);
+    dtPolyRef* refs = &tlBatchRefs[0];
+    Vector3* segments = &tlBatchPositions[0];
+    Vector3* normals = segments + count * 2;
+    float* ts = &tlBatchValues[0];
+    if (refArray)
+        env->GetLongArrayRegion(refArray, 0, count, (jlong*)refs);
+    else
+        memset(refs, 0, sizeof(dtPolyRef) * count);
+    env->GetFloatArrayRegion(segmentArray, 0, count * 6, (jfloat*)segments);
+    int hitCount = 0;
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    if (traceStamp)
+    {
+        // the call overwrites the hints, so the record is filled first
+        NaviTraceRecord trace(TRACE_BATCH_RAYCAST, navi, traceStamp);
+        trace.Write((int)count);
+        for (int i = 0; i < count; ++i)
+        {
+            trace.Write(refs[i]);
+            trace.Write(segments[i * 2]);
+            trace.Write(segments[i * 2 + 1]);
+        }
+        trace.Start();
+        hitCount = navi->BatchRaycast(count, refs, segments, ts, normals);
+        trace.Stop();
+    }
+    else
+    {
+        hitCount = navi->BatchRaycast(count, refs, segments, ts, normals);
+    }
+    if (refArray)
+        env->SetLongArrayRegion(refArray, 0, count, (const jlong*)refs);
+    env->SetFloatArrayRegion(tArray, 0, count, (const jfloat*)ts);
+    env->SetFloatArrayRegion(normalArray, 0, count * 3, (const jfloat*)normals);
+    return hitCount;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_findRandomPointsNative
+(JNIEnv* env, jobject obj, jlong ptr, jint count, jfloat centerX, jfloat centerY, jfloat centerZ, jfloat radius,
+    jint regionId, jint include, jint exclude, jint seed, jfloat minSpacing, jfloatArray pointArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_FIND_RANDOM_POINTS);
+    if (!ptr || count <= 0 || !pointArray || env->GetArrayLength(pointArray) < count * 3)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchPositions.size() < count)
+        tlBatchPositions.resize(count);
+    Vector3* points = &tlBatchPositions[0];
+    Vector3 center(centerX, centerY, centerZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int found = navi->FindRandomPoints(count, center, radius, regionId, include, exclude,
+        (unsigned int)seed, minSpacing, points);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_FIND_RANDOM_POINTS, navi, traceStamp);
+        trace.Write((int)count);
+        trace.Write(center);
+        trace.Write((float)radius);
+        trace.Write((int)regionId);
+        trace.Write((int)include);
+        trace.Write((int)exclude);
+        trace.Write((int)seed);
+        trace.Write((float)minSpacing);
+        trace.Write(found);
+    }
+    env->SetFloatArrayRegion(pointArray, 0, found * 3, (const jfloat*)points);
+    return found;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_snapHeightsNative
+(JNIEnv* env, jobject obj, jlong ptr, jint count, jfloatArray xzArray, jfloat minY, jfloat maxY,
+    jfloatArray heightArray, jlongArray refArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SNAP_HEIGHTS);
+    if (!ptr || count <= 0 || !xzArray || !heightArray)
+        return 0;
+    if (env->GetArrayLength(xzArray) < count * 2 || env->GetArrayLength(heightArray) < count
+        || (refArray && env->GetArrayLength(refArray) < count))
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchRefs.size() < count)
+        tlBatchRefs.resize(count);
+    if ((int)tlBatchValues.size() < count * 3)
+        tlBatchValues.resize(count * 3);
+    dtPolyRef* refs = &tlBatchRefs[0];
+    float* xz = &tlBatchValues[0];
+    float* heights = xz + count * 2;
+    env->GetFloatArrayRegion(xzArray, 0, count * 2, (jfloat*)xz);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int snappedCount = navi->SnapHeights(count, xz, minY, maxY, heights, refs);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_SNAP_HEIGHTS, navi, traceStamp);
+        trace.Write((int)count);
+        trace.Write((float)minY);
+        trace.Write((float)maxY);
+        trace.Write(xz, count * 2 * (int)sizeof(float));
+        trace.Write(snappedCount);
+    }
+    env->SetFloatArrayRegion(heightArray, 0, count, (const jfloat*)heights);
+    if (refArray)
+        env->SetLongArrayRegion(refArray, 0, count, (const jlong*)refs);
+    return snappedCount;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_getPathDistancesNative
+(JNIEnv* env, jobject obj, jlong ptr, jint count, jfloatArray pairArray, jfloatArray distanceArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_GET_PATH_DISTANCES);
+    if (!ptr || count <= 0 || !pairArray || !distanceArray)
+        return 0;
+    if (env->GetArrayLength(pairArray) < count * 6 || env->GetArrayLength(distanceArray) < count)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchPositions.size() < count * 2)
+        tlBatchPositions.resize(count * 2);
+    if ((int)tlBatchValues.size() < count)
+        tlBatchValues.resize(count);
+    Vector3* pairs = &tlBatchPositions[0];
+    float* distances = &tlBatchValues[0];
+    env->GetFloatArrayRegion(pairArray, 0, count * 6, (jfloat*)pairs);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int reachableCount = navi->GetPathDistances(count, pairs, distances);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_GET_PATH_DISTANCES, navi, traceStamp);
+        trace.Write((int)count);
+        trace.Write(pairs, count * 2 * (int)sizeof(Vector3));
+        trace.Write(reachableCount);
+    }
+    env->SetFloatArrayRegion(distanceArray, 0, count, (const jfloat*)distances);
+    return reachableCount;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_buildFlowFieldNative
+(JNIEnv* env, jobject obj, jlong ptr, jfloat goalX, jfloat goalY, jfloat goalZ, jfloat maxCost)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_BUILD_FLOW_FIELD);
+    if (!ptr)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    Vector3 goal(goalX, goalY, goalZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    int fieldId = 0;
+    FlowFieldEntry entry;
+    bool created = false;
+    {
+        // the flood fill only reads the mesh, so it runs beside other queries
+        NaviReadLock lock(navi);
+        fieldId = navi->FindFlowField(goal, maxCost);
+        if (!fieldId)
+            created = navi->CreateFlowField(goal, maxCost, entry);
+    }
+    if (created)
+    {
+        NaviWriteLock lock(navi);
+        fieldId = navi->PublishFlowField(entry);
+        // stale by now, so it is built again against the current world
+        if (!fieldId)
+            fieldId = navi->BuildFlowField(goal, maxCost);
+    }
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_BUILD_FLOW_FIELD, navi, traceStamp);
+        trace.Write(goal);
+        trace.Write((float)maxCost);
+        trace.Write(fieldId);
+    }
+    return fieldId;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_sampleFlowFieldNative
+(JNIEnv* env, jobject obj, jlong ptr, jint fieldId, jint count, jlongArray refArray,
+    jfloatArray posArray, jfloatArray dirArray, jfloatArray costArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_SAMPLE_FLOW_FIELD);
+    if (!ptr || count <= 0 || !refArray || !posArray || !dirArray || !costArray)
+        return 0;
+    if (env->GetArrayLength(refArray) < count || env->GetArrayLength(posArray) < count * 3
+        || env->GetArrayLength(dirArray) < count * 3 || env->GetArrayLength(costArray) < count)
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchRefs.size() < count)
+        tlBatchRefs.resize(count);
+    if ((int)tlBatchPositions.size() < count * 2)
+        tlBatchPositions.resize(count * 2);
+    if ((int)tlBatchValues.size() < count)
+        tlBatchValues.resize(count);
+    dtPolyRef* refs = &tlBatchRefs[0];
+    Vector3* pos = &tlBatchPositions[0];
+    Vector3* dirs = pos + count;
+    float* costs = &tlBatchValues[0];
+    env->GetLongArrayRegion(refArray, 0, count, (jlong*)refs);
+    env->GetFloatArrayRegion(posArray, 0, count * 3, (jfloat*)pos);
+    int insideCount = 0;
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    if (traceStamp)
+    {
+        // the call overwrites the hints, so the record is filled first
+        NaviTraceRecord trace(TRACE_SAMPLE_FLOW_FIELD, navi, traceStamp);
+        trace.Write((int)fieldId);
+        trace.Write((int)count);
+        for (int i = 0; i < count; ++i)
+        {
+            trace.Write(refs[i]);
+            trace.Write(pos[i]);
+        }
+        trace.Start();
+        insideCount = navi->SampleFlowField(fieldId, count, refs, pos, dirs, costs);
+        trace.Stop();
+    }
+    else
+    {
+        insideCount = navi->SampleFlowField(fieldId, count, refs, pos, dirs, costs);
+    }
+    if (insideCount < 0)
+        return insideCount;
+    env->SetLongArrayRegion(refArray, 0, count, (const jlong*)refs);
+    env->SetFloatArrayRegion(dirArray, 0, count * 3, (const jfloat*)dirs);
+    env->SetFloatArrayRegion(costArray, 0, count, (const jfloat*)costs);
+    return insideCount;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_findNearestGoalPathNative
+(JNIEnv* env, jobject obj, jlong ptr, jfloatArray posArray, jint arraySize, jintArray posSize,
+    jfloat startX, jfloat startY, jfloat startZ, jint goalCount, jfloatArray goalArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_FIND_NEAREST_GOAL_PATH);
+    if (!ptr || goalCount <= 0 || !goalArray || env->GetArrayLength(goalArray) < goalCount * 3)
+        return -1;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchPositions.size() < goalCount)
+        tlBatchPositions.resize(goalCount);
+    Vector3* goals = &tlBatchPositions[0];
+    env->GetFloatArrayRegion(goalArray, 0, goalCount * 3, (jfloat*)goals);
+    Vector3 start(startX, startY, startZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int goal = navi->FindNearestGoalPath(start, goalCount, goals);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_FIND_NEAREST_GOAL_PATH, navi, traceStamp);
+        trace.Write(start);
+        trace.Write((int)goalCount);
+        trace.Write(goals, goalCount * (int)sizeof(Vector3));
+        trace.Write(goal);
+    }
+    if (goal < 0)
+        return goal;
+
+    const int pathCount = navi->GetPathCount();
+    const Vector3* path = navi->GetPath();
+    const int maxCount = pathCount < arraySize ? pathCount : arraySize;
+    env->SetFloatArrayRegion(posArray, 0, maxCount * 3, (const jfloat*)path);
+    env->SetIntArrayRegion(posSize, 0, 1, (const jint*)&maxCount);
+    return goal;
+}
+
+JNIEXPORT jint JNICALL Java_org_navi_Navi_findReachablePolysNative
+(JNIEnv* env, jobject obj, jlong ptr, jfloat startX, jfloat startY, jfloat startZ, jfloat maxCost,
+    jint maxCount, jlongArray refArray, jfloatArray costArray, jfloatArray centerArray)
+{
+    JAVA_ENV_INIT(env);
+    NAVI_LATENCY_SCOPE(NATIVE_FIND_REACHABLE_POLYS);
+    if (!ptr || maxCount <= 0 || !refArray || !costArray)
+        return 0;
+    if (env->GetArrayLength(refArray) < maxCount || env->GetArrayLength(costArray) < maxCount
+        || (centerArray && env->GetArrayLength(centerArray) < maxCount * 3))
+        return 0;
+    Navi* navi = (Navi*)Long2Ptr(ptr);
+    NaviReadLock lock(navi);
+    if ((int)tlBatchRefs.size() < maxCount)
+        tlBatchRefs.resize(maxCount);
+    if ((int)tlBatchValues.size() < maxCount)
+        tlBatchValues.resize(maxCount);
+    if (centerArray && (int)tlBatchPositions.size() < maxCount)
+        tlBatchPositions.resize(maxCount);
+    dtPolyRef* refs = &tlBatchRefs[0];
+    float* costs = &tlBatchValues[0];
+    Vector3* centers = centerArray ? &tlBatchPositions[0] : nullptr;
+    Vector3 start(startX, startY, startZ);
+    const NaviTraceStamp traceStamp = NaviTraceBegin();
+    const int count = navi->FindReachablePolys(start, maxCost, maxCount, refs, costs, centers);
+    if (traceStamp)
+    {
+        NaviTraceRecord trace(TRACE_FIND_REACHABLE_POLYS, navi, traceStamp);
+        trace.Write(start);
+        trace.Write((float)maxCost);
+        trace.Write((int)maxCount);
+        trace.Write(centers != nullptr);
+        trace.Write(count);
+    }
+    env->SetLongArrayRegion(refArray, 0, count, (const jlong*)refs);
+    env->SetFloatArrayRegion(costArray, 0, count, (const jfloat*)costs);
+    if (centers)
+        env->SetFloatArrayRegion(centerArray, 0, count * 3, (const jfloat*)centers);
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////
+// JNI_OnLoad
+// Natives are registered explicitly so the VM does not resolve them by symbol
+// name. Keep in step with the native declarations of Navi.java.
+static JNINativeMethod sNaviNatives[] = {
+    {(char*)"getMaxPosSizeNative", (char*)"()I", (void*)Java_org_navi_Navi_getMaxPosSizeNative},
+    {(char*)"createNative", (char*)"(IIZ)J", (void*)Java_org_navi_Navi_createNative},
+    {(char*)"destroyNative", (char*)"(J)V", (void*)Java_org_navi_Navi_destroyNative},
+    {(char*)"setDefaultPolySizeNative", (char*)"(JFFF)V", (void*)Java_org_navi_Navi_setDefaultPolySizeNative},
+    {(char*)"loadMeshNative", (char*)"(JLjava/lang/String;I)Z", (void*)Java_org_navi_Navi_loadMeshNative},
+    {(char*)"loadDoorsNative", (char*)"(JLjava/lang/String;)Z", (void*)Java_org_navi_Navi_loadDoorsNative},
+    {(char*)"loadRegionsNative", (char*)"(JLjava/lang/String;)Z", (void*)Java_org_navi_Navi_loadRegionsNative},
+    {(char*)"getRegionIdNative", (char*)"(JFF)I", (void*)Java_org_navi_Navi_getRegionIdNative},
+    {(char*)"initDoorsPolyNative", (char*)"(J)V", (void*)Java_org_navi_Navi_initDoorsPolyNative},
+    {(char*)"isDoorExistNative", (char*)"(JI)Z", (void*)Java_org_navi_Navi_isDoorExistNative},
+    {(char*)"isDoorOpenNative", (char*)"(JI)Z", (void*)Java_org_navi_Navi_isDoorOpenNative},
+    {(char*)"openDoorNative", (char*)"(JIZ)V", (void*)Java_org_navi_Navi_openDoorNative},
+    {(char*)"openAllDoorsNative", (char*)"(JZ)V", (void*)Java_org_navi_Navi_openAllDoorsNative},
+    {(char*)"closeAllDoorsPolyNative", (char*)"(J)V", (void*)Java_org_navi_Navi_closeAllDoorsPolyNative},
+    {(char*)"recoverAllDoorsPolyNative", (char*)"(J)V", (void*)Java_org_navi_Navi_recoverAllDoorsPolyNative},
+    {(char*)"buildDoorGraphNative", (char*)"(J)Z", (void*)Java_org_navi_Navi_buildDoorGraphNative},
+    {(char*)"setDoorGraphPathNative", (char*)"(JZ)V", (void*)Java_org_navi_Navi_setDoorGraphPathNative},
+    {(char*)"buildLandmarksNative", (char*)"(JI)Z", (void*)Java_org_navi_Navi_buildLandmarksNative},
+    {(char*)"setLandmarkPathNative", (char*)"(JZ)V", (void*)Java_org_navi_Navi_setLandmarkPathNative},
+    {(char*)"addObstacleNative", (char*)"(JFFFFF)I", (void*)Java_org_navi_Navi_addObstacleNative},
+    {(char*)"removeObstacleNative", (char*)"(JI)Z", (void*)Java_org_navi_Navi_removeObstacleNative},
+    {(char*)"refreshObstacleNative", (char*)"(J)Z", (void*)Java_org_navi_Navi_refreshObstacleNative},
+    {(char*)"getMaxObstacleReqCountNative", (char*)"(J)I", (void*)Java_org_navi_Navi_getMaxObstacleReqCountNative},
+    {(char*)"getAddedObstacleReqCountNative", (char*)"(J)I", (void*)Java_org_navi_Navi_getAddedObstacleReqCountNative},
+    {(char*)"getObstacleReqRemainCountNative", (char*)"(J)I", (void*)Java_org_navi_Navi_getObstacleReqRemainCountNative},
+    {(char*)"setTileAllocCapacityNative", (char*)"(JI)V", (void*)Java_org_navi_Navi_setTileAllocCapacityNative},
+    {(char*)"getTileAllocStatsNative", (char*)"(J[JI)I", (void*)Java_org_navi_Navi_getTileAllocStatsNative},
+    {(char*)"getPathStatsNative", (char*)"(J[JI)I", (void*)Java_org_navi_Navi_getPathStatsNative},
+    {(char*)"resetPathStatsNative", (char*)"(J)V", (void*)Java_org_navi_Navi_resetPathStatsNative},
+    {(char*)"getMemoryUsageNative", (char*)"(J)J", (void*)Java_org_navi_Navi_getMemoryUsageNative},
+    {(char*)"getTotalMemoryUsageNative", (char*)"()J", (void*)Java_org_navi_Navi_getTotalMemoryUsageNative},
+    {(char*)"startTraceNative", (char*)"(Ljava/lang/String;)Z", (void*)Java_org_navi_Navi_startTraceNative},
+    {(char*)"stopTraceNative", (char*)"()V", (void*)Java_org_navi_Navi_stopTraceNative},
+    {(char*)"snapshotLatencyNative", (char*)"([JI)I", (void*)Java_org_navi_Navi_snapshotLatencyNative},
+    {(char*)"setPathCacheSizeNative", (char*)"(JI)V", (void*)Java_org_navi_Navi_setPathCacheSizeNative},
+    {(char*)"clearPathCacheNative", (char*)"(J)V", (void*)Java_org_navi_Navi_clearPathCacheNative},
+    {(char*)"findPathNative", (char*)"(J[FI[IFFFFFFFFF)I", (void*)Java_org_navi_Navi_findPathNative},
+    {(char*)"findPathDefaultNative", (char*)"(J[FI[IFFFFFF)I", (void*)Java_org_navi_Navi_findPathDefaultNative},
+    {(char*)"makePathStraightNative", (char*)"(J[FIFFF)I", (void*)Java_org_navi_Navi_makePathStraightNative},
+    {(char*)"makePathStraightDefaultNative", (char*)"(J[FI)I", (void*)Java_org_navi_Navi_makePathStraightDefaultNative},
+    {(char*)"pathRaycastNative", (char*)"(JFFFFFFFFF)F", (void*)Java_org_navi_Navi_pathRaycastNative},
+    {(char*)"pathRaycastDefaultNative", (char*)"(JFFFFFF)F", (void*)Java_org_navi_Navi_pathRaycastDefaultNative},
+    {(char*)"canPathForwardNative", (char*)"(JFFFFFFFFF)Z", (void*)Java_org_navi_Navi_canPathForwardNative},
+    {(char*)"canPathForwardDefaultNative", (char*)"(JFFFFFF)Z", (void*)Java_org_navi_Navi_canPathForwardDefaultNative},
+    {(char*)"initCrowdNative", (char*)"(JIF)Z", (void*)Java_org_navi_Navi_initCrowdNative},
+    {(char*)"getCrowdMaxAgentsNative", (char*)"(J)I", (void*)Java_org_navi_Navi_getCrowdMaxAgentsNative},
+    {(char*)"addCrowdAgentNative", (char*)"(JFFFFFFF)I", (void*)Java_org_navi_Navi_addCrowdAgentNative},
+    {(char*)"removeCrowdAgentNative", (char*)"(JI)Z", (void*)Java_org_navi_Navi_removeCrowdAgentNative},
+    {(char*)"setCrowdTargetNative", (char*)"(JIFFF)Z", (void*)Java_org_navi_Navi_setCrowdTargetNative},
+    {(char*)"updateCrowdNative", (char*)"(JF[FI)I", (void*)Java_org_navi_Navi_updateCrowdNative},
+    {(char*)"moveAlongSurfaceNative", (char*)"(JI[J[F[F[F)I", (void*)Java_org_navi_Navi_moveAlongSurfaceNative},
+    {(char*)"buildFlowFieldNative", (char*)"(JFFFF)I", (void*)Java_org_navi_Navi_buildFlowFieldNative},
+    {(char*)"sampleFlowFieldNative", (char*)"(JII[J[F[F[F)I", (void*)Java_org_navi_Navi_sampleFlowFieldNative},
+    {(char*)"findNearestGoalPathNative", (char*)"(J[FI[IFFFI[F)I", (void*)Java_org_navi_Navi_findNearestGoalPathNative},
+    {(char*)"findReachablePolysNative", (char*)"(JFFFFI[J[F[F)I", (void*)Java_org_navi_Navi_findReachablePolysNative},
+    {(char*)"batchRaycastNative", (char*)"(JI[J[F[F[F)I", (void*)Java_org_navi_Navi_batchRaycastNative},
+    {(char*)"findPathHintNative", (char*)"(J[FI[I[JFFFFFFFFF)I", (void*)Java_org_navi_Navi_findPathHintNative},
+    {(char*)"makePathStraightHintNative", (char*)"(J[FIJFFF)I", (void*)Java_org_navi_Navi_makePathStraightHintNative},
+    {(char*)"pathRaycastHintNative", (char*)"(J[JFFFFFFFFF)F", (void*)Java_org_navi_Navi_pathRaycastHintNative},
+    {(char*)"findRandomPointsNative", (char*)"(JIFFFFIIIIF[F)I", (void*)Java_org_navi_Navi_findRandomPointsNative},
+    {(char*)"snapHeightsNative", (char*)"(JI[FFF[F[J)I", (void*)Java_org_navi_Navi_snapHeightsNative},
+    {(char*)"getPathDistanceNative", (char*)"(JFFFFFFFFF)F", (void*)Java_org_navi_Navi_getPathDistanceNative},
+    {(char*)"getPathDistancesNative", (char*)"(JI[F[F)I", (void*)Java_org_navi_Navi_getPathDistancesNative},
+    {(char*)"setNodeStatsNative", (char*)"(JZ)V", (void*)Java_org_navi_Navi_setNodeStatsNative},
+};
+
+static jclass NewGlobalClass(JNIEnv* env, const char* name)
+{
+    jclass localClass = env->FindClass(name);
+    if (!localClass || env->ExceptionCheck())
+    {
+        JniDeleteLocalRef(env, localClass);
+        JniClearPendingException(env);
+        return nullptr;
+    }
+    jclass globalClass = (jclass)env->NewGlobalRef(localClass);
+    JniDeleteLocalRef(env, localClass);
+    return globalClass;
+}
+
+// Drops the global refs taken by JNI_OnLoad, for a load that fails half way.
+static void DeleteGlobalRefs(JNIEnv* env)
+{
+    if (sNaviClass)
+        env->DeleteGlobalRef(sNaviClass);
+    if (sStringClass)
+        env->DeleteGlobalRef(sStringClass);
+    if (sUtf8Name)
+        env->DeleteGlobalRef(sUtf8Name);
+    sNaviClass = nullptr;
+    sStringClass = nullptr;
+    sStringInit = nullptr;
+    sUtf8Name = nullptr;
+}
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved)
+{
+    JNIEnv* env = nullptr;
+    if (vm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK)
+        return JNI_ERR;
+
+    sNaviClass = NewGlobalClass(env, "org/navi/Navi");
+    sStringClass = NewGlobalClass(env, "java/lang/String");
+    if (!sNaviClass || !sStringClass)
+    {
+        DeleteGlobalRefs(env);
+        printf("JNI_OnLoad cannot find org/navi/Navi or java/lang/String\n");
+        return JNI_ERR;
+    }
+    sStringInit = env->GetMethodID(sStringClass, "<init>", "([BLjava/lang/String;)V");
+    jstring utf8Name = env->NewStringUTF("utf-8");
+    if (!sStringInit || !utf8Name || env->ExceptionCheck())
+    {
+        JniDeleteLocalRef(env, utf8Name);
+        JniClearPendingException(env);
+        DeleteGlobalRefs(env);
+        printf("JNI_OnLoad cannot resolve the String(byte[], String) constructor\n");
+        return JNI_ERR;
+    }
+    sUtf8Name = (jstring)env->NewGlobalRef(utf8Name);
+    JniDeleteLocalRef(env, utf8Name);
+    if (!sUtf8Name)
+    {
+        JniClearPendingException(env);
+        DeleteGlobalRefs(env);
+        printf("JNI_OnLoad cannot keep the utf-8 charset name\n");
+        return JNI_ERR;
+    }
+
+    const int nativeCount = (int)(sizeof(sNaviNatives) / sizeof(sNaviNatives[0]));
+    if (env->RegisterNatives(sNaviClass, sNaviNatives, nativeCount) != JNI_OK || env->ExceptionCheck())
+    {
+        JniClearPendingException(env);
+        DeleteGlobalRefs(env);
+        printf("JNI_OnLoad cannot register the natives of org/navi/Navi\n");
+        return JNI_ERR;
+    }
+
+    if (!JniLogStart(vm, env, sNaviClass))
+        printf("JNI_OnLoad cannot start the native log, logs are dropped\n");
+    return JNI_VERSION_1_6;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM* vm, void* reserved)
+{
+    JniLogStop();
 }
 
 #ifdef __cplusplus
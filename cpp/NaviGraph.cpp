@@ -0,0 +1,648 @@
+#include <math.h>
+#include <stdlib.h>
+#include <queue>
+#include <algorithm>
+#include "DetourCommon.h"
+#include "DetourNavMesh.h"
+#include "DetourNavMeshQuery.h"
+#include "NaviGraph.h"
+
+struct GraphOpenNode
+{
+    float total;
+    float cost;
+    int index;
+
+    GraphOpenNode(float inTotal, float inCost, int inIndex)
+    :total(inTotal)
+    ,cost(inCost)
+    ,index(inIndex)
+    {}
+
+    bool operator>(const GraphOpenNode& other) const
+    {
+        return total > other.total;
+    }
+};
+typedef std::priority_queue<GraphOpenNode, std::vector<GraphOpenNode>, std::greater<GraphOpenNode>> GraphOpenList;
+
+/////////////////////////////////////////////////////////////////
+// PolyGraphScratch
+void PolyGraphScratch::Prepare(int polyCount)
+{
+    if ((int)stamps.size() != polyCount)
+    {
+        costs.resize(polyCount);
+        parents.resize(polyCount);
+        stamps.assign(polyCount, 0);
+        stamp = 0;
+    }
+    ++stamp;
+    if (!stamp)
+    {
+        std::fill(stamps.begin(), stamps.end(), 0);
+        stamp = 1;
+    }
+    expandedCount = 0;
+    visitedCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// PolyGraph
+PolyGraph::PolyGraph()
+:mNavMesh(nullptr)
+{
+}
+
+void PolyGraph::Clear()
+{
+    mNavMesh = nullptr;
+    mTileOffsets.clear();
+    mTilePolyCounts.clear();
+    mRefs.clear();
+    mCenters.clear();
+    mAdjStart.clear();
+    mAdj.clear();
+    mAdjCosts.clear();
+}
+
+bool PolyGraph::Build(const dtNavMesh* navMesh)
+{
+    Clear();
+    if (!navMesh)
+        return false;
+    mNavMesh = navMesh;
+
+    const int maxTiles = navMesh->getMaxTiles();
+    mTileOffsets.assign(maxTiles, -1);
+    mTilePolyCounts.assign(maxTiles, 0);
+    int polyCount = 0;
+    for (int i = 0; i < maxTiles; ++i)
+    {
+        const dtMeshTile* tile = navMesh->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize)
+            continue;
+        mTileOffsets[i] = polyCount;
+        mTilePolyCounts[i] = tile->header->polyCount;
+        polyCount += tile->header->polyCount;
+    }
+    if (!polyCount)
+    {
+        Clear();
+        return false;
+    }
+
+    mRefs.resize(polyCount);
+    mCenters.resize(polyCount * 3);
+    for (int i = 0; i < maxTiles; ++i)
+    {
+        if (mTileOffsets[i] < 0)
+            continue;
+        const dtMeshTile* tile = navMesh->getTile(i);
+        const dtPolyRef base = navMesh->getPolyRefBase(tile);
+        for (int j = 0; j < tile->header->polyCount; ++j)
+        {
+            const int index = mTileOffsets[i] + j;
+            const dtPoly* poly = &tile->polys[j];
+            mRefs[index] = base | (dtPolyRef)j;
+            float* center = &mCenters[index * 3];
+            dtVset(center, 0, 0, 0);
+            for (int k = 0; k < poly->vertCount; ++k)
+                dtVadd(center, center, &tile->verts[poly->verts[k] * 3]);
+            if (poly->vertCount)
+                dtVscale(center, center, 1.0f / poly->vertCount);
+        }
+    }
+
+    mAdjStart.resize(polyCount + 1);
+    for (int i = 0; i < maxTiles; ++i)
+    {
+        if (mTileOffsets[i] < 0)
+            continue;
+        const dtMeshTile* tile = navMesh->getTile(i);
+        for (int j = 0; j < tile->header->polyCount; ++j)
+        {
+            const int index = mTileOffsets[i] + j;
+            const dtPoly* poly = &tile->polys[j];
+            mAdjStart[index] = (int)mAdj.size();
+            for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+            {
+                const int neighbor = GetIndex(tile->links[k].ref);
+                if (neighbor < 0)
+                    continue;
+                mAdj.push_back(neighbor);
+                mAdjCosts.push_back(dtVdist(GetCenter(index), GetCenter(neighbor)));
+            }
+        }
+    }
+    mAdjStart[polyCount] = (int)mAdj.size();
+    return true;
+}
+
+int PolyGraph::GetIndex(dtPolyRef ref) const
+{
+    if (!ref || !mNavMesh)
+        return -1;
+    unsigned int salt = 0;
+    unsigned int it = 0;
+    unsigned int ip = 0;
+    mNavMesh->decodePolyId(ref, salt, it, ip);
+    if (it >= mTileOffsets.size() || mTileOffsets[it] < 0 || (int)ip >= mTilePolyCounts[it])
+        return -1;
+    const int index = mTileOffsets[it] + (int)ip;
+    if (mRefs[index] != ref)
+        return -1;
+    return index;
+}
+
+bool PolyGraph::PassFilter(int index, const dtQueryFilter* filter) const
+{
+    const dtMeshTile* tile = nullptr;
+    const dtPoly* poly = nullptr;
+    mNavMesh->getTileAndPolyByRefUnsafe(mRefs[index], &tile, &poly);
+    return filter->passFilter(mRefs[index], tile, poly);
+}
+
+void PolyGraph::Dijkstra(int source, const dtQueryFilter* filter, float maxCost, std::vector<float>& costs) const
+{
+    costs.assign(GetPolyCount(), HUGE_VALF);
+    if (source < 0 || source >= GetPolyCount())
+        return;
+    GraphOpenList openList;
+    costs[source] = 0;
+    openList.push(GraphOpenNode(0, 0, source));
+    while (!openList.empty())
+    {
+        const GraphOpenNode node = openList.top();
+        openList.pop();
+        if (node.cost > costs[node.index])
+            continue;
+        for (int i = GetNeighborBegin(node.index); i < GetNeighborEnd(node.index); ++i)
+        {
+            const int neighbor = GetNeighbor(i);
+            const float cost = node.cost + GetNeighborCost(i);
+            if (cost >= costs[neighbor] || cost > maxCost)
+                continue;
+            if (!PassFilter(neighbor, filter))
+                continue;
+            costs[neighbor] = cost;
+            openList.push(GraphOpenNode(cost, cost, neighbor));
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// LandmarkTable
+const unsigned short LandmarkTable::UNREACHABLE;
+
+LandmarkTable::LandmarkTable()
+:mLandmarkCount(0)
+,mPolyCount(0)
+{
+}
+
+void LandmarkTable::Clear()
+{
+    mLandmarkCount = 0;
+    mPolyCount = 0;
+    mLandmarks.clear();
+    mScales.clear();
+    mDists.clear();
+}
+
+bool LandmarkTable::Build(const PolyGraph& graph, const dtQueryFilter* filter, int count)
+{
+    Clear();
+    const int polyCount = graph.GetPolyCount();
+    if (!polyCount || count <= 0)
+        return false;
+    count = dtMin(count, polyCount);
+
+    int next = -1;
+    for (int i = 0; i < polyCount && next < 0; ++i)
+    {
+        if (graph.PassFilter(i, filter))
+            next = i;
+    }
+    if (next < 0)
+        return false;
+
+    std::vector<unsigned short> dists((size_t)polyCount * count, UNREACHABLE);
+    std::vector<float> minDists(polyCount, HUGE_VALF);
+    std::vector<float> costs;
+    int landmarkCount = 0;
+    while (landmarkCount < count && next >= 0)
+    {
+        graph.Dijkstra(next, filter, HUGE_VALF, costs);
+        float maxDist = 0;
+        for (int i = 0; i < polyCount; ++i)
+        {
+            if (costs[i] != HUGE_VALF)
+                maxDist = dtMax(maxDist, costs[i]);
+        }
+        // quantize so that the largest distance still fits below UNREACHABLE
+        const float scale = maxDist > 0 ? maxDist / (UNREACHABLE - 1) : 1.0f;
+        for (int i = 0; i < polyCount; ++i)
+        {
+            if (costs[i] == HUGE_VALF)
+                continue;
+            const int quantized = dtMin((int)(costs[i] / scale), UNREACHABLE - 1);
+            dists[(size_t)i * count + landmarkCount] = (unsigned short)quantized;
+            minDists[i] = dtMin(minDists[i], costs[i]);
+        }
+        mLandmarks.push_back(next);
+        mScales.push_back(scale);
+        ++landmarkCount;
+
+        // the next landmark is the reached poly furthest from all chosen ones
+        next = -1;
+        float farthest = 0;
+        for (int i = 0; i < polyCount; ++i)
+        {
+            if (minDists[i] != HUGE_VALF && minDists[i] > farthest)
+            {
+                farthest = minDists[i];
+                next = i;
+            }
+        }
+    }
+
+    mPolyCount = polyCount;
+    mLandmarkCount = landmarkCount;
+    if (landmarkCount == count)
+    {
+        mDists.swap(dists);
+    }
+    else
+    {
+        mDists.resize((size_t)polyCount * landmarkCount);
+        for (int i = 0; i < polyCount; ++i)
+        {
+            for (int j = 0; j < landmarkCount; ++j)
+                mDists[(size_t)i * landmarkCount + j] = dists[(size_t)i * count + j];
+        }
+    }
+    return true;
+}
+
+float LandmarkTable::GetHeuristic(int from, int to) const
+{
+    const unsigned short* fromDists = &mDists[(size_t)from * mLandmarkCount];
+    const unsigned short* toDists = &mDists[(size_t)to * mLandmarkCount];
+    float best = 0;
+    for (int i = 0; i < mLandmarkCount; ++i)
+    {
+        if (fromDists[i] == UNREACHABLE || toDists[i] == UNREACHABLE)
+        {
+            // reached from a landmark while the other is not, not connected
+            if (fromDists[i] != toDists[i])
+                return -1.0f;
+            continue;
+        }
+        // one quantum is dropped so the bound stays admissible after rounding
+        const int diff = abs((int)fromDists[i] - (int)toDists[i]) - 1;
+        if (diff > 0)
+            best = dtMax(best, diff * mScales[i]);
+    }
+    return best;
+}
+
+/////////////////////////////////////////////////////////////////
+// FindPolyGraphPath
+dtStatus FindPolyGraphPath(const PolyGraph& graph, const LandmarkTable* landmarks, PolyGraphScratch& scratch,
+    dtPolyRef startRef, dtPolyRef endRef, const dtQueryFilter* filter, int maxNodes,
+    dtPolyRef* path, int* pathCount, int maxPath)
+{
+    *pathCount = 0;
+    scratch.expandedCount = 0;
+    scratch.visitedCount = 0;
+    const int start = graph.GetIndex(startRef);
+    const int end = graph.GetIndex(endRef);
+    if (start < 0 || end < 0 || !path || maxPath <= 0)
+        return DT_FAILURE | DT_INVALID_PARAM;
+    if (landmarks && !landmarks->IsBuilt())
+        landmarks = nullptr;
+
+    scratch.Prepare(graph.GetPolyCount());
+    std::vector<float>& costs = scratch.costs;
+    std::vector<int>& parents = scratch.parents;
+    std::vector<unsigned int>& stamps = scratch.stamps;
+    const unsigned int stamp = scratch.stamp;
+    const float* endCenter = graph.GetCenter(end);
+
+    GraphOpenList openList;
+    stamps[start] = stamp;
+    costs[start] = 0;
+    parents[start] = -1;
+    float startHeuristic = dtVdist(graph.GetCenter(start), endCenter);
+    if (landmarks)
+    {
+        const float heuristic = landmarks->GetHeuristic(start, end);
+        if (heuristic >= 0)
+            startHeuristic = dtMax(startHeuristic, heuristic);
+        else
+            startHeuristic = -1.0f;
+    }
+    int best = start;
+    float bestHeuristic = startHeuristic;
+    int nodeCount = 1;
+    bool outOfNodes = false;
+    if (startHeuristic >= 0)
+        openList.push(GraphOpenNode(startHeuristic, 0, start));
+
+    while (!openList.empty())
+    {
+        const GraphOpenNode node = openList.top();
+        openList.pop();
+        if (node.cost > costs[node.index])
+            continue;
+        ++scratch.expandedCount;
+        if (node.index == end)
+        {
+            best = end;
+            break;
+        }
+        for (int i = graph.GetNeighborBegin(node.index); i < graph.GetNeighborEnd(node.index); ++i)
+        {
+            const int neighbor = graph.GetNeighbor(i);
+            const float cost = node.cost + graph.GetNeighborCost(i);
+            const bool visited = stamps[neighbor] == stamp;
+            if (visited && cost >= costs[neighbor])
+                continue;
+            if (!graph.PassFilter(neighbor, filter))
+                continue;
+            float heuristic = dtVdist(graph.GetCenter(neighbor), endCenter);
+            if (landmarks)
+            {
+                const float landmarkHeuristic = landmarks->GetHeuristic(neighbor, end);
+                if (landmarkHeuristic < 0)
+                    continue;
+                heuristic = dtMax(heuristic, landmarkHeuristic);
+            }
+            if (!visited)
+            {
+                if (nodeCount >= maxNodes)
+                {
+                    outOfNodes = true;
+                    continue;
+                }
+                ++nodeCount;
+                stamps[neighbor] = stamp;
+            }
+            costs[neighbor] = cost;
+            parents[neighbor] = node.index;
+            if (heuristic < bestHeuristic)
+            {
+                bestHeuristic = heuristic;
+                best = neighbor;
+            }
+            openList.push(GraphOpenNode(cost + heuristic, cost, neighbor));
+        }
+    }
+    scratch.visitedCount = nodeCount;
+
+    dtStatus status = DT_SUCCESS;
+    if (best != end)
+        status |= DT_PARTIAL_RESULT;
+    if (outOfNodes)
+        status |= DT_OUT_OF_NODES;
+
+    int length = 0;
+    for (int index = best; index >= 0; index = parents[index])
+        ++length;
+    // keep the part of the corridor nearest to the start when it is too long
+    int skip = length - maxPath;
+    if (skip > 0)
+        status |= DT_BUFFER_TOO_SMALL;
+    int count = dtMin(length, maxPath);
+    int write = length - 1;
+    for (int index = best; index >= 0; index = parents[index], --write)
+    {
+        if (write < count)
+            path[write] = graph.GetRef(index);
+    }
+    *pathCount = count;
+    return status;
+}
+
+/////////////////////////////////////////////////////////////////
+// FlowField
+struct FlowOpenNode
+{
+    float cost;
+    dtPolyRef ref;
+
+    FlowOpenNode(float inCost, dtPolyRef inRef)
+    :cost(inCost)
+    ,ref(inRef)
+    {}
+
+    bool operator>(const FlowOpenNode& other) const
+    {
+        return cost > other.cost;
+    }
+};
+typedef std::priority_queue<FlowOpenNode, std::vector<FlowOpenNode>, std::greater<FlowOpenNode>> FlowOpenList;
+
+void GetPolyCenter(const dtMeshTile* tile, const dtPoly* poly, float* center)
+{
+    dtVset(center, 0, 0, 0);
+    for (int k = 0; k < poly->vertCount; ++k)
+        dtVadd(center, center, &tile->verts[poly->verts[k] * 3]);
+    if (poly->vertCount)
+        dtVscale(center, center, 1.0f / poly->vertCount);
+}
+
+// Middle of the edge of link, clipped to the part shared with the neighbour
+// tile like dtNavMeshQuery::getPortalPoints.
+static void GetPortalMid(const dtMeshTile* tile, const dtPoly* poly, const dtLink& link, float* mid)
+{
+    const float* va = &tile->verts[poly->verts[link.edge] * 3];
+    const float* vb = &tile->verts[poly->verts[(link.edge + 1) % poly->vertCount] * 3];
+    if (link.side != 0xff && (link.bmin != 0 || link.bmax != 255))
+    {
+        float left[3];
+        float right[3];
+        dtVlerp(left, va, vb, link.bmin * (1.0f / 255.0f));
+        dtVlerp(right, va, vb, link.bmax * (1.0f / 255.0f));
+        dtVlerp(mid, left, right, 0.5f);
+        return;
+    }
+    dtVlerp(mid, va, vb, 0.5f);
+}
+
+FlowField::FlowField()
+:mGoalRef(0)
+,mMaxCost(0)
+{
+}
+
+bool FlowField::Build(const dtNavMesh* navMesh, dtPolyRef goalRef, const float* goalPos, const dtQueryFilter* filter,
+    float maxCost, int maxPolys)
+{
+    mCells.clear();
+    mGoalRef = goalRef;
+    mMaxCost = maxCost;
+    if (!navMesh || !navMesh->isValidPolyRef(goalRef))
+        return false;
+
+    FlowCell& goalCell = mCells[goalRef];
+    goalCell.cost = 0;
+    dtVcopy(goalCell.waypoint, goalPos);
+    FlowOpenList openList;
+    openList.push(FlowOpenNode(0, goalRef));
+    while (!openList.empty())
+    {
+        const FlowOpenNode node = openList.top();
+        openList.pop();
+        if (node.cost > mCells[node.ref].cost)
+            continue;
+        const dtMeshTile* tile = nullptr;
+        const dtPoly* poly = nullptr;
+        navMesh->getTileAndPolyByRefUnsafe(node.ref, &tile, &poly);
+        float center[3];
+        GetPolyCenter(tile, poly, center);
+        for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+        {
+            const dtLink& link = tile->links[k];
+            if (!link.ref)
+                continue;
+            const dtMeshTile* neighborTile = nullptr;
+            const dtPoly* neighborPoly = nullptr;
+            navMesh->getTileAndPolyByRefUnsafe(link.ref, &neighborTile, &neighborPoly);
+            if (neighborPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+                continue;
+            if (!filter->passFilter(link.ref, neighborTile, neighborPoly))
+                continue;
+            float neighborCenter[3];
+            GetPolyCenter(neighborTile, neighborPoly, neighborCenter);
+            const float cost = node.cost + dtVdist(center, neighborCenter);
+            if (cost > maxCost)
+                continue;
+            std::unordered_map<dtPolyRef, FlowCell>::iterator cellIt = mCells.find(link.ref);
+            if (cellIt == mCells.end())
+            {
+                if ((int)mCells.size() >= maxPolys)
+                    continue;
+                cellIt = mCells.insert(std::make_pair(link.ref, FlowCell())).first;
+            }
+            else if (cost >= cellIt->second.cost)
+            {
+                continue;
+            }
+            // agents in the neighbour head through the shared portal into this poly
+            cellIt->second.cost = cost;
+            GetPortalMid(tile, poly, link, cellIt->second.waypoint);
+            openList.push(FlowOpenNode(cost, link.ref));
+        }
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// PolySearch
+int PolySearch::Run(const dtNavMesh* navMesh, dtPolyRef startRef, const float* startPos, const dtQueryFilter* filter,
+    float maxCost, int maxPolys, int goalCount, const dtPolyRef* goalRefs, const float* goalPos, float* goalCost)
+{
+    mNodes.clear();
+    mClosed.clear();
+    if (!navMesh || !navMesh->isValidPolyRef(startRef))
+        return -1;
+
+    // goal indices by poly, several goals may share one
+    std::vector<std::pair<dtPolyRef, int>> goals;
+    for (int i = 0; i < goalCount; ++i)
+    {
+        if (goalRefs[i])
+            goals.push_back(std::make_pair(goalRefs[i], i));
+    }
+    std::sort(goals.begin(), goals.end());
+    int bestGoal = -1;
+    float bestCost = HUGE_VALF;
+
+    PolySearchNode& startNode = mNodes[startRef];
+    startNode.cost = 0;
+    dtVcopy(startNode.pos, startPos);
+    startNode.parent = 0;
+    FlowOpenList openList;
+    openList.push(FlowOpenNode(0, startRef));
+    while (!openList.empty())
+    {
+        const FlowOpenNode top = openList.top();
+        openList.pop();
+        // every goal left costs at least the cost of the poly it sits in
+        if (top.cost >= bestCost)
+            break;
+        const PolySearchNode node = mNodes[top.ref];
+        if (top.cost > node.cost)
+            continue;
+        mClosed.push_back(top.ref);
+        std::vector<std::pair<dtPolyRef, int>>::const_iterator goalIt = std::lower_bound(goals.begin(), goals.end(),
+            std::make_pair(top.ref, -1));
+        for (; goalIt != goals.end() && goalIt->first == top.ref; ++goalIt)
+        {
+            const float cost = node.cost + dtVdist(node.pos, &goalPos[goalIt->second * 3]);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestGoal = goalIt->second;
+            }
+        }
+
+        const dtMeshTile* tile = nullptr;
+        const dtPoly* poly = nullptr;
+        navMesh->getTileAndPolyByRefUnsafe(top.ref, &tile, &poly);
+        for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+        {
+            const dtLink& link = tile->links[k];
+            if (!link.ref || link.ref == node.parent)
+                continue;
+            const dtMeshTile* neighborTile = nullptr;
+            const dtPoly* neighborPoly = nullptr;
+            navMesh->getTileAndPolyByRefUnsafe(link.ref, &neighborTile, &neighborPoly);
+            if (neighborPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+                continue;
+            if (!filter->passFilter(link.ref, neighborTile, neighborPoly))
+                continue;
+            float mid[3];
+            GetPortalMid(tile, poly, link, mid);
+            const float cost = node.cost + dtVdist(node.pos, mid);
+            if (cost > maxCost)
+                continue;
+            std::unordered_map<dtPolyRef, PolySearchNode>::iterator nodeIt = mNodes.find(link.ref);
+            if (nodeIt == mNodes.end())
+            {
+                if ((int)mNodes.size() >= maxPolys)
+                    continue;
+                nodeIt = mNodes.insert(std::make_pair(link.ref, PolySearchNode())).first;
+            }
+            else if (cost >= nodeIt->second.cost)
+            {
+                continue;
+            }
+            nodeIt->second.cost = cost;
+            dtVcopy(nodeIt->second.pos, mid);
+            nodeIt->second.parent = top.ref;
+            openList.push(FlowOpenNode(cost, link.ref));
+        }
+    }
+    if (goalCost)
+        *goalCost = bestCost;
+    return bestGoal;
+}
+
+int PolySearch::GetPath(dtPolyRef ref, dtPolyRef* path, int maxPath) const
+{
+    int length = 0;
+    for (const PolySearchNode* node = Find(ref); node; node = node->parent ? Find(node->parent) : nullptr)
+        ++length;
+    // walk back from ref, dropping the polys past maxPath
+    int index = length - 1;
+    for (dtPolyRef it = ref; it && index >= 0; --index)
+    {
+        if (index < maxPath)
+            path[index] = it;
+        it = Find(it)->parent;
+    }
+    return dtMin(length, maxPath);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "DetourNavMesh.h"
+
+class dtQueryFilter;
+
+// Per-search state of PolyGraph, one per thread doing searches.
+struct PolyGraphScratch
+{
+    std::vector<float> costs;
+    std::vector<int> parents;
+    std::vector<unsigned int> stamps;
+    unsigned int stamp;
+    int expandedCount;
+    int visitedCount;                   // nodes touched by the last FindPolyGraphPath
+
+    PolyGraphScratch()
+    :stamp(0)
+    ,expandedCount(0)
+    ,visitedCount(0)
+    {}
+
+    void Prepare(int polyCount);
+};
+
+// Dense index view of a dtNavMesh: every poly gets an index, a center and a
+// list of neighbours weighted by the distance between centers.
+class PolyGraph
+{
+    const dtNavMesh* mNavMesh;
+    std::vector<int> mTileOffsets;
+    std::vector<int> mTilePolyCounts;
+    std::vector<dtPolyRef> mRefs;
+    std::vector<float> mCenters;
+    std::vector<int> mAdjStart;
+    std::vector<int> mAdj;
+    std::vector<float> mAdjCosts;
+
+public:
+    PolyGraph();
+
+    bool Build(const dtNavMesh* navMesh);
+    void Clear();
+
+    inline bool IsBuilt() const
+    {
+        return !mRefs.empty();
+    }
+    inline int GetPolyCount() const
+    {
+        return (int)mRefs.size();
+    }
+    inline dtPolyRef GetRef(int index) const
+    {
+        return mRefs[index];
+    }
+    inline const float* GetCenter(int index) const
+    {
+        return &mCenters[index * 3];
+    }
+    inline int GetNeighborBegin(int index) const
+    {
+        return mAdjStart[index];
+    }
+    inline int GetNeighborEnd(int index) const
+    {
+        return mAdjStart[index + 1];
+    }
+    inline int GetNeighbor(int adjIndex) const
+    {
+        return mAdj[adjIndex];
+    }
+    inline float GetNeighborCost(int adjIndex) const
+    {
+        return mAdjCosts[adjIndex];
+    }
+
+    // -1 if the ref does not belong to the graph (stale or invalid)
+    int GetIndex(dtPolyRef ref) const;
+    bool PassFilter(int index, const dtQueryFilter* filter) const;
+
+    // Single source Dijkstra over polys passing the filter, costs of polys
+    // not reached or further than maxCost are left at HUGE_VALF.
+    void Dijkstra(int source, const dtQueryFilter* filter, float maxCost, std::vector<float>& costs) const;
+};
+
+// ALT (A*, landmarks, triangle inequality) heuristic. Stores the graph
+// distance from a few landmark polys to every poly, quantized to 16 bits.
+class LandmarkTable
+{
+    int mLandmarkCount;
+    int mPolyCount;
+    std::vector<int> mLandmarks;
+    std::vector<float> mScales;
+    // [poly * mLandmarkCount + landmark], UNREACHABLE when not connected
+    std::vector<unsigned short> mDists;
+
+public:
+    static const unsigned short UNREACHABLE = 0xffff;
+
+    LandmarkTable();
+
+    bool Build(const PolyGraph& graph, const dtQueryFilter* filter, int count);
+    void Clear();
+
+    inline bool IsBuilt() const
+    {
+        return mLandmarkCount > 0;
+    }
+    inline int GetLandmarkCount() const
+    {
+        return mLandmarkCount;
+    }
+
+    // Admissible lower bound of the graph distance, negative when the
+    // landmarks prove the two polys are not connected.
+    float GetHeuristic(int from, int to) const;
+};
+
+// A* over the poly graph, guided by the landmark table when given. Returns
+// the corridor from startRef to endRef, or to the closest poly reached when
+// the end is not reachable or the node budget runs out.
+dtStatus FindPolyGraphPath(const PolyGraph& graph, const LandmarkTable* landmarks, PolyGraphScratch& scratch,
+    dtPolyRef startRef, dtPolyRef endRef, const dtQueryFilter* filter, int maxNodes,
+    dtPolyRef* path, int* pathCount, int maxPath);
+
+// Average of the poly vertices
+void GetPolyCenter(const dtMeshTile* tile, const dtPoly* poly, float* center);
+
+// Step of a flow field: cost to the goal and the point to head for, the
+// middle of the portal towards the goal, or the goal itself in its poly.
+struct FlowCell
+{
+    float cost;
+    float waypoint[3];
+};
+
+// Reverse Dijkstra from a goal poly over the tile links of a dtNavMesh. Only
+// the polys within the cost bound are stored, so a field costs memory by its
+// reach rather than by the mesh size. Costs are distances between poly
+// centers like PolyGraph.
+class FlowField
+{
+    dtPolyRef mGoalRef;
+    float mMaxCost;
+    std::unordered_map<dtPolyRef, FlowCell> mCells;
+
+public:
+    FlowField();
+
+    // Stops at maxCost or after maxPolys polys, false if goalRef is invalid.
+    bool Build(const dtNavMesh* navMesh, dtPolyRef goalRef, const float* goalPos, const dtQueryFilter* filter,
+        float maxCost, int maxPolys);
+
+    inline dtPolyRef GetGoalRef() const
+    {
+        return mGoalRef;
+    }
+    inline float GetMaxCost() const
+    {
+        return mMaxCost;
+    }
+    inline int GetCellCount() const
+    {
+        return (int)mCells.size();
+    }
+    // nullptr if ref was not reached
+    inline const FlowCell* Find(dtPolyRef ref) const
+    {
+        std::unordered_map<dtPolyRef, FlowCell>::const_iterator it = mCells.find(ref);
+        return it == mCells.end() ? nullptr : &it->second;
+    }
+};
+
+// Node of PolySearch: cost from the start, the point the search entered the
+// poly at and the poly it came from.
+struct PolySearchNode
+{
+    float cost;
+    float pos[3];
+    dtPolyRef parent;
+};
+
+// Dijkstra from a start poly over the tile links, with costs measured between
+// portal midpoints like the Detour queries. Polys are closed in order of cost.
+class PolySearch
+{
+    std::unordered_map<dtPolyRef, PolySearchNode> mNodes;
+    std::vector<dtPolyRef> mClosed;
+
+public:
+    // Expands polys within maxCost, at most maxPolys of them. With goals, stops
+    // as soon as the cheapest goal is known and returns its index, the cost to
+    // a goal runs on to its point inside goalRefs[i]. Returns -1 otherwise.
+    int Run(const dtNavMesh* navMesh, dtPolyRef startRef, const float* startPos, const dtQueryFilter* filter,
+        float maxCost, int maxPolys, int goalCount = 0, const dtPolyRef* goalRefs = nullptr, const float* goalPos = nullptr,
+        float* goalCost = nullptr);
+
+    // Polys closed by the last run, in order of cost
+    inline const std::vector<dtPolyRef>& GetClosed() const
+    {
+        return mClosed;
+    }
+    // nullptr if ref was not reached
+    inline const PolySearchNode* Find(dtPolyRef ref) const
+    {
+        std::unordered_map<dtPolyRef, PolySearchNode>::const_iterator it = mNodes.find(ref);
+        return it == mNodes.end() ? nullptr : &it->second;
+    }
+    // Corridor from the start to ref, truncated to the first maxPath polys.
+    int GetPath(dtPolyRef ref, dtPolyRef* path, int maxPath) const;
+};
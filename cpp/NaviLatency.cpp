@@ -0,0 +1,94 @@
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "Util.h"
+#include "NaviLatency.h"
+
+COMPILE_TEST(LATENCY_BUCKET_COUNT, LATENCY_BUCKET_COUNT == 304);
+
+/////////////////////////////////////////////////////////////////
+// LatencyHistogram
+// Cache line aligned so that natives called from different threads do not
+// share lines.
+struct alignas(64) LatencyHistogram
+{
+    std::atomic<long long> count;
+    std::atomic<long long> totalNs;
+    std::atomic<long long> maxNs;
+    std::atomic<long long> buckets[LATENCY_BUCKET_COUNT];
+
+    LatencyHistogram()
+    :count(0)
+    ,totalNs(0)
+    ,maxNs(0)
+    {
+        for (int i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+            buckets[i].store(0, std::memory_order_relaxed);
+    }
+};
+
+// Plain atomics have nothing to destroy, so calls recording during process exit
+// stay safe without leaking the histograms like the trace file.
+static LatencyHistogram sHistograms[NATIVE_CALL_COUNT];
+
+static inline LatencyHistogram* GetHistograms()
+{
+    return sHistograms;
+}
+
+static inline int HighestBit(unsigned long long value)
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+static inline int GetBucket(long long ns)
+{
+    if (ns < LATENCY_SUB_BUCKETS)
+        return ns < 0 ? 0 : (int)ns;
+    const int exponent = HighestBit((unsigned long long)ns);
+    if (exponent >= LATENCY_MAX_EXPONENT)
+        return LATENCY_BUCKET_COUNT - 1;
+    const int sub = (int)(ns >> (exponent - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+    return (exponent - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+long long NaviLatencyBucketLow(int bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket < 0 ? 0 : bucket;
+    const int exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+    const int sub = bucket % LATENCY_SUB_BUCKETS;
+    return (long long)(LATENCY_SUB_BUCKETS + sub) << (exponent - LATENCY_SUB_BUCKET_BITS);
+}
+
+void NaviLatencyRecord(NaviNativeCall call, long long ns)
+{
+    LatencyHistogram& histogram = GetHistograms()[call];
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.totalNs.fetch_add(ns, std::memory_order_relaxed);
+    histogram.buckets[GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    long long max = histogram.maxNs.load(std::memory_order_relaxed);
+    while (ns > max && !histogram.maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        ;
+}
+
+void NaviLatencySnapshot(long long* out)
+{
+    LatencyHistogram* histograms = GetHistograms();
+    for (int call = 0; call < NATIVE_CALL_COUNT; ++call)
+    {
+        LatencyHistogram& histogram = histograms[call];
+        long long* values = out + call * LATENCY_STRIDE;
+        values[0] = histogram.count.exchange(0, std::memory_order_relaxed);
+        values[1] = histogram.totalNs.exchange(0, std::memory_order_relaxed);
+        values[2] = histogram.maxNs.exchange(0, std::memory_order_relaxed);
+        for (int i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+            values[3 + i] = histogram.buckets[i].exchange(0, std::memory_order_relaxed);
+    }
+}
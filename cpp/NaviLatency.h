@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+// Latency histograms of the JNI entry points, one per native and shared by all
+// navis. Buckets are log spaced with LATENCY_SUB_BUCKETS linear sub-buckets
+// per power of two, so a bucket is at most 1/8 wide relative to its value.
+// Values below LATENCY_SUB_BUCKETS ns get a bucket each, values from 2^40 ns
+// (about 18 minutes) up land in the last bucket.
+//
+// Snapshot layout, LATENCY_STRIDE longs per native in NaviNativeCall order:
+// count, total ns, max ns, then LATENCY_BUCKET_COUNT bucket counts.
+enum NaviNativeCall
+{
+    NATIVE_GET_MAX_POS_SIZE,
+    NATIVE_CREATE,
+    NATIVE_DESTROY,
+    NATIVE_SET_DEFAULT_POLY_SIZE,
+    NATIVE_LOAD_MESH,
+    NATIVE_LOAD_DOORS,
+    NATIVE_LOAD_REGIONS,
+    NATIVE_GET_REGION_ID,
+    NATIVE_INIT_DOORS_POLY,
+    NATIVE_IS_DOOR_EXIST,
+    NATIVE_IS_DOOR_OPEN,
+    NATIVE_OPEN_DOOR,
+    NATIVE_OPEN_ALL_DOORS,
+    NATIVE_CLOSE_ALL_DOORS_POLY,
+    NATIVE_RECOVER_ALL_DOORS_POLY,
+    NATIVE_BUILD_DOOR_GRAPH,
+    NATIVE_SET_DOOR_GRAPH_PATH,
+    NATIVE_BUILD_LANDMARKS,
+    NATIVE_SET_LANDMARK_PATH,
+    NATIVE_ADD_OBSTACLE,
+    NATIVE_REMOVE_OBSTACLE,
+    NATIVE_REFRESH_OBSTACLE,
+    NATIVE_GET_MAX_OBSTACLE_REQ_COUNT,
+    NATIVE_GET_ADDED_OBSTACLE_REQ_COUNT,
+    NATIVE_GET_OBSTACLE_REQ_REMAIN_COUNT,
+    NATIVE_SET_TILE_ALLOC_CAPACITY,
+    NATIVE_GET_TILE_ALLOC_STATS,
+    NATIVE_GET_PATH_STATS,
+    NATIVE_RESET_PATH_STATS,
+    NATIVE_GET_MEMORY_USAGE,
+    NATIVE_GET_TOTAL_MEMORY_USAGE,
+    NATIVE_START_TRACE,
+    NATIVE_STOP_TRACE,
+    NATIVE_SET_PATH_CACHE_SIZE,
+    NATIVE_CLEAR_PATH_CACHE,
+    NATIVE_FIND_PATH,
+    NATIVE_FIND_PATH_DEFAULT,
+    NATIVE_MAKE_PATH_STRAIGHT,
+    NATIVE_MAKE_PATH_STRAIGHT_DEFAULT,
+    NATIVE_PATH_RAYCAST,
+    NATIVE_PATH_RAYCAST_DEFAULT,
+    NATIVE_CAN_PATH_FORWARD,
+    NATIVE_CAN_PATH_FORWARD_DEFAULT,
+    NATIVE_SNAPSHOT_LATENCY,
+    NATIVE_INIT_CROWD,
+    NATIVE_GET_CROWD_MAX_AGENTS,
+    NATIVE_ADD_CROWD_AGENT,
+    NATIVE_REMOVE_CROWD_AGENT,
+    NATIVE_SET_CROWD_TARGET,
+    NATIVE_UPDATE_CROWD,
+    NATIVE_MOVE_ALONG_SURFACE,
+    NATIVE_BUILD_FLOW_FIELD,
+    NATIVE_SAMPLE_FLOW_FIELD,
+    NATIVE_FIND_NEAREST_GOAL_PATH,
+    NATIVE_FIND_REACHABLE_POLYS,
+    NATIVE_BATCH_RAYCAST,
+    NATIVE_FIND_PATH_HINT,
+    NATIVE_MAKE_PATH_STRAIGHT_HINT,
+    NATIVE_PATH_RAYCAST_HINT,
+    NATIVE_FIND_RANDOM_POINTS,
+    NATIVE_SNAP_HEIGHTS,
+    NATIVE_GET_PATH_DISTANCE,
+    NATIVE_GET_PATH_DISTANCES,
+    NATIVE_SET_NODE_STATS,
+    NATIVE_CALL_COUNT,
+};
+
+const int LATENCY_SUB_BUCKET_BITS = 3;
+const int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+const int LATENCY_MAX_EXPONENT = 40;
+const int LATENCY_BUCKET_COUNT = (LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS;
+const int LATENCY_STRIDE = 3 + LATENCY_BUCKET_COUNT;
+
+// Adds one call of ns nanoseconds, lock free with relaxed atomics.
+void NaviLatencyRecord(NaviNativeCall call, long long ns);
+
+// Copies every histogram into out, NATIVE_CALL_COUNT * LATENCY_STRIDE longs,
+// and resets it. Calls running meanwhile land in either snapshot.
+void NaviLatencySnapshot(long long* out);
+
+// Smallest value counted in bucket
+long long NaviLatencyBucketLow(int bucket);
+
+class NaviLatencyScope
+{
+    NaviNativeCall mCall;
+    std::chrono::steady_clock::time_point mBegin;
+
+public:
+    inline NaviLatencyScope(NaviNativeCall call)
+    :mCall(call)
+    ,mBegin(std::chrono::steady_clock::now())
+    {}
+
+    inline ~NaviLatencyScope()
+    {
+        const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - mBegin;
+        NaviLatencyRecord(mCall, (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+};
+
+#define NAVI_LATENCY_SCOPE(call) NaviLatencyScope __latency__(call)
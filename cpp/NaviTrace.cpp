@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include "Util.h"
+#include "NaviTrace.h"
+
+COMPILE_TEST(TRACE_RECORD_HEADER_SIZE, sizeof(NaviTraceRecordHeader) == 32);
+
+const size_t TRACE_FILE_BUFFER = 1024 * 1024;
+
+std::atomic<bool> gNaviTraceEnabled(false);
+std::atomic<long long> gNaviTraceSequence(0);
+
+/////////////////////////////////////////////////////////////////
+// TraceFile
+// Shared by every thread, records are appended under the lock.
+struct TraceFile
+{
+    std::mutex lock;
+    FILE* fp;
+    std::unordered_map<Navi*, unsigned int> handles;
+    unsigned int nextHandle;
+    std::chrono::steady_clock::time_point start;
+
+    TraceFile()
+    :fp(nullptr)
+    ,nextHandle(1)
+    {}
+
+    void Close()
+    {
+        if (fp)
+            fclose(fp);
+        fp = nullptr;
+        handles.clear();
+        nextHandle = 1;
+    }
+};
+
+static TraceFile* GetTraceFile()
+{
+    // Leaked on purpose, JNI calls may still record during process exit.
+    static TraceFile* file = new TraceFile;
+    return file;
+}
+
+// Payload of the record being built on this thread.
+thread_local std::vector<unsigned char> tlPayload;
+
+bool NaviTraceStart(const char* path)
+{
+    TraceFile* file = GetTraceFile();
+    std::lock_guard<std::mutex> guard(file->lock);
+    gNaviTraceEnabled.store(false);
+    file->Close();
+    file->fp = fopen(path, "wb");
+    if (!file->fp)
+    {
+        LOG_ERROR("NaviTraceStart cannot open %s", path);
+        return false;
+    }
+    setvbuf(file->fp, nullptr, _IOFBF, TRACE_FILE_BUFFER);
+    NaviTraceFileHeader header;
+    header.magic = NAVI_TRACE_MAGIC;
+    header.version = NAVI_TRACE_VERSION;
+    fwrite(&header, sizeof(header), 1, file->fp);
+    file->start = std::chrono::steady_clock::now();
+    gNaviTraceSequence.store(0);
+    gNaviTraceEnabled.store(true);
+    return true;
+}
+
+void NaviTraceStop()
+{
+    TraceFile* file = GetTraceFile();
+    std::lock_guard<std::mutex> guard(file->lock);
+    gNaviTraceEnabled.store(false);
+    file->Close();
+}
+
+long long NaviTraceNow()
+{
+    const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - GetTraceFile()->start;
+    return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+/////////////////////////////////////////////////////////////////
+// NaviTraceRecord
+NaviTraceRecord::NaviTraceRecord(NaviTraceOp op, Navi* navi, const NaviTraceStamp& stamp)
+:mOp(op)
+,mNavi(navi)
+,mStamp(stamp)
+,mCallTime(stamp.time)
+,mDuration(0)
+{
+    Stop();
+    tlPayload.clear();
+}
+
+NaviTraceRecord::~NaviTraceRecord()
+{
+    const long long duration = mDuration;
+    TraceFile* file = GetTraceFile();
+    std::lock_guard<std::mutex> guard(file->lock);
+    if (!file->fp)
+        return;
+
+    unsigned int handle = 0;
+    auto it = file->handles.find(mNavi);
+    if (it != file->handles.end())
+    {
+        handle = it->second;
+    }
+    else
+    {
+        // navis created before the trace started also get a handle, the
+        // replayer skips them as it never saw their creation
+        handle = file->nextHandle++;
+        file->handles.emplace(mNavi, handle);
+    }
+    if (mOp == TRACE_DESTROY)
+        file->handles.erase(mNavi);
+
+    NaviTraceRecordHeader header;
+    header.op = (unsigned short)mOp;
+    header.reserved = 0;
+    header.handle = handle;
+    header.size = (unsigned int)tlPayload.size();
+    header.duration = duration > 0xffffffffLL ? 0xffffffffu : (unsigned int)(duration < 0 ? 0 : duration);
+    header.sequence = mStamp.sequence;
+    header.time = mStamp.time;
+    fwrite(&header, sizeof(header), 1, file->fp);
+    if (!tlPayload.empty())
+        fwrite(&tlPayload[0], tlPayload.size(), 1, file->fp);
+}
+
+void NaviTraceRecord::Write(const void* data, int size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    tlPayload.insert(tlPayload.end(), bytes, bytes + size);
+}
+
+void NaviTraceRecord::WriteString(const char* str)
+{
+    const int length = str ? (int)strlen(str) : 0;
+    Write(length);
+    if (length > 0)
+        Write(str, length);
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+
+class Navi;
+
+// Binary trace of the JNI calls, written by the JNI layer while recording is
+// on and replayed by RecastJniReplay.
+//
+// File: NaviTraceFileHeader, then records. Each record is a
+// NaviTraceRecordHeader followed by size bytes of payload. Payloads are the
+// raw call arguments in the order listed below, Vector3 as 3 floats, bool as
+// 1 byte and strings as an int length followed by the bytes. Records are
+// appended as calls finish, the sequence gives the order the calls started.
+const int NAVI_TRACE_MAGIC = 'N'<<24 | 'T'<<16 | 'R'<<8 | 'C';
+const int NAVI_TRACE_VERSION = 2;
+
+enum NaviTraceOp
+{
+    TRACE_CREATE,                       // int maxPoly, int maxObstacle
+    TRACE_DESTROY,
+    TRACE_SET_DEFAULT_POLY_SIZE,        // Vector3 size
+    TRACE_LOAD_MESH,                    // string path, int maxSearchNodes, bool result
+    TRACE_LOAD_DOORS,                   // string path, bool result
+    TRACE_LOAD_REGIONS,                 // string path, bool result
+    TRACE_GET_REGION_ID,                // float x, float z
+    TRACE_INIT_DOORS_POLY,
+    TRACE_OPEN_DOOR,                    // int doorId, bool open
+    TRACE_OPEN_ALL_DOORS,               // bool open
+    TRACE_CLOSE_ALL_DOORS_POLY,
+    TRACE_RECOVER_ALL_DOORS_POLY,
+    TRACE_BUILD_DOOR_GRAPH,
+    TRACE_SET_DOOR_GRAPH_PATH,          // bool enable
+    TRACE_BUILD_LANDMARKS,              // int count
+    TRACE_SET_LANDMARK_PATH,            // bool enable
+    TRACE_ADD_OBSTACLE,                 // Vector3 pos, float radius, float height, int ref (0 if failed)
+    TRACE_REMOVE_OBSTACLE,              // int ref
+    TRACE_REFRESH_OBSTACLE,
+    TRACE_SET_TILE_ALLOC_CAPACITY,      // int capacity
+    TRACE_SET_PATH_CACHE_SIZE,          // int size
+    TRACE_CLEAR_PATH_CACHE,
+    TRACE_FIND_PATH,                    // Vector3 start, Vector3 end, Vector3 size, int result
+    TRACE_FIND_PATH_DEFAULT,            // Vector3 start, Vector3 end, int result
+    TRACE_MAKE_PATH_STRAIGHT,           // Vector3 size, int count, Vector3 path[count]
+    TRACE_MAKE_PATH_STRAIGHT_DEFAULT,   // int count, Vector3 path[count]
+    TRACE_PATH_RAYCAST,                 // Vector3 start, Vector3 end, Vector3 size
+    TRACE_PATH_RAYCAST_DEFAULT,         // Vector3 start, Vector3 end
+    TRACE_CAN_PATH_FORWARD,             // Vector3 start, Vector3 end, Vector3 size
+    TRACE_CAN_PATH_FORWARD_DEFAULT,     // Vector3 start, Vector3 end
+    TRACE_INIT_CROWD,                   // int maxAgents, float maxAgentRadius, bool result
+    TRACE_ADD_CROWD_AGENT,              // Vector3 pos, float radius, float height, float maxSpeed, float maxAcceleration, int idx
+    TRACE_REMOVE_CROWD_AGENT,           // int idx
+    TRACE_SET_CROWD_TARGET,             // int idx, Vector3 target, bool result
+    TRACE_UPDATE_CROWD,                 // float dt
+    TRACE_MOVE_ALONG_SURFACE,           // int count, then count times dtPolyRef hint, Vector3 from, Vector3 to
+    TRACE_BUILD_FLOW_FIELD,             // Vector3 goal, float maxCost, int fieldId
+    TRACE_SAMPLE_FLOW_FIELD,            // int fieldId, int count, then count times dtPolyRef hint, Vector3 pos
+    TRACE_FIND_NEAREST_GOAL_PATH,       // Vector3 start, int goalCount, goalCount Vector3 goals, int goal
+    TRACE_FIND_REACHABLE_POLYS,         // Vector3 start, float maxCost, int maxCount, bool centers, int count
+    TRACE_BATCH_RAYCAST,                // int count, then count times dtPolyRef hint, Vector3 start, Vector3 end
+    TRACE_FIND_PATH_HINT,               // Vector3 start, Vector3 end, Vector3 size, dtPolyRef startHint, dtPolyRef endHint, int result
+    TRACE_MAKE_PATH_STRAIGHT_HINT,      // Vector3 size, dtPolyRef startHint, int count, Vector3 path[count]
+    TRACE_PATH_RAYCAST_HINT,            // Vector3 start, Vector3 end, Vector3 size, dtPolyRef startHint
+    TRACE_FIND_RANDOM_POINTS,           // int count, Vector3 center, float radius, int regionId, int include, int exclude, int seed, float minSpacing, int found
+    TRACE_SNAP_HEIGHTS,                 // int count, float minY, float maxY, float xz[count * 2], int snappedCount
+    TRACE_GET_PATH_DISTANCE,            // Vector3 start, Vector3 end, Vector3 size, float distance
+    TRACE_GET_PATH_DISTANCES,           // int count, Vector3 pairs[count * 2], int reachableCount
+    TRACE_OP_COUNT,
+};
+
+struct NaviTraceFileHeader
+{
+    int magic;
+    int version;
+};
+
+struct NaviTraceRecordHeader
+{
+    unsigned short op;
+    unsigned short reserved;
+    unsigned int handle;                // navi id, numbered from 1 in the order the trace first sees them
+    unsigned int size;                  // payload bytes
+    unsigned int duration;              // ns spent in the call, saturated
+    long long sequence;                 // call order, numbered from 1 when the trace starts
+    long long time;                     // ns from the start of the trace to the call
+};
+
+// Order and time of a call, taken when it starts.
+struct NaviTraceStamp
+{
+    long long sequence;                 // 0 when not recording
+    long long time;
+
+    inline explicit operator bool() const
+    {
+        return sequence != 0;
+    }
+};
+
+extern std::atomic<bool> gNaviTraceEnabled;
+extern std::atomic<long long> gNaviTraceSequence;
+
+inline bool NaviTraceEnabled()
+{
+    return gNaviTraceEnabled.load(std::memory_order_relaxed);
+}
+
+// Starts writing to path, replacing a trace already running.
+bool NaviTraceStart(const char* path);
+void NaviTraceStop();
+
+// ns from the start of the trace
+long long NaviTraceNow();
+
+// Stamp to pass to NaviTraceRecord, taken before the call. False when not recording.
+inline NaviTraceStamp NaviTraceBegin()
+{
+    NaviTraceStamp stamp = { 0, 0 };
+    if (NaviTraceEnabled())
+    {
+        stamp.sequence = gNaviTraceSequence.fetch_add(1, std::memory_order_relaxed) + 1;
+        stamp.time = NaviTraceNow();
+    }
+    return stamp;
+}
+
+// Collects the payload of one call and appends the record when destroyed.
+// Built after the call, so the duration stops when it is constructed and the
+// payload is not counted. Calls that overwrite their inputs fill the record
+// first and time the call between Start and Stop. Records are dropped if the
+// trace stops meanwhile.
+class NaviTraceRecord
+{
+    NaviTraceOp mOp;
+    Navi* mNavi;
+    NaviTraceStamp mStamp;
+    long long mCallTime;
+    long long mDuration;
+
+public:
+    NaviTraceRecord(NaviTraceOp op, Navi* navi, const NaviTraceStamp& stamp);
+    ~NaviTraceRecord();
+
+    inline void Start()
+    {
+        mCallTime = NaviTraceNow();
+    }
+    inline void Stop()
+    {
+        mDuration = NaviTraceNow() - mCallTime;
+    }
+
+    void Write(const void* data, int size);
+    void WriteString(const char* str);
+    template <typename T>
+    inline void Write(const T& value)
+    {
+        Write(&value, (int)sizeof(T));
+    }
+};
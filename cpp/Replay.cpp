@@ -0,0 +1,829 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include "DetourCommon.h"
+#include "DetourNavMesh.h"
+#include "DetourTileCache.h"
+#include "nlohmann/json.hpp"
+#include "NaviTrace.h"
+#include "Navi.h"
+
+// RecastJniReplay <trace> [options]
+// Replays a trace written by Navi.startTrace on one thread, in the order the
+// calls started, records being stable sorted by their call-start sequence.
+//   --timing               keep the original call times instead of running at full speed
+//   --path-map <from> <to> replace the path prefix from of loaded files by to
+//   --out <file>           write the json report to a file instead of stdout
+struct ReplayOptions
+{
+    std::string trace;
+    bool timing;
+    std::string mapFrom;
+    std::string mapTo;
+    std::string out;
+
+    ReplayOptions()
+    :timing(false)
+    {}
+};
+
+typedef std::chrono::steady_clock ReplayClock;
+
+static const char* sOpNames[TRACE_OP_COUNT] = {
+    "create",
+    "destroy",
+    "setDefaultPolySize",
+    "loadMesh",
+    "loadDoors",
+    "loadRegions",
+    "getRegionId",
+    "initDoorsPoly",
+    "openDoor",
+    "openAllDoors",
+    "closeAllDoorsPoly",
+    "recoverAllDoorsPoly",
+    "buildDoorGraph",
+    "setDoorGraphPath",
+    "buildLandmarks",
+    "setLandmarkPath",
+    "addObstacle",
+    "removeObstacle",
+    "refreshObstacle",
+    "setTileAllocCapacity",
+    "setPathCacheSize",
+    "clearPathCache",
+    "findPath",
+    "findPathDefault",
+    "makePathStraight",
+    "makePathStraightDefault",
+    "pathRaycast",
+    "pathRaycastDefault",
+    "canPathForward",
+    "canPathForwardDefault",
+    "initCrowd",
+    "addCrowdAgent",
+    "removeCrowdAgent",
+    "setCrowdTarget",
+    "updateCrowd",
+    "moveAlongSurface",
+    "buildFlowField",
+    "sampleFlowField",
+    "findNearestGoalPath",
+    "findReachablePolys",
+    "batchRaycast",
+    "findPathHint",
+    "makePathStraightHint",
+    "pathRaycastHint",
+    "findRandomPoints",
+    "snapHeights",
+    "getPathDistance",
+    "getPathDistances",
+};
+
+// Reads the payload of one record, every read fails once past the end.
+struct PayloadReader
+{
+    const unsigned char* data;
+    unsigned int size;
+    unsigned int pos;
+    bool failed;
+
+    PayloadReader(const unsigned char* inData, unsigned int inSize)
+    :data(inData)
+    ,size(inSize)
+    ,pos(0)
+    ,failed(false)
+    {}
+
+    void Read(void* out, unsigned int count)
+    {
+        if (failed || count > size - pos)
+        {
+            failed = true;
+            memset(out, 0, count);
+            return;
+        }
+        memcpy(out, data + pos, count);
+        pos += count;
+    }
+
+    template <typename T>
+    inline T Read()
+    {
+        T value;
+        Read(&value, sizeof(T));
+        return value;
+    }
+
+    std::string ReadString()
+    {
+        const int length = Read<int>();
+        if (failed || length < 0 || (unsigned int)length > size - pos)
+        {
+            failed = true;
+            return std::string();
+        }
+        std::string str((const char*)data + pos, length);
+        pos += length;
+        return str;
+    }
+};
+
+// Recorded and replayed latencies of one op.
+struct OpStats
+{
+    std::vector<long long> recorded;
+    std::vector<long long> replayed;
+
+    static void Summary(std::vector<long long>& samples, nlohmann::json& result)
+    {
+        if (samples.empty())
+            return;
+        std::sort(samples.begin(), samples.end());
+        const size_t count = samples.size();
+        long long total = 0;
+        for (size_t i = 0; i < count; ++i)
+            total += samples[i];
+        result["p50_ns"] = samples[count / 2];
+        result["p99_ns"] = samples[std::min(count - 1, count * 99 / 100)];
+        result["max_ns"] = samples[count - 1];
+        result["mean_ns"] = total / (long long)count;
+    }
+};
+
+struct ReplayNavi
+{
+    Navi* navi;
+    // obstacle ref in the trace -> obstacle ref of this replay
+    std::map<int, dtObstacleRef> obstacles;
+    // crowd agent index in the trace -> agent index of this replay
+    std::map<int, int> crowdAgents;
+    // flow field id in the trace -> flow field id of this replay
+    std::map<int, int> flowFields;
+
+    ReplayNavi()
+    :navi(nullptr)
+    {}
+};
+
+/////////////////////////////////////////////////////////////////
+// Replayer
+class Replayer
+{
+    const ReplayOptions& mOptions;
+    std::map<unsigned int, ReplayNavi> mNavis;
+    std::vector<Vector3> mPath;
+    std::vector<float> mValues;
+    std::vector<dtPolyRef> mRefs;
+    OpStats mStats[TRACE_OP_COUNT];
+    int mSkipped;
+    int mResultMismatches;
+
+    std::string MapPath(const std::string& path) const
+    {
+        if (mOptions.mapFrom.empty() || path.compare(0, mOptions.mapFrom.size(), mOptions.mapFrom) != 0)
+            return path;
+        return mOptions.mapTo + path.substr(mOptions.mapFrom.size());
+    }
+
+    // Runs one record, false if it cannot be replayed.
+    bool Run(const NaviTraceRecordHeader& header, PayloadReader& payload);
+
+public:
+    Replayer(const ReplayOptions& options)
+    :mOptions(options)
+    ,mSkipped(0)
+    ,mResultMismatches(0)
+    {}
+
+    ~Replayer()
+    {
+        for (auto it = mNavis.begin(); it != mNavis.end(); ++it)
+            delete it->second.navi;
+    }
+
+    bool Replay(const std::vector<unsigned char>& trace, nlohmann::json& report);
+};
+
+bool Replayer::Run(const NaviTraceRecordHeader& header, PayloadReader& payload)
+{
+    if (header.op == TRACE_CREATE)
+    {
+        const int maxPoly = payload.Read<int>();
+        const int maxObstacle = payload.Read<int>();
+        if (payload.failed)
+            return false;
+        ReplayNavi& item = mNavis[header.handle];
+        delete item.navi;
+        item.navi = new Navi(maxPoly <= 0 ? 1024 : maxPoly, maxObstacle);
+        item.obstacles.clear();
+        item.crowdAgents.clear();
+        item.flowFields.clear();
+        return true;
+    }
+
+    auto it = mNavis.find(header.handle);
+    if (it == mNavis.end())
+        return false;
+    ReplayNavi& item = it->second;
+    Navi* navi = item.navi;
+    switch (header.op)
+    {
+    case TRACE_DESTROY:
+        delete navi;
+        mNavis.erase(it);
+        break;
+    case TRACE_SET_DEFAULT_POLY_SIZE:
+    {
+        const Vector3 size = payload.Read<Vector3>();
+        navi->SetDefaultPolySize(size.x, size.y, size.z);
+        break;
+    }
+    case TRACE_LOAD_MESH:
+    {
+        const std::string path = MapPath(payload.ReadString());
+        const int maxSearchNodes = payload.Read<int>();
+        const bool recorded = payload.Read<bool>();
+        if (navi->LoadMesh(path.c_str(), maxSearchNodes) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_LOAD_DOORS:
+    {
+        const std::string path = MapPath(payload.ReadString());
+        const bool recorded = payload.Read<bool>();
+        if (navi->LoadDoors(path.c_str()) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_LOAD_REGIONS:
+    {
+        const std::string path = MapPath(payload.ReadString());
+        const bool recorded = payload.Read<bool>();
+        if (navi->LoadRegions(path.c_str()) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_GET_REGION_ID:
+    {
+        const float x = payload.Read<float>();
+        const float z = payload.Read<float>();
+        navi->GetRegionId(Vector3(x, 0, z));
+        break;
+    }
+    case TRACE_INIT_DOORS_POLY:
+        navi->InitDoorsPoly();
+        break;
+    case TRACE_OPEN_DOOR:
+    {
+        const int doorId = payload.Read<int>();
+        const bool open = payload.Read<bool>();
+        navi->OpenDoor(doorId, open);
+        break;
+    }
+    case TRACE_OPEN_ALL_DOORS:
+        navi->OpenAllDoors(payload.Read<bool>());
+        break;
+    case TRACE_CLOSE_ALL_DOORS_POLY:
+        navi->CloseAllDoorsPoly();
+        break;
+    case TRACE_RECOVER_ALL_DOORS_POLY:
+        navi->RecoverAllDoorsPoly();
+        break;
+    case TRACE_BUILD_DOOR_GRAPH:
+        navi->BuildDoorGraph();
+        break;
+    case TRACE_SET_DOOR_GRAPH_PATH:
+        navi->SetDoorGraphPath(payload.Read<bool>());
+        break;
+    case TRACE_BUILD_LANDMARKS:
+        navi->BuildLandmarks(payload.Read<int>());
+        break;
+    case TRACE_SET_LANDMARK_PATH:
+        navi->SetLandmarkPath(payload.Read<bool>());
+        break;
+    case TRACE_ADD_OBSTACLE:
+    {
+        const Vector3 pos = payload.Read<Vector3>();
+        const float radius = payload.Read<float>();
+        const float height = payload.Read<float>();
+        const int recordedRef = payload.Read<int>();
+        dtObstacleRef ref = 0;
+        const dtStatus status = navi->AddObstacle(pos, radius, height, &ref);
+        if (dtStatusSucceed(status) != (recordedRef != 0))
+            ++mResultMismatches;
+        if (recordedRef && dtStatusSucceed(status))
+            item.obstacles[recordedRef] = ref;
+        break;
+    }
+    case TRACE_REMOVE_OBSTACLE:
+    {
+        const int recordedRef = payload.Read<int>();
+        auto obstacleIt = item.obstacles.find(recordedRef);
+        if (obstacleIt == item.obstacles.end())
+            return false;
+        navi->RemoveObstacle(obstacleIt->second);
+        item.obstacles.erase(obstacleIt);
+        break;
+    }
+    case TRACE_REFRESH_OBSTACLE:
+        navi->RefreshObstacle();
+        break;
+    case TRACE_SET_TILE_ALLOC_CAPACITY:
+        navi->SetTileAllocCapacity(payload.Read<int>());
+        break;
+    case TRACE_SET_PATH_CACHE_SIZE:
+        navi->SetPathCacheSize(payload.Read<int>());
+        break;
+    case TRACE_CLEAR_PATH_CACHE:
+        navi->ClearPathCache();
+        break;
+    case TRACE_FIND_PATH:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const Vector3 end = payload.Read<Vector3>();
+        const Vector3 size = payload.Read<Vector3>();
+        const int recorded = payload.Read<int>();
+        if (navi->FindPath(start, end, size) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_FIND_PATH_DEFAULT:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const Vector3 end = payload.Read<Vector3>();
+        const int recorded = payload.Read<int>();
+        if (navi->FindPath(start, end) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_MAKE_PATH_STRAIGHT:
+    case TRACE_MAKE_PATH_STRAIGHT_DEFAULT:
+    {
+        Vector3 size;
+        if (header.op == TRACE_MAKE_PATH_STRAIGHT)
+            size = payload.Read<Vector3>();
+        int pathCount = payload.Read<int>();
+        if (pathCount < 0 || pathCount > navi->GetMaxPolys())
+            return false;
+        mPath.resize(pathCount > 0 ? pathCount : 1);
+        payload.Read(&mPath[0], pathCount * (unsigned int)sizeof(Vector3));
+        if (payload.failed)
+            return false;
+        if (header.op == TRACE_MAKE_PATH_STRAIGHT)
+            navi->MakePathStraight(pathCount, (float*)&mPath[0], size);
+        else
+            navi->MakePathStraight(pathCount, (float*)&mPath[0]);
+        break;
+    }
+    case TRACE_PATH_RAYCAST:
+    case TRACE_CAN_PATH_FORWARD:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const Vector3 end = payload.Read<Vector3>();
+        const Vector3 size = payload.Read<Vector3>();
+        if (header.op == TRACE_PATH_RAYCAST)
+            navi->PathRaycast(start, end, size);
+        else
+            navi->CanPathForward(start, end, size);
+        break;
+    }
+    case TRACE_PATH_RAYCAST_DEFAULT:
+    case TRACE_CAN_PATH_FORWARD_DEFAULT:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const Vector3 end = payload.Read<Vector3>();
+        if (header.op == TRACE_PATH_RAYCAST_DEFAULT)
+            navi->PathRaycast(start, end);
+        else
+            navi->CanPathForward(start, end);
+        break;
+    }
+    case TRACE_INIT_CROWD:
+    {
+        const int maxAgents = payload.Read<int>();
+        const float maxAgentRadius = payload.Read<float>();
+        const bool recorded = payload.Read<bool>();
+        if (navi->InitCrowd(maxAgents, maxAgentRadius) != recorded)
+            ++mResultMismatches;
+        item.crowdAgents.clear();
+        break;
+    }
+    case TRACE_ADD_CROWD_AGENT:
+    {
+        const Vector3 pos = payload.Read<Vector3>();
+        const float radius = payload.Read<float>();
+        const float height = payload.Read<float>();
+        const float maxSpeed = payload.Read<float>();
+        const float maxAcceleration = payload.Read<float>();
+        const int recordedIdx = payload.Read<int>();
+        const int idx = navi->AddCrowdAgent(pos, radius, height, maxSpeed, maxAcceleration);
+        if ((idx >= 0) != (recordedIdx >= 0))
+            ++mResultMismatches;
+        if (recordedIdx >= 0 && idx >= 0)
+            item.crowdAgents[recordedIdx] = idx;
+        break;
+    }
+    case TRACE_REMOVE_CROWD_AGENT:
+    {
+        const int recordedIdx = payload.Read<int>();
+        auto agentIt = item.crowdAgents.find(recordedIdx);
+        if (agentIt == item.crowdAgents.end())
+            return false;
+        navi->RemoveCrowdAgent(agentIt->second);
+        item.crowdAgents.erase(agentIt);
+        break;
+    }
+    case TRACE_SET_CROWD_TARGET:
+    {
+        const int recordedIdx = payload.Read<int>();
+        const Vector3 target = payload.Read<Vector3>();
+        const bool recorded = payload.Read<bool>();
+        auto agentIt = item.crowdAgents.find(recordedIdx);
+        if (agentIt == item.crowdAgents.end())
+            return false;
+        if (navi->SetCrowdTarget(agentIt->second, target) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_UPDATE_CROWD:
+    {
+        const float dt = payload.Read<float>();
+        mValues.resize(CROWD_LANE_COUNT * navi->GetCrowdMaxAgents() + 1);
+        navi->UpdateCrowd(dt, &mValues[0]);
+        break;
+    }
+    case TRACE_MOVE_ALONG_SURFACE:
+    {
+        const int count = payload.Read<int>();
+        if (count < 0 || (unsigned int)count > header.size / (sizeof(dtPolyRef) + sizeof(Vector3) * 2))
+            return false;
+        mRefs.resize(count + 1);
+        mPath.resize(count * 3 + 1);
+        for (int i = 0; i < count; ++i)
+        {
+            // recorded hints that are stale here fall back to the nearest poly
+            mRefs[i] = payload.Read<dtPolyRef>();
+            mPath[i] = payload.Read<Vector3>();
+            mPath[count + i] = payload.Read<Vector3>();
+        }
+        if (payload.failed)
+            return false;
+        navi->MoveAlongSurface(count, &mRefs[0], &mPath[0], &mPath[count], &mPath[count * 2]);
+        break;
+    }
+    case TRACE_BUILD_FLOW_FIELD:
+    {
+        const Vector3 goal = payload.Read<Vector3>();
+        const float maxCost = payload.Read<float>();
+        const int recordedId = payload.Read<int>();
+        const int fieldId = navi->BuildFlowField(goal, maxCost);
+        if ((fieldId != 0) != (recordedId != 0))
+            ++mResultMismatches;
+        if (recordedId && fieldId)
+            item.flowFields[recordedId] = fieldId;
+        break;
+    }
+    case TRACE_SAMPLE_FLOW_FIELD:
+    {
+        const int recordedId = payload.Read<int>();
+        const int count = payload.Read<int>();
+        if (count < 0 || (unsigned int)count > header.size / (sizeof(dtPolyRef) + sizeof(Vector3)))
+            return false;
+        auto fieldIt = item.flowFields.find(recordedId);
+        if (fieldIt == item.flowFields.end())
+            return false;
+        mRefs.resize(count + 1);
+        mPath.resize(count * 2 + 1);
+        mValues.resize(count + 1);
+        for (int i = 0; i < count; ++i)
+        {
+            mRefs[i] = payload.Read<dtPolyRef>();
+            mPath[i] = payload.Read<Vector3>();
+        }
+        if (payload.failed)
+            return false;
+        navi->SampleFlowField(fieldIt->second, count, &mRefs[0], &mPath[0], &mPath[count], &mValues[0]);
+        break;
+    }
+    case TRACE_FIND_NEAREST_GOAL_PATH:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const int goalCount = payload.Read<int>();
+        if (goalCount < 0 || (unsigned int)goalCount > header.size / sizeof(Vector3))
+            return false;
+        mPath.resize(goalCount + 1);
+        payload.Read(&mPath[0], goalCount * (unsigned int)sizeof(Vector3));
+        const int recorded = payload.Read<int>();
+        if (payload.failed)
+            return false;
+        if (navi->FindNearestGoalPath(start, goalCount, &mPath[0]) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_FIND_REACHABLE_POLYS:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const float maxCost = payload.Read<float>();
+        // a search never closes more polys than the node budget
+        const int maxCount = std::min(payload.Read<int>(), navi->GetMaxSearchNodes());
+        const bool centers = payload.Read<bool>();
+        const int recorded = payload.Read<int>();
+        if (payload.failed || maxCount < 0)
+            return false;
+        mRefs.resize(maxCount + 1);
+        mValues.resize(maxCount + 1);
+        mPath.resize(maxCount + 1);
+        if (navi->FindReachablePolys(start, maxCost, maxCount, &mRefs[0], &mValues[0], centers ? &mPath[0] : nullptr) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_BATCH_RAYCAST:
+    {
+        const int count = payload.Read<int>();
+        if (count < 0 || (unsigned int)count > header.size / (sizeof(dtPolyRef) + sizeof(Vector3) * 2))
+            return false;
+        mRefs.resize(count + 1);
+        mPath.resize(count * 3 + 1);
+        mValues.resize(count + 1);
+        for (int i = 0; i < count; ++i)
+        {
+            mRefs[i] = payload.Read<dtPolyRef>();
+            mPath[i * 2] = payload.Read<Vector3>();
+            mPath[i * 2 + 1] = payload.Read<Vector3>();
+        }
+        if (payload.failed)
+            return false;
+        navi->BatchRaycast(count, &mRefs[0], &mPath[0], &mValues[0], &mPath[count * 2]);
+        break;
+    }
+    case TRACE_FIND_PATH_HINT:
+    {
+        // recorded hints that do not hold the points here fall back to the nearest poly
+        const Vector3 start = payload.Read<Vector3>();
+        const Vector3 end = payload.Read<Vector3>();
+        const Vector3 size = payload.Read<Vector3>();
+        const dtPolyRef startRef = payload.Read<dtPolyRef>();
+        const dtPolyRef endRef = payload.Read<dtPolyRef>();
+        const int recorded = payload.Read<int>();
+        if (navi->FindPath(start, end, size, startRef, endRef) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_MAKE_PATH_STRAIGHT_HINT:
+    {
+        const Vector3 size = payload.Read<Vector3>();
+        const dtPolyRef startRef = payload.Read<dtPolyRef>();
+        int pathCount = payload.Read<int>();
+        if (pathCount < 0 || pathCount > navi->GetMaxPolys())
+            return false;
+        mPath.resize(pathCount > 0 ? pathCount : 1);
+        payload.Read(&mPath[0], pathCount * (unsigned int)sizeof(Vector3));
+        if (payload.failed)
+            return false;
+        navi->MakePathStraight(pathCount, (float*)&mPath[0], size, startRef);
+        break;
+    }
+    case TRACE_PATH_RAYCAST_HINT:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const Vector3 end = payload.Read<Vector3>();
+        const Vector3 size = payload.Read<Vector3>();
+        dtPolyRef startRef = payload.Read<dtPolyRef>();
+        navi->PathRaycast(start, end, size, &startRef);
+        break;
+    }
+    case TRACE_FIND_RANDOM_POINTS:
+    {
+        const int count = payload.Read<int>();
+        const Vector3 center = payload.Read<Vector3>();
+        const float radius = payload.Read<float>();
+        const int regionId = payload.Read<int>();
+        const int include = payload.Read<int>();
+        const int exclude = payload.Read<int>();
+        const unsigned int seed = (unsigned int)payload.Read<int>();
+        const float minSpacing = payload.Read<float>();
+        const int recorded = payload.Read<int>();
+        // the points are not recorded, the seed draws the same ones again
+        if (payload.failed || recorded < 0 || recorded > count)
+            return false;
+        mPath.resize(count + 1);
+        if (navi->FindRandomPoints(count, center, radius, regionId, include, exclude, seed, minSpacing, &mPath[0]) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_SNAP_HEIGHTS:
+    {
+        const int count = payload.Read<int>();
+        const float minY = payload.Read<float>();
+        const float maxY = payload.Read<float>();
+        if (count < 0 || (unsigned int)count > header.size / (sizeof(float) * 2))
+            return false;
+        mValues.resize(count * 3 + 1);
+        mRefs.resize(count + 1);
+        payload.Read(&mValues[0], count * 2 * (unsigned int)sizeof(float));
+        const int recorded = payload.Read<int>();
+        if (payload.failed)
+            return false;
+        if (navi->SnapHeights(count, &mValues[0], minY, maxY, &mValues[count * 2], &mRefs[0]) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_GET_PATH_DISTANCE:
+    {
+        const Vector3 start = payload.Read<Vector3>();
+        const Vector3 end = payload.Read<Vector3>();
+        const Vector3 size = payload.Read<Vector3>();
+        const float recorded = payload.Read<float>();
+        // distances may drift with the mesh, the unreachable and partial codes may not
+        const float distance = navi->GetPathDistance(start, end, size);
+        if ((distance >= 0 || recorded >= 0) ? (distance >= 0) != (recorded >= 0) : distance != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    case TRACE_GET_PATH_DISTANCES:
+    {
+        const int count = payload.Read<int>();
+        if (count < 0 || (unsigned int)count > header.size / (sizeof(Vector3) * 2))
+            return false;
+        mPath.resize(count * 2 + 1);
+        mValues.resize(count + 1);
+        payload.Read(&mPath[0], count * 2 * (unsigned int)sizeof(Vector3));
+        const int recorded = payload.Read<int>();
+        if (payload.failed)
+            return false;
+        if (navi->GetPathDistances(count, &mPath[0], &mValues[0]) != recorded)
+            ++mResultMismatches;
+        break;
+    }
+    default:
+        return false;
+    }
+    return !payload.failed;
+}
+
+bool Replayer::Replay(const std::vector<unsigned char>& trace, nlohmann::json& report)
+{
+    NaviTraceFileHeader fileHeader;
+    if (trace.size() < sizeof(fileHeader))
+    {
+        fprintf(stderr, "trace is too short\n");
+        return false;
+    }
+    memcpy(&fileHeader, &trace[0], sizeof(fileHeader));
+    if (fileHeader.magic != NAVI_TRACE_MAGIC || fileHeader.version != NAVI_TRACE_VERSION)
+    {
+        fprintf(stderr, "not a trace of version %d\n", NAVI_TRACE_VERSION);
+        return false;
+    }
+
+    // records are appended as calls finish, replay them in the order the calls started
+    typedef std::pair<long long, size_t> RecordIndex;
+    std::vector<RecordIndex> records;
+    size_t pos = sizeof(fileHeader);
+    while (pos + sizeof(NaviTraceRecordHeader) <= trace.size())
+    {
+        NaviTraceRecordHeader header;
+        memcpy(&header, &trace[pos], sizeof(header));
+        if (header.size > trace.size() - pos - sizeof(header))
+        {
+            // the recording process stopped in the middle of a record
+            fprintf(stderr, "trace is truncated after %d records\n", (int)records.size());
+            break;
+        }
+        records.push_back(RecordIndex(header.sequence, pos));
+        pos += sizeof(header) + header.size;
+    }
+    std::stable_sort(records.begin(), records.end());
+
+    const int recordCount = (int)records.size();
+    long long traceEnd = 0;
+    const ReplayClock::time_point begin = ReplayClock::now();
+    for (int i = 0; i < recordCount; ++i)
+    {
+        NaviTraceRecordHeader header;
+        pos = records[i].second;
+        memcpy(&header, &trace[pos], sizeof(header));
+        pos += sizeof(header);
+        PayloadReader payload(header.size ? &trace[pos] : nullptr, header.size);
+        traceEnd = std::max(traceEnd, header.time + (long long)header.duration);
+
+        if (mOptions.timing)
+            std::this_thread::sleep_until(begin + std::chrono::nanoseconds(header.time));
+        const ReplayClock::time_point callBegin = ReplayClock::now();
+        const bool success = header.op < TRACE_OP_COUNT && Run(header, payload);
+        const ReplayClock::time_point callEnd = ReplayClock::now();
+        if (!success)
+        {
+            ++mSkipped;
+            continue;
+        }
+        OpStats& stats = mStats[header.op];
+        stats.recorded.push_back(header.duration);
+        stats.replayed.push_back((long long)std::chrono::duration_cast<std::chrono::nanoseconds>(callEnd - callBegin).count());
+    }
+    const double seconds = std::chrono::duration<double>(ReplayClock::now() - begin).count();
+
+    report["trace"] = mOptions.trace;
+    report["timing"] = mOptions.timing;
+    report["records"] = recordCount;
+    report["skipped"] = mSkipped;
+    report["result_mismatches"] = mResultMismatches;
+    report["trace_seconds"] = traceEnd / 1e9;
+    report["replay_seconds"] = seconds;
+    nlohmann::json ops = nlohmann::json::array();
+    for (int i = 0; i < TRACE_OP_COUNT; ++i)
+    {
+        OpStats& stats = mStats[i];
+        if (stats.replayed.empty())
+            continue;
+        nlohmann::json op;
+        op["name"] = sOpNames[i];
+        op["count"] = stats.replayed.size();
+        OpStats::Summary(stats.recorded, op["recorded"]);
+        OpStats::Summary(stats.replayed, op["replayed"]);
+        ops.push_back(op);
+    }
+    report["ops"] = ops;
+    return true;
+}
+
+static bool ParseOptions(int argc, char* argv[], ReplayOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if (!strcmp(arg, "--timing"))
+        {
+            options.timing = true;
+        }
+        else if (!strcmp(arg, "--path-map") && i + 2 < argc)
+        {
+            options.mapFrom = argv[++i];
+            options.mapTo = argv[++i];
+        }
+        else if (!strcmp(arg, "--out") && i + 1 < argc)
+        {
+            options.out = argv[++i];
+        }
+        else if (arg[0] != '-' && options.trace.empty())
+        {
+            options.trace = arg;
+        }
+        else
+        {
+            fprintf(stderr, "invalid option %s\n", arg);
+            return false;
+        }
+    }
+    if (options.trace.empty())
+    {
+        fprintf(stderr, "usage: RecastJniReplay <trace> [--timing] [--path-map <from> <to>] [--out <file>]\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    ReplayOptions options;
+    if (!ParseOptions(argc, argv, options))
+        return 1;
+
+    std::ifstream read(options.trace.c_str(), std::ios::binary);
+    if (!read.is_open())
+    {
+        fprintf(stderr, "cannot read %s\n", options.trace.c_str());
+        return 1;
+    }
+    std::vector<unsigned char> trace((std::istreambuf_iterator<char>(read)), std::istreambuf_iterator<char>());
+
+    nlohmann::json report;
+    Replayer replayer(options);
+    if (!replayer.Replay(trace, report))
+        return 1;
+
+    const std::string text = report.dump(2);
+    if (options.out.empty())
+    {
+        printf("%s\n", text.c_str());
+    }
+    else
+    {
+        std::ofstream write(options.out.c_str());
+        if (!write.is_open())
+        {
+            fprintf(stderr, "cannot write %s\n", options.out.c_str());
+            return 1;
+        }
+        write << text << "\n";
+    }
+    return 0;
+}
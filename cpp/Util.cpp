@@ -1,4 +1,11 @@
 #include <jni.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "Util.h"
 
 thread_local JNIEnv* tlEnv = nullptr;
@@ -35,48 +42,199 @@ JavaEnvIniter::~JavaEnvIniter()
 		tlEnv = nullptr;
 }
 
-void JniLog(int level, const char* format, ...)
+/////////////////////////////////////////////////////////////////
+// Log ring
+// Bounded lock-free queue of formatted records, pushed by any thread and drained
+// by one. A slot is free for position pos when its sequence is pos and holds the
+// record of pos when its sequence is pos + 1.
+const int LOG_RING_SIZE = 1024;
+const int LOG_RECORD_SIZE = 2048;
+const int LOG_DRAIN_SLEEP_MS = 10;
+const int LOG_STOP_TIMEOUT_MS = 1000;
+
+COMPILE_TEST(LOG_RING_SIZE_POW2, (LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0);
+
+struct LogRecord
 {
-	if (!tlEnv || !format)
-		return;
+	std::atomic<unsigned int> sequence;
+	int level;
+	char text[LOG_RECORD_SIZE];
+};
+
+static LogRecord sLogRing[LOG_RING_SIZE];
+static std::atomic<unsigned int> sLogWritePos(0);
+static unsigned int sLogReadPos = 0;
+static std::atomic<int> sLogDropped(0);
 
-	JNIEnv* env = tlEnv;
+static JavaVM* sJavaVM = nullptr;
+static std::atomic<bool> sLogEnabled(false);
+static std::atomic<bool> sLogRunning(false);
+static std::atomic<bool> sLogDrainDone(true);
+// wakes the drain thread on stop and JniLogStop once the drain is done
+static std::mutex sLogLock;
+static std::condition_variable sLogCond;
+static jclass sLogClass = nullptr;
+static jmethodID sLogMethod = nullptr;
 
-	jclass naviClass = env->FindClass("org/navi/Navi");
-	if (!naviClass || env->ExceptionCheck())
+int JniLogLimiter::Acquire()
+{
+	const long long window = (long long)std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	long long current = mWindow.load(std::memory_order_relaxed);
+	if (current != window && mWindow.compare_exchange_strong(current, window, std::memory_order_relaxed))
+		mCount.store(0, std::memory_order_relaxed);
+	if (mCount.fetch_add(1, std::memory_order_relaxed) >= LOG_SITE_LIMIT)
 	{
-		JniDeleteLocalRef(env, naviClass);
-		JniClearPendingException(env);
-		return;
+		mSuppressed.fetch_add(1, std::memory_order_relaxed);
+		return -1;
 	}
+	return mSuppressed.exchange(0, std::memory_order_relaxed);
+}
 
-	jmethodID methodID = env->GetStaticMethodID(naviClass, "jniLog", "(ILjava/lang/String;)V");
-	if (!methodID || env->ExceptionCheck())
-	{
-		JniDeleteLocalRef(env, naviClass);
-		JniClearPendingException(env);
+void JniLog(int level, int suppressed, const char* format, ...)
+{
+	if (!format || !sLogEnabled.load(std::memory_order_relaxed))
 		return;
+
+	unsigned int pos = sLogWritePos.load(std::memory_order_relaxed);
+	LogRecord* record = nullptr;
+	for (;;)
+	{
+		record = &sLogRing[pos & (LOG_RING_SIZE - 1)];
+		const unsigned int sequence = record->sequence.load(std::memory_order_acquire);
+		const int diff = (int)(sequence - pos);
+		if (diff == 0)
+		{
+			if (sLogWritePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			sLogDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			pos = sLogWritePos.load(std::memory_order_relaxed);
+		}
 	}
 
-	const int bufferSize = 2048;
-	char buffer[bufferSize];
 	va_list vl;
 	va_start(vl, format);
-	vsnprintf(buffer, bufferSize, format, vl);
+	int length = vsnprintf(record->text, LOG_RECORD_SIZE, format, vl);
 	va_end(vl);
+	if (length < 0)
+		length = 0;
+	if (suppressed > 0 && length < LOG_RECORD_SIZE)
+		snprintf(record->text + length, LOG_RECORD_SIZE - length, " (%d similar suppressed)", suppressed);
+	record->level = level;
+	record->sequence.store(pos + 1, std::memory_order_release);
+}
 
-	jstring message = env->NewStringUTF(buffer);
+static void CallJniLog(JNIEnv* env, int level, const char* text)
+{
+	jstring message = env->NewStringUTF(text);
 	if (!message || env->ExceptionCheck())
 	{
 		JniDeleteLocalRef(env, message);
-		JniDeleteLocalRef(env, naviClass);
 		JniClearPendingException(env);
 		return;
 	}
-
-	env->CallStaticVoidMethod(naviClass, methodID, level, message);
-
+	env->CallStaticVoidMethod(sLogClass, sLogMethod, level, message);
 	JniDeleteLocalRef(env, message);
-	JniDeleteLocalRef(env, naviClass);
 	JniClearPendingException(env);
-}
\ No newline at end of file
+}
+
+// Passes the pending records to Java, returns how many.
+static int DrainLogRing(JNIEnv* env)
+{
+	int count = 0;
+	for (;;)
+	{
+		LogRecord& record = sLogRing[sLogReadPos & (LOG_RING_SIZE - 1)];
+		if ((int)(record.sequence.load(std::memory_order_acquire) - (sLogReadPos + 1)) < 0)
+			break;
+		CallJniLog(env, record.level, record.text);
+		record.sequence.store(sLogReadPos + LOG_RING_SIZE, std::memory_order_release);
+		++sLogReadPos;
+		++count;
+	}
+
+	const int dropped = sLogDropped.exchange(0, std::memory_order_relaxed);
+	if (dropped > 0)
+	{
+		char text[64];
+		snprintf(text, sizeof(text), "log ring full, %d records dropped", dropped);
+		CallJniLog(env, 1, text);
+	}
+	return count;
+}
+
+static void SetLogDrainDone()
+{
+	{
+		std::lock_guard<std::mutex> guard(sLogLock);
+		sLogDrainDone.store(true);
+	}
+	sLogCond.notify_all();
+}
+
+static void LogDrainThread()
+{
+	JNIEnv* env = nullptr;
+	if (sJavaVM->AttachCurrentThreadAsDaemon((void**)&env, nullptr) != JNI_OK || !env)
+	{
+		sLogEnabled.store(false);
+		SetLogDrainDone();
+		return;
+	}
+	while (sLogRunning.load(std::memory_order_relaxed))
+	{
+		if (DrainLogRing(env) != 0)
+			continue;
+		std::unique_lock<std::mutex> guard(sLogLock);
+		sLogCond.wait_for(guard, std::chrono::milliseconds(LOG_DRAIN_SLEEP_MS), [] { return !sLogRunning.load(); });
+	}
+	DrainLogRing(env);
+	sJavaVM->DetachCurrentThread();
+	SetLogDrainDone();
+}
+
+bool JniLogStart(void* vm, void* envPtr, void* logClass)
+{
+	JNIEnv* env = (JNIEnv*)envPtr;
+	if (!vm || !env || !logClass || sLogRunning.load() || !sLogDrainDone.load())
+		return false;
+
+	sLogMethod = env->GetStaticMethodID((jclass)logClass, "jniLog", "(ILjava/lang/String;)V");
+	if (!sLogMethod || env->ExceptionCheck())
+	{
+		JniClearPendingException(env);
+		return false;
+	}
+	sLogClass = (jclass)logClass;
+
+	for (int i = 0; i < LOG_RING_SIZE; ++i)
+		sLogRing[i].sequence.store((unsigned int)i, std::memory_order_relaxed);
+	sLogWritePos.store(0, std::memory_order_relaxed);
+	sLogReadPos = 0;
+	sJavaVM = (JavaVM*)vm;
+	sLogRunning.store(true);
+	sLogDrainDone.store(false);
+	sLogEnabled.store(true);
+	// Detached, a joinable std::thread left at exit would terminate the process.
+	std::thread(LogDrainThread).detach();
+	return true;
+}
+
+void JniLogStop()
+{
+	if (!sLogRunning.exchange(false))
+		return;
+	sLogEnabled.store(false);
+	// the drain thread is detached, wait for its last drain instead of a join,
+	// bounded in case a Java logger blocks
+	std::unique_lock<std::mutex> guard(sLogLock);
+	sLogCond.notify_all();
+	sLogCond.wait_for(guard, std::chrono::milliseconds(LOG_STOP_TIMEOUT_MS), [] { return sLogDrainDone.load(); });
+}
@@ -1,16 +1,48 @@
 #pragma once
 
-extern void JniLog(int level, const char* format, ...);
+#include <atomic>
+
+// Rate limit of one LOG_* call site, at most LOG_SITE_LIMIT records a second.
+const int LOG_SITE_LIMIT = 10;
+
+class JniLogLimiter
+{
+	std::atomic<long long> mWindow;
+	std::atomic<int> mCount;
+	std::atomic<int> mSuppressed;
+
+public:
+	JniLogLimiter()
+	:mWindow(0)
+	,mCount(0)
+	,mSuppressed(0)
+	{}
+
+	// Records suppressed since the last one let through, -1 to drop this one.
+	int Acquire();
+};
+
+// Formats the record into the log ring, the drain thread passes it to
+// Navi.jniLog. Never blocks, records are dropped while the ring is full or
+// when the library was not loaded by a JVM.
+extern void JniLog(int level, int suppressed, const char* format, ...);
+#define JNI_LOG(level, format, ...) {static JniLogLimiter __limiter__; const int __suppressed__ = __limiter__.Acquire(); if (__suppressed__ >= 0) JniLog(level, __suppressed__, format, ## __VA_ARGS__);}
 #ifdef _WIN32
-#define LOG_INFO(format, ...) {printf(format"\n", ## __VA_ARGS__); JniLog(0, format, ## __VA_ARGS__);}
-#define LOG_WARN(format, ...) {printf(format"\n", ## __VA_ARGS__); JniLog(1, format, ## __VA_ARGS__);}
-#define LOG_ERROR(format, ...) {printf(format"\n", ## __VA_ARGS__); JniLog(2, format, ## __VA_ARGS__);}
+#define JNI_LOG_PRINT(level, format, ...) {static JniLogLimiter __limiter__; const int __suppressed__ = __limiter__.Acquire(); if (__suppressed__ >= 0) {printf(format"\n", ## __VA_ARGS__); JniLog(level, __suppressed__, format, ## __VA_ARGS__);}}
+#define LOG_INFO(format, ...) JNI_LOG_PRINT(0, format, ## __VA_ARGS__)
+#define LOG_WARN(format, ...) JNI_LOG_PRINT(1, format, ## __VA_ARGS__)
+#define LOG_ERROR(format, ...) JNI_LOG_PRINT(2, format, ## __VA_ARGS__)
 #else
-#define LOG_INFO(format, ...) {JniLog(0, format, ## __VA_ARGS__);}
-#define LOG_WARN(format, ...) {JniLog(1, format, ## __VA_ARGS__);}
-#define LOG_ERROR(format, ...) {JniLog(2, format, ## __VA_ARGS__);}
+#define LOG_INFO(format, ...) JNI_LOG(0, format, ## __VA_ARGS__)
+#define LOG_WARN(format, ...) JNI_LOG(1, format, ## __VA_ARGS__)
+#define LOG_ERROR(format, ...) JNI_LOG(2, format, ## __VA_ARGS__)
 #endif
 
+// Started from JNI_OnLoad with a global ref of the class receiving the records
+// through its static jniLog(int, String), and stopped from JNI_OnUnload.
+bool JniLogStart(void* vm, void* env, void* logClass);
+void JniLogStop();
+
 #ifndef COMPILE_TEST
 #define COMPILE_TEST(Name, Check) int __COMPILE_TEST_##Name##__[(Check) ? 1 : -1];
 #endif
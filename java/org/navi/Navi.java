@@ -56,6 +56,7 @@ public class Navi {
     }
 
     // level:0-debug 1-warning 2-error
+    // called from the native log thread, records reach it with a short delay
     public static void jniLog(int level, String message) {
          switch (level) {
              case 0:
@@ -74,6 +75,121 @@ public class Navi {
     public static final int SUCCESS = 1 << 30; // Operation succeed.
     public static final int MAX_QUERY_INIT_NODE = 65535;
     public static final int MAX_SEARCH_POLYS = 1024;
+    // getPathDistance results that are no distance: end is not reachable, or
+    // the search limits cut the corridor before it got to end
+    public static final float PATH_DISTANCE_UNREACHABLE = -1.0f;
+    public static final float PATH_DISTANCE_PARTIAL = -2.0f;
+
+    // index of getTileAllocStats result
+    public static final int TILE_ALLOC_CAPACITY = 0;
+    public static final int TILE_ALLOC_USED = 1;
+    public static final int TILE_ALLOC_HIGH = 2;
+    public static final int TILE_ALLOC_GROW_COUNT = 3;
+    public static final int TILE_ALLOC_STAT_COUNT = 4;
+
+    // index of getPathStats result, the last findPath call first (on any
+    // thread of a thread-safe navi), then the totals since resetPathStats at
+    // PATH_STAT_COUNT + index
+    public static final int PATH_STAT_QUERIES = 0;
+    public static final int PATH_STAT_NODES_EXPANDED = 1;
+    public static final int PATH_STAT_NODE_POOL_HIGH = 2;
+    public static final int PATH_STAT_CORRIDOR_LENGTH = 3;
+    public static final int PATH_STAT_STRAIGHTEN_RAYCASTS = 4;
+    public static final int PATH_STAT_OUT_OF_BLOCK_NEAREST = 5;
+    public static final int PATH_STAT_LOCATE_NS = 6;
+    public static final int PATH_STAT_SEARCH_NS = 7;
+    public static final int PATH_STAT_STRAIGHT_PATH_NS = 8;
+    public static final int PATH_STAT_STRAIGHTEN_NS = 9;
+    public static final int PATH_STAT_OUT_OF_BLOCK_NS = 10;
+    public static final int PATH_STAT_TOTAL_NS = 11;
+    public static final int PATH_STAT_NODE_POOL_RETRIES = 12;
+    public static final int PATH_STAT_COUNT = 13;
+
+    // lane of the updateCrowd state, lane * getCrowdMaxAgents() + agent index,
+    // slots without an agent are 0
+    public static final int CROWD_LANE_POS_X = 0;
+    public static final int CROWD_LANE_POS_Y = 1;
+    public static final int CROWD_LANE_POS_Z = 2;
+    public static final int CROWD_LANE_VEL_X = 3;
+    public static final int CROWD_LANE_VEL_Y = 4;
+    public static final int CROWD_LANE_VEL_Z = 5;
+    public static final int CROWD_LANE_STATE = 6;
+    public static final int CROWD_LANE_COUNT = 7;
+
+    // native of snapshotLatency, each has LATENCY_STRIDE longs in the result:
+    // count, total ns, max ns, then LATENCY_BUCKET_COUNT bucket counts
+    public static final int NATIVE_GET_MAX_POS_SIZE = 0;
+    public static final int NATIVE_CREATE = 1;
+    public static final int NATIVE_DESTROY = 2;
+    public static final int NATIVE_SET_DEFAULT_POLY_SIZE = 3;
+    public static final int NATIVE_LOAD_MESH = 4;
+    public static final int NATIVE_LOAD_DOORS = 5;
+    public static final int NATIVE_LOAD_REGIONS = 6;
+    public static final int NATIVE_GET_REGION_ID = 7;
+    public static final int NATIVE_INIT_DOORS_POLY = 8;
+    public static final int NATIVE_IS_DOOR_EXIST = 9;
+    public static final int NATIVE_IS_DOOR_OPEN = 10;
+    public static final int NATIVE_OPEN_DOOR = 11;
+    public static final int NATIVE_OPEN_ALL_DOORS = 12;
+    public static final int NATIVE_CLOSE_ALL_DOORS_POLY = 13;
+    public static final int NATIVE_RECOVER_ALL_DOORS_POLY = 14;
+    public static final int NATIVE_BUILD_DOOR_GRAPH = 15;
+    public static final int NATIVE_SET_DOOR_GRAPH_PATH = 16;
+    public static final int NATIVE_BUILD_LANDMARKS = 17;
+    public static final int NATIVE_SET_LANDMARK_PATH = 18;
+    public static final int NATIVE_ADD_OBSTACLE = 19;
+    public static final int NATIVE_REMOVE_OBSTACLE = 20;
+    public static final int NATIVE_REFRESH_OBSTACLE = 21;
+    public static final int NATIVE_GET_MAX_OBSTACLE_REQ_COUNT = 22;
+    public static final int NATIVE_GET_ADDED_OBSTACLE_REQ_COUNT = 23;
+    public static final int NATIVE_GET_OBSTACLE_REQ_REMAIN_COUNT = 24;
+    public static final int NATIVE_SET_TILE_ALLOC_CAPACITY = 25;
+    public static final int NATIVE_GET_TILE_ALLOC_STATS = 26;
+    public static final int NATIVE_GET_PATH_STATS = 27;
+    public static final int NATIVE_RESET_PATH_STATS = 28;
+    public static final int NATIVE_GET_MEMORY_USAGE = 29;
+    public static final int NATIVE_GET_TOTAL_MEMORY_USAGE = 30;
+    public static final int NATIVE_START_TRACE = 31;
+    public static final int NATIVE_STOP_TRACE = 32;
+    public static final int NATIVE_SET_PATH_CACHE_SIZE = 33;
+    public static final int NATIVE_CLEAR_PATH_CACHE = 34;
+    public static final int NATIVE_FIND_PATH = 35;
+    public static final int NATIVE_FIND_PATH_DEFAULT = 36;
+    public static final int NATIVE_MAKE_PATH_STRAIGHT = 37;
+    public static final int NATIVE_MAKE_PATH_STRAIGHT_DEFAULT = 38;
+    public static final int NATIVE_PATH_RAYCAST = 39;
+    public static final int NATIVE_PATH_RAYCAST_DEFAULT = 40;
+    public static final int NATIVE_CAN_PATH_FORWARD = 41;
+    public static final int NATIVE_CAN_PATH_FORWARD_DEFAULT = 42;
+    public static final int NATIVE_SNAPSHOT_LATENCY = 43;
+    public static final int NATIVE_INIT_CROWD = 44;
+    public static final int NATIVE_GET_CROWD_MAX_AGENTS = 45;
+    public static final int NATIVE_ADD_CROWD_AGENT = 46;
+    public static final int NATIVE_REMOVE_CROWD_AGENT = 47;
+    public static final int NATIVE_SET_CROWD_TARGET = 48;
+    public static final int NATIVE_UPDATE_CROWD = 49;
+    public static final int NATIVE_MOVE_ALONG_SURFACE = 50;
+    public static final int NATIVE_BUILD_FLOW_FIELD = 51;
+    public static final int NATIVE_SAMPLE_FLOW_FIELD = 52;
+    public static final int NATIVE_FIND_NEAREST_GOAL_PATH = 53;
+    public static final int NATIVE_FIND_REACHABLE_POLYS = 54;
+    public static final int NATIVE_BATCH_RAYCAST = 55;
+    public static final int NATIVE_FIND_PATH_HINT = 56;
+    public static final int NATIVE_MAKE_PATH_STRAIGHT_HINT = 57;
+    public static final int NATIVE_PATH_RAYCAST_HINT = 58;
+    public static final int NATIVE_FIND_RANDOM_POINTS = 59;
+    public static final int NATIVE_SNAP_HEIGHTS = 60;
+    public static final int NATIVE_GET_PATH_DISTANCE = 61;
+    public static final int NATIVE_GET_PATH_DISTANCES = 62;
+    public static final int NATIVE_SET_NODE_STATS = 63;
+    public static final int NATIVE_CALL_COUNT = 64;
+    public static final int LATENCY_COUNT = 0;
+    public static final int LATENCY_TOTAL_NS = 1;
+    public static final int LATENCY_MAX_NS = 2;
+    public static final int LATENCY_BUCKETS = 3;
+    public static final int LATENCY_SUB_BUCKET_BITS = 3;
+    public static final int LATENCY_BUCKET_COUNT = 304;
+    public static final int LATENCY_STRIDE = LATENCY_BUCKETS + LATENCY_BUCKET_COUNT;
 
     private static final Map<Long, Long> createdNavis = new ConcurrentHashMap<>();
     public static final Map<Long, Long> getCreatedNavis() {
@@ -88,15 +204,44 @@ public class Navi {
         return (status & SUCCESS) != 0;
     }
 
+    // natives are registered by JNI_OnLoad in NaviExport.cpp, a native added here
+    // also needs its entry in sNaviNatives or loading the library fails
     private static native int getMaxPosSizeNative();
 
-    private long naviPtr = 0;
+    private volatile long naviPtr = 0;
     private int bindCount = 0;
     private Thread activeThread = null;
-    private float[] posArray = new float[MAX_SEARCH_POLYS * 3];
-    private int[] posSize = new int[1];
+    // thread-safe navis skip the binding below, each thread gets its own
+    // result arrays and the native side serializes the mutations
+    private final boolean threadSafe;
+    private final float[] posArray;
+    private final int[] posSize;
+    private final ThreadLocal<float[]> threadPosArray;
+    private final ThreadLocal<int[]> threadPosSize;
+
+    private float[] currentPosArray() {
+        return threadSafe ? threadPosArray.get() : posArray;
+    }
+
+    private int[] currentPosSize() {
+        return threadSafe ? threadPosSize.get() : posSize;
+    }
+
+    private void bindCurrentThread() {
+        if (threadSafe) {
+            return;
+        }
+        bindOwnerThread();
+    }
 
-    private synchronized void bindCurrentThread() {
+    private void releaseCurrentThread() {
+        if (threadSafe) {
+            return;
+        }
+        releaseOwnerThread();
+    }
+
+    private synchronized void bindOwnerThread() {
         Thread current = Thread.currentThread();
         if (bindCount == 0) {
             activeThread = current;
@@ -106,7 +251,7 @@ public class Navi {
         ++bindCount;
     }
 
-    private synchronized void releaseCurrentThread() {
+    private synchronized void releaseOwnerThread() {
         if (bindCount <= 0) {
             return;
         }
@@ -125,30 +270,54 @@ public class Navi {
     public int getPosSize() {
         bindCurrentThread();
         try {
-            return posSize[0];
+            return currentPosSize()[0];
         } finally {
             releaseCurrentThread();
         }
     }
 
-    // 3 float(x, y, z) = 1 pos
+    // 3 float(x, y, z) = 1 pos, the result of the last findPath of this thread
+    // on a thread-safe navi
     public float[] getPosArray() {
         bindCurrentThread();
         try {
-            return posArray;
+            return currentPosArray();
         } finally {
             releaseCurrentThread();
         }
     }
 
     public Navi() {
-        create(MAX_SEARCH_POLYS, 0);
+        this(MAX_SEARCH_POLYS, 0, false);
     }
 
     public Navi(int maxPoly, int maxObstacle) {
+        this(maxPoly, maxObstacle, false);
+    }
+
+    // A thread-safe navi can be queried from many threads at once, queries run
+    // in parallel and mutations wait for them. destroy must still not overlap
+    // any other call.
+    public Navi(int maxPoly, int maxObstacle, boolean threadSafe) {
+        this.threadSafe = threadSafe;
+        if (threadSafe) {
+            posArray = null;
+            posSize = null;
+            threadPosArray = ThreadLocal.withInitial(() -> new float[MAX_SEARCH_POLYS * 3]);
+            threadPosSize = ThreadLocal.withInitial(() -> new int[1]);
+        } else {
+            posArray = new float[MAX_SEARCH_POLYS * 3];
+            posSize = new int[1];
+            threadPosArray = null;
+            threadPosSize = null;
+        }
         create(maxPoly, maxObstacle);
     }
 
+    public boolean isThreadSafe() {
+        return threadSafe;
+    }
+
     public boolean isCreated() {
         bindCurrentThread();
         try {
@@ -158,7 +327,7 @@ public class Navi {
         }
     }
 
-    private native long createNative(int maxPoly, int maxObstacle);
+    private native long createNative(int maxPoly, int maxObstacle, boolean threadSafe);
     private void create(int maxPoly, int maxObstacle) {
         if (naviPtr != 0) {
             log.info("Create navi twice, ptr = {}", naviPtr);
@@ -166,7 +335,7 @@ public class Navi {
         }
         bindCurrentThread();
         try {
-            naviPtr = createNative(maxPoly, maxObstacle);
+            naviPtr = createNative(maxPoly, maxObstacle, threadSafe);
             if (naviPtr != 0) {
                 createdNavis.put(naviPtr, System.currentTimeMillis());
                 log.info("Create navi result = {}", naviPtr);
@@ -372,6 +541,69 @@ public class Navi {
         }
     }
         
+    private native boolean buildDoorGraphNative(long ptr);
+    // precompute door to door costs, call after loadDoors and again after
+    // obstacles or a reload change the mesh, a stale graph is not used.
+    // Legs follow the path filter with doors passable
+    public boolean buildDoorGraph() {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("buildDoorGraph but navi is null");
+                return false;
+            }
+            return buildDoorGraphNative(naviPtr);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native void setDoorGraphPathNative(long ptr, boolean enable);
+    // plan paths crossing provinces over the door graph, needs buildDoorGraph
+    public void setDoorGraphPath(boolean enable) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("setDoorGraphPath but navi is null");
+                return;
+            }
+            setDoorGraphPathNative(naviPtr, enable);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+        
+    private native boolean buildLandmarksNative(long ptr, int count);
+    // precompute the ALT landmark table, rebuild after refreshObstacle or a
+    // path filter change
+    public boolean buildLandmarks(int count) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("buildLandmarks but navi is null");
+                return false;
+            }
+            return buildLandmarksNative(naviPtr, count);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native void setLandmarkPathNative(long ptr, boolean enable);
+    // search paths with the landmark heuristic, needs buildLandmarks
+    public void setLandmarkPath(boolean enable) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("setLandmarkPath but navi is null");
+                return;
+            }
+            setLandmarkPathNative(naviPtr, enable);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+        
     private native int addObstacleNative(long ptr,
          float posX, float posY, float posZ,
          float radius, float height);
@@ -472,6 +704,186 @@ public class Navi {
         }
     }
 
+    private native void setTileAllocCapacityNative(long ptr, int capacity);
+    // call before loadMesh to preset the tile rebuild buffer of this map
+    public void setTileAllocCapacity(int capacity) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("setTileAllocCapacity but navi is null");
+                return;
+            }
+            setTileAllocCapacityNative(naviPtr, capacity);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int getTileAllocStatsNative(long ptr, long[] statArray, int arraySize);
+    public long[] getTileAllocStats() {
+        bindCurrentThread();
+        try {
+            long[] stats = new long[TILE_ALLOC_STAT_COUNT];
+            if (naviPtr == 0) {
+                log.error("getTileAllocStats but navi is null");
+                return stats;
+            }
+            getTileAllocStatsNative(naviPtr, stats, stats.length);
+            return stats;
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int getPathStatsNative(long ptr, long[] statArray, int arraySize);
+    public long[] getPathStats() {
+        bindCurrentThread();
+        try {
+            long[] stats = new long[PATH_STAT_COUNT * 2];
+            if (naviPtr == 0) {
+                log.error("getPathStats but navi is null");
+                return stats;
+            }
+            getPathStatsNative(naviPtr, stats, stats.length);
+            return stats;
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native void resetPathStatsNative(long ptr);
+    public void resetPathStats() {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("resetPathStats but navi is null");
+                return;
+            }
+            resetPathStatsNative(naviPtr);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native void setNodeStatsNative(long ptr, boolean enable);
+    // count PATH_STAT_NODES_EXPANDED, off by default as it costs a walk of the
+    // node pool after every search
+    public void setNodeStats(boolean enable) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("setNodeStats but navi is null");
+                return;
+            }
+            setNodeStatsNative(naviPtr, enable);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native long getMemoryUsageNative(long ptr);
+    // bytes held by the native navmesh, tile cache and query of this navi
+    public long getMemoryUsage() {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("getMemoryUsage but navi is null");
+                return 0;
+            }
+            return getMemoryUsageNative(naviPtr);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private static native long getTotalMemoryUsageNative();
+    // bytes held by all navis
+    public static long getTotalMemoryUsage() {
+        return getTotalMemoryUsageNative();
+    }
+
+    private static native boolean startTraceNative(String filePath);
+    // record the native calls of all navis to a binary trace for RecastJniReplay,
+    // start it before creating the navis to replay
+    public static boolean startTrace(String filePath) {
+        return startTraceNative(filePath);
+    }
+
+    private static native void stopTraceNative();
+    public static void stopTrace() {
+        stopTraceNative();
+    }
+
+    private static native int snapshotLatencyNative(long[] latencyArray, int arraySize);
+    // native side latency histograms of every native since the last snapshot,
+    // NATIVE_CALL_COUNT * LATENCY_STRIDE longs, the histograms are reset
+    public static long[] snapshotLatency() {
+        long[] latency = new long[NATIVE_CALL_COUNT * LATENCY_STRIDE];
+        snapshotLatencyNative(latency, latency.length);
+        return latency;
+    }
+
+    // smallest ns counted in a latency bucket
+    public static long getLatencyBucketLow(int bucket) {
+        int subBuckets = 1 << LATENCY_SUB_BUCKET_BITS;
+        if (bucket < subBuckets) {
+            return Math.max(bucket, 0);
+        }
+        int exponent = bucket / subBuckets + LATENCY_SUB_BUCKET_BITS - 1;
+        long sub = bucket % subBuckets;
+        return (subBuckets + sub) << (exponent - LATENCY_SUB_BUCKET_BITS);
+    }
+
+    // ns under which percentile (0..100) of the calls of native in a snapshot
+    // finished, the upper end of the bucket capped at the max
+    public static long getLatencyPercentile(long[] latency, int nativeCall, double percentile) {
+        int base = nativeCall * LATENCY_STRIDE;
+        long count = latency[base + LATENCY_COUNT];
+        if (count == 0) {
+            return 0;
+        }
+        long rank = Math.max(1, (long) Math.ceil(count * percentile / 100.0));
+        long seen = 0;
+        for (int i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+            seen += latency[base + LATENCY_BUCKETS + i];
+            if (seen >= rank) {
+                long high = i + 1 < LATENCY_BUCKET_COUNT ? getLatencyBucketLow(i + 1) - 1 : Long.MAX_VALUE;
+                return Math.min(high, latency[base + LATENCY_MAX_NS]);
+            }
+        }
+        return latency[base + LATENCY_MAX_NS];
+    }
+
+    private native void setPathCacheSizeNative(long ptr, int size);
+    // cache the corridors of the last size findPath queries, 0 disables the cache.
+    // Queries reusing a corridor may get a longer path than a fresh search.
+    public void setPathCacheSize(int size) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("setPathCacheSize but navi is null");
+                return;
+            }
+            setPathCacheSizeNative(naviPtr, size);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native void clearPathCacheNative(long ptr);
+    public void clearPathCache() {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("clearPathCache but navi is null");
+                return;
+            }
+            clearPathCacheNative(naviPtr);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
     private native int findPathNative(long ptr, float[] posArray, int arraySize, int[] posSize,
          float startX, float startY, float startZ,
          float endX, float endY, float endZ,
@@ -485,7 +897,7 @@ public class Navi {
                 log.error("findPath but navi is null");
                 return FAILURE;
             }
-            return findPathNative(naviPtr, posArray, MAX_SEARCH_POLYS, posSize, startX, startY, startZ,
+            return findPathNative(naviPtr, currentPosArray(), MAX_SEARCH_POLYS, currentPosSize(), startX, startY, startZ,
                 endX, endY, endZ, sizeX, sizeY, sizeZ);
         } finally {
             releaseCurrentThread();
@@ -503,13 +915,41 @@ public class Navi {
                 log.error("findPath default but navi is null");
                 return FAILURE;
             }
-            return findPathDefaultNative(naviPtr, posArray, MAX_SEARCH_POLYS, posSize, startX, startY, startZ,
+            return findPathDefaultNative(naviPtr, currentPosArray(), MAX_SEARCH_POLYS, currentPosSize(), startX, startY, startZ,
                 endX, endY, endZ);
         } finally {
             releaseCurrentThread();
         }
     }
 
+    private native int findPathHintNative(long ptr, float[] posArray, int arraySize, int[] posSize, long[] refArray,
+         float startX, float startY, float startZ,
+         float endX, float endY, float endZ,
+         float sizeX, float sizeY, float sizeZ);
+    // refs holds the start and end poly hints, usually the refs of the
+    // previous call, and gets the polys start and end were found in. 0 or a
+    // poly not holding the point within sizeY of its height falls back to the
+    // nearest poly.
+    public int findPath(long[] refs, float startX, float startY, float startZ,
+         float endX, float endY, float endZ,
+         float sizeX, float sizeY, float sizeZ) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("findPath hint but navi is null");
+                return FAILURE;
+            }
+            if (refs.length < 2) {
+                log.error("findPath hint refs are shorter than 2");
+                return FAILURE;
+            }
+            return findPathHintNative(naviPtr, currentPosArray(), MAX_SEARCH_POLYS, currentPosSize(), refs,
+                startX, startY, startZ, endX, endY, endZ, sizeX, sizeY, sizeZ);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
     private native int makePathStraightNative(long ptr, float[] posArray, int arraySize,
          float sizeX, float sizeY, float sizeZ);
     public int makePathStraight(float[] posArray, int arraySize, float sizeX, float sizeY, float sizeZ) {
@@ -539,6 +979,23 @@ public class Navi {
         }
     }
 
+    private native int makePathStraightHintNative(long ptr, float[] posArray, int arraySize, long startRef,
+         float sizeX, float sizeY, float sizeZ);
+    // startRef is a hint for the poly of the first point like findPath.
+    // Paths longer than maxPoly points are returned unchanged.
+    public int makePathStraight(float[] posArray, int arraySize, long startRef, float sizeX, float sizeY, float sizeZ) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("makePathStraight hint but navi is null");
+                return arraySize;
+            }
+            return makePathStraightHintNative(naviPtr, posArray, arraySize, startRef, sizeX, sizeY, sizeZ);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
     private native float pathRaycastNative(long ptr,
          float startX, float startY, float startZ,
          float endX, float endY, float endZ,
@@ -559,6 +1016,32 @@ public class Navi {
         }
     }
 
+    private native float pathRaycastHintNative(long ptr, long[] refArray,
+         float startX, float startY, float startZ,
+         float endX, float endY, float endZ,
+         float sizeX, float sizeY, float sizeZ);
+    // refs[0] holds a hint for the poly of start like findPath and gets the
+    // poly the ray started from
+    public float pathRaycast(long[] refs, float startX, float startY, float startZ,
+         float endX, float endY, float endZ,
+         float sizeX, float sizeY, float sizeZ) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("pathRaycast hint but navi is null");
+                return -1.0f;
+            }
+            if (refs.length < 1) {
+                log.error("pathRaycast hint refs are empty");
+                return -1.0f;
+            }
+            return pathRaycastHintNative(naviPtr, refs, startX, startY, startZ,
+                endX, endY, endZ, sizeX, sizeY, sizeZ);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
     private native float pathRaycastDefaultNative(long ptr,
          float startX, float startY, float startZ,
          float endX, float endY, float endZ);
@@ -614,4 +1097,322 @@ public class Navi {
             releaseCurrentThread();
         }
     }
-}
\ No newline at end of file
+
+    private native boolean initCrowdNative(long ptr, int maxAgents, float maxAgentRadius);
+    // crowd simulation on the loaded mesh, loadMesh drops it so init again after loading
+    public boolean initCrowd(int maxAgents, float maxAgentRadius) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("initCrowd but navi is null");
+                return false;
+            }
+            return initCrowdNative(naviPtr, maxAgents, maxAgentRadius);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int getCrowdMaxAgentsNative(long ptr);
+    public int getCrowdMaxAgents() {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("getCrowdMaxAgents but navi is null");
+                return 0;
+            }
+            return getCrowdMaxAgentsNative(naviPtr);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int addCrowdAgentNative(long ptr, float posX, float posY, float posZ,
+         float radius, float height, float maxSpeed, float maxAcceleration);
+    // agent index, -1 if the crowd is full or the position is off the mesh
+    public int addCrowdAgent(float posX, float posY, float posZ,
+         float radius, float height, float maxSpeed, float maxAcceleration) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("addCrowdAgent but navi is null");
+                return -1;
+            }
+            return addCrowdAgentNative(naviPtr, posX, posY, posZ, radius, height, maxSpeed, maxAcceleration);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native boolean removeCrowdAgentNative(long ptr, int idx);
+    public boolean removeCrowdAgent(int idx) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("removeCrowdAgent but navi is null");
+                return false;
+            }
+            return removeCrowdAgentNative(naviPtr, idx);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native boolean setCrowdTargetNative(long ptr, int idx, float targetX, float targetY, float targetZ);
+    public boolean setCrowdTarget(int idx, float targetX, float targetY, float targetZ) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("setCrowdTarget but navi is null");
+                return false;
+            }
+            return setCrowdTargetNative(naviPtr, idx, targetX, targetY, targetZ);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int updateCrowdNative(long ptr, float dt, float[] stateArray, int arraySize);
+    // step the crowd by dt seconds, state gets CROWD_LANE_COUNT * getCrowdMaxAgents()
+    // floats or as many as fit. Returns the active agents.
+    public int updateCrowd(float dt, float[] state) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("updateCrowd but navi is null");
+                return 0;
+            }
+            return updateCrowdNative(naviPtr, dt, state, state == null ? 0 : state.length);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int moveAlongSurfaceNative(long ptr, int count, long[] refArray,
+         float[] fromArray, float[] toArray, float[] resultArray);
+    // move count agents along the surface in one call, from, to and result hold
+    // x, y, z per agent. refs holds the poly of each from as hint, 0 if unknown,
+    // a hint on another floor is ignored, and gets the poly of the result,
+    // keep it for the next call. Agents off
+    // the mesh keep their from with ref 0. Returns the moved agents.
+    public int moveAlongSurface(int count, long[] refs, float[] from, float[] to, float[] result) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("moveAlongSurface but navi is null");
+                return 0;
+            }
+            if (refs.length < count || from.length < count * 3 || to.length < count * 3 || result.length < count * 3) {
+                log.error("moveAlongSurface arrays are shorter than count {}", count);
+                return 0;
+            }
+            return moveAlongSurfaceNative(naviPtr, count, refs, from, to, result);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int buildFlowFieldNative(long ptr, float goalX, float goalY, float goalZ, float maxCost);
+    // flow field towards the goal over the polys within maxCost, 0 if the goal
+    // is off the mesh. Requesting the same goal position again returns the
+    // cached field until doors, obstacles or filters change, then a new id.
+    public int buildFlowField(float goalX, float goalY, float goalZ, float maxCost) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("buildFlowField but navi is null");
+                return 0;
+            }
+            return buildFlowFieldNative(naviPtr, goalX, goalY, goalZ, maxCost);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int sampleFlowFieldNative(long ptr, int fieldId, int count, long[] refArray,
+         float[] posArray, float[] dirArray, float[] costArray);
+    // unit direction towards the goal and the remaining cost of count agents,
+    // 0 and -1 outside the field. refs are poly hints like moveAlongSurface.
+    // Returns the agents inside the field, -1 if it is stale and has to be
+    // built again.
+    public int sampleFlowField(int fieldId, int count, long[] refs, float[] pos, float[] dirs, float[] costs) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("sampleFlowField but navi is null");
+                return -1;
+            }
+            if (refs.length < count || pos.length < count * 3 || dirs.length < count * 3 || costs.length < count) {
+                log.error("sampleFlowField arrays are shorter than count {}", count);
+                return 0;
+            }
+            return sampleFlowFieldNative(naviPtr, fieldId, count, refs, pos, dirs, costs);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int findNearestGoalPathNative(long ptr, float[] posArray, int arraySize, int[] posSize,
+         float startX, float startY, float startZ, int goalCount, float[] goalArray);
+    // path to the goal reached at the lowest cost of goalCount goals, x y z
+    // each, searching once from start. Returns the goal index, -1 if none is
+    // reachable. The path is read like the one of findPath.
+    public int findNearestGoalPath(float startX, float startY, float startZ, int goalCount, float[] goals) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("findNearestGoalPath but navi is null");
+                return -1;
+            }
+            if (goals.length < goalCount * 3) {
+                log.error("findNearestGoalPath goals are shorter than count {}", goalCount);
+                return -1;
+            }
+            return findNearestGoalPathNative(naviPtr, currentPosArray(), MAX_SEARCH_POLYS, currentPosSize(),
+                startX, startY, startZ, goalCount, goals);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int findReachablePolysNative(long ptr, float startX, float startY, float startZ, float maxCost,
+         int maxCount, long[] refArray, float[] costArray, float[] centerArray);
+    // polys reachable from start within maxCost, cheapest first and at most
+    // maxCount of them, with their cost and, when centers is not null, their
+    // center x y z. Returns the polys found.
+    public int findReachablePolys(float startX, float startY, float startZ, float maxCost,
+         int maxCount, long[] refs, float[] costs, float[] centers) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("findReachablePolys but navi is null");
+                return 0;
+            }
+            if (refs.length < maxCount || costs.length < maxCount || (centers != null && centers.length < maxCount * 3)) {
+                log.error("findReachablePolys arrays are shorter than count {}", maxCount);
+                return 0;
+            }
+            return findReachablePolysNative(naviPtr, startX, startY, startZ, maxCost, maxCount, refs, costs, centers);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int batchRaycastNative(long ptr, int count, long[] refArray,
+         float[] segmentArray, float[] tArray, float[] normalArray);
+    // raycasts count segments packed start x y z, end x y z. refs are poly
+    // hints of the starts like moveAlongSurface and may be null, a hint on
+    // another floor than the start is ignored. ts gets the
+    // hit t, Float.MAX_VALUE when clear and -1 when the start is off the mesh,
+    // normals the wall normal of hits. Returns the segments that hit a wall.
+    public int batchRaycast(int count, long[] refs, float[] segments, float[] ts, float[] normals) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("batchRaycast but navi is null");
+                return 0;
+            }
+            if ((refs != null && refs.length < count) || segments.length < count * 6 || ts.length < count
+                || normals.length < count * 3) {
+                log.error("batchRaycast arrays are shorter than count {}", count);
+                return 0;
+            }
+            return batchRaycastNative(naviPtr, count, refs, segments, ts, normals);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int findRandomPointsNative(long ptr, int count, float centerX, float centerY, float centerZ,
+         float radius, int regionId, int include, int exclude, int seed, float minSpacing, float[] pointArray);
+    // up to count random points x y z on polys passing include and exclude,
+    // within radius of center when radius > 0, inside regionId when it is not
+    // 0 and at least minSpacing apart. A region without a circle draws from
+    // its own polys by area. The same seed gives the same points.
+    // Returns the points found.
+    public int findRandomPoints(int count, float centerX, float centerY, float centerZ, float radius,
+         int regionId, int include, int exclude, int seed, float minSpacing, float[] points) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("findRandomPoints but navi is null");
+                return 0;
+            }
+            if (points.length < count * 3) {
+                log.error("findRandomPoints points are shorter than count {}", count);
+                return 0;
+            }
+            return findRandomPointsNative(naviPtr, count, centerX, centerY, centerZ, radius,
+                regionId, include, exclude, seed, minSpacing, points);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int snapHeightsNative(long ptr, int count, float[] xzArray, float minY, float maxY,
+         float[] heightArray, long[] refArray);
+    // mesh height below count points packed x z, the highest surface between
+    // minY and maxY. refs may be null, else gets the poly of each point, 0
+    // where nothing covers it and its height is left at minY. Returns the
+    // points snapped.
+    public int snapHeights(int count, float[] xz, float minY, float maxY, float[] heights, long[] refs) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("snapHeights but navi is null");
+                return 0;
+            }
+            if (xz.length < count * 2 || heights.length < count || (refs != null && refs.length < count)) {
+                log.error("snapHeights arrays are shorter than count {}", count);
+                return 0;
+            }
+            return snapHeightsNative(naviPtr, count, xz, minY, maxY, heights, refs);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native float getPathDistanceNative(long ptr,
+         float startX, float startY, float startZ,
+         float endX, float endY, float endZ,
+         float sizeX, float sizeY, float sizeZ);
+    // length of the path from start to end without building its waypoints,
+    // PATH_DISTANCE_UNREACHABLE when end is not reachable and
+    // PATH_DISTANCE_PARTIAL when the search limits stopped short of it. The
+    // path of findPath is left as it was.
+    public float getPathDistance(float startX, float startY, float startZ,
+         float endX, float endY, float endZ,
+         float sizeX, float sizeY, float sizeZ) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("getPathDistance but navi is null");
+                return PATH_DISTANCE_UNREACHABLE;
+            }
+            return getPathDistanceNative(naviPtr, startX, startY, startZ,
+                endX, endY, endZ, sizeX, sizeY, sizeZ);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+
+    private native int getPathDistancesNative(long ptr, int count, float[] pairArray, float[] distanceArray);
+    // getPathDistance of count pairs packed start x y z, end x y z with the
+    // default poly size. Returns the pairs with a distance.
+    public int getPathDistances(int count, float[] pairs, float[] distances) {
+        bindCurrentThread();
+        try {
+            if (naviPtr == 0) {
+                log.error("getPathDistances but navi is null");
+                return 0;
+            }
+            if (pairs.length < count * 6 || distances.length < count) {
+                log.error("getPathDistances arrays are shorter than count {}", count);
+                return 0;
+            }
+            return getPathDistancesNative(naviPtr, count, pairs, distances);
+        } finally {
+            releaseCurrentThread();
+        }
+    }
+}